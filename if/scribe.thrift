@@ -35,7 +35,27 @@ struct LogEntry
   2:  string message
 }
 
+struct LogReply
+{
+  1:  ResultCode result,
+  2:  i32 retry_after_ms    # when to retry TRY_LATER, 0 if no suggestion
+}
+
+struct LogV2Reply
+{
+  1:  ResultCode result,    # OK only if every message was accepted
+  2:  list<bool> accepted,  # on TRY_LATER, which messages were accepted
+  3:  i32 retry_after_ms    # when to retry the rest, 0 if no suggestion
+}
+
 service scribe extends fb303.FacebookService
 {
   ResultCode Log(1: list<LogEntry> messages);
+
+  # Same as Log(), but a TRY_LATER reply also says how long to back off
+  LogReply LogWithBackoff(1: list<LogEntry> messages);
+
+  # Same as LogWithBackoff(), but messages are accepted or turned away per
+  # category, so that only the ones not accepted have to be sent again
+  LogV2Reply LogV2(1: list<LogEntry> messages);
 }
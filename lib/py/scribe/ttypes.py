@@ -98,3 +98,161 @@ class LogEntry:
   def __ne__(self, other):
     return not (self == other)
 
+
+class LogReply:
+  """
+  Attributes:
+   - result
+   - retry_after_ms
+  """
+
+  thrift_spec = (
+    None, # 0
+    (1, TType.I32, 'result', None, None, ), # 1
+    (2, TType.I32, 'retry_after_ms', None, None, ), # 2
+  )
+
+  def __init__(self, result=None, retry_after_ms=None,):
+    self.result = result
+    self.retry_after_ms = retry_after_ms
+
+  def read(self, iprot):
+    if iprot.__class__ == TBinaryProtocol.TBinaryProtocolAccelerated and isinstance(iprot.trans, TTransport.CReadableTransport) and self.thrift_spec is not None and fastbinary is not None:
+      fastbinary.decode_binary(self, iprot.trans, (self.__class__, self.thrift_spec))
+      return
+    iprot.readStructBegin()
+    while True:
+      (fname, ftype, fid) = iprot.readFieldBegin()
+      if ftype == TType.STOP:
+        break
+      if fid == 1:
+        if ftype == TType.I32:
+          self.result = iprot.readI32();
+        else:
+          iprot.skip(ftype)
+      elif fid == 2:
+        if ftype == TType.I32:
+          self.retry_after_ms = iprot.readI32();
+        else:
+          iprot.skip(ftype)
+      else:
+        iprot.skip(ftype)
+      iprot.readFieldEnd()
+    iprot.readStructEnd()
+
+  def write(self, oprot):
+    if oprot.__class__ == TBinaryProtocol.TBinaryProtocolAccelerated and self.thrift_spec is not None and fastbinary is not None:
+      oprot.trans.write(fastbinary.encode_binary(self, (self.__class__, self.thrift_spec)))
+      return
+    oprot.writeStructBegin('LogReply')
+    if self.result != None:
+      oprot.writeFieldBegin('result', TType.I32, 1)
+      oprot.writeI32(self.result)
+      oprot.writeFieldEnd()
+    if self.retry_after_ms != None:
+      oprot.writeFieldBegin('retry_after_ms', TType.I32, 2)
+      oprot.writeI32(self.retry_after_ms)
+      oprot.writeFieldEnd()
+    oprot.writeFieldStop()
+    oprot.writeStructEnd()
+
+  def __repr__(self):
+    L = ['%s=%r' % (key, value)
+      for key, value in self.__dict__.iteritems()]
+    return '%s(%s)' % (self.__class__.__name__, ', '.join(L))
+
+  def __eq__(self, other):
+    return isinstance(other, self.__class__) and self.__dict__ == other.__dict__
+
+  def __ne__(self, other):
+    return not (self == other)
+
+
+class LogV2Reply:
+  """
+  Attributes:
+   - result
+   - accepted
+   - retry_after_ms
+  """
+
+  thrift_spec = (
+    None, # 0
+    (1, TType.I32, 'result', None, None, ), # 1
+    (2, TType.LIST, 'accepted', (TType.BOOL,None), None, ), # 2
+    (3, TType.I32, 'retry_after_ms', None, None, ), # 3
+  )
+
+  def __init__(self, result=None, accepted=None, retry_after_ms=None,):
+    self.result = result
+    self.accepted = accepted
+    self.retry_after_ms = retry_after_ms
+
+  def read(self, iprot):
+    if iprot.__class__ == TBinaryProtocol.TBinaryProtocolAccelerated and isinstance(iprot.trans, TTransport.CReadableTransport) and self.thrift_spec is not None and fastbinary is not None:
+      fastbinary.decode_binary(self, iprot.trans, (self.__class__, self.thrift_spec))
+      return
+    iprot.readStructBegin()
+    while True:
+      (fname, ftype, fid) = iprot.readFieldBegin()
+      if ftype == TType.STOP:
+        break
+      if fid == 1:
+        if ftype == TType.I32:
+          self.result = iprot.readI32();
+        else:
+          iprot.skip(ftype)
+      elif fid == 2:
+        if ftype == TType.LIST:
+          self.accepted = []
+          (_etype3, _size0) = iprot.readListBegin()
+          for _i4 in xrange(_size0):
+            _elem5 = iprot.readBool();
+            self.accepted.append(_elem5)
+          iprot.readListEnd()
+        else:
+          iprot.skip(ftype)
+      elif fid == 3:
+        if ftype == TType.I32:
+          self.retry_after_ms = iprot.readI32();
+        else:
+          iprot.skip(ftype)
+      else:
+        iprot.skip(ftype)
+      iprot.readFieldEnd()
+    iprot.readStructEnd()
+
+  def write(self, oprot):
+    if oprot.__class__ == TBinaryProtocol.TBinaryProtocolAccelerated and self.thrift_spec is not None and fastbinary is not None:
+      oprot.trans.write(fastbinary.encode_binary(self, (self.__class__, self.thrift_spec)))
+      return
+    oprot.writeStructBegin('LogV2Reply')
+    if self.result != None:
+      oprot.writeFieldBegin('result', TType.I32, 1)
+      oprot.writeI32(self.result)
+      oprot.writeFieldEnd()
+    if self.accepted != None:
+      oprot.writeFieldBegin('accepted', TType.LIST, 2)
+      oprot.writeListBegin(TType.BOOL, len(self.accepted))
+      for iter6 in self.accepted:
+        oprot.writeBool(iter6)
+      oprot.writeListEnd()
+      oprot.writeFieldEnd()
+    if self.retry_after_ms != None:
+      oprot.writeFieldBegin('retry_after_ms', TType.I32, 3)
+      oprot.writeI32(self.retry_after_ms)
+      oprot.writeFieldEnd()
+    oprot.writeFieldStop()
+    oprot.writeStructEnd()
+
+  def __repr__(self):
+    L = ['%s=%r' % (key, value)
+      for key, value in self.__dict__.iteritems()]
+    return '%s(%s)' % (self.__class__.__name__, ', '.join(L))
+
+  def __eq__(self, other):
+    return isinstance(other, self.__class__) and self.__dict__ == other.__dict__
+
+  def __ne__(self, other):
+    return not (self == other)
+
@@ -0,0 +1,88 @@
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "category_table.h"
+
+pthread_mutex_t CategoryTable::lock = PTHREAD_MUTEX_INITIALIZER;
+CategoryTable::id_map_t CategoryTable::ids;
+std::string* volatile CategoryTable::chunks[CategoryTable::MAX_CHUNKS];
+volatile unsigned long CategoryTable::numIds = 0;
+unsigned long CategoryTable::limit = CategoryTable::MAX_IDS;
+const unsigned long CategoryTable::MAX_IDS;
+
+category_id_t CategoryTable::intern(const std::string& category) {
+  category_id_t id;
+  if (!addId(category, MAX_IDS, id)) {
+    throw std::runtime_error("too many categories to intern");
+  }
+  return id;
+}
+
+bool CategoryTable::tryIntern(const std::string& category,
+                              category_id_t& _return) {
+  return addId(category, 0, _return);
+}
+
+// Looks the category up, or gives it the next id unless there are max_ids
+// already. A max_ids of 0 means the configured limit.
+bool CategoryTable::addId(const std::string& category, unsigned long max_ids,
+                          category_id_t& _return) {
+  pthread_mutex_lock(&lock);
+
+  id_map_t::const_iterator iter = ids.find(category);
+  if (iter != ids.end()) {
+    _return = iter->second;
+    pthread_mutex_unlock(&lock);
+    return true;
+  }
+
+  unsigned long id = numIds;
+  if (id >= (max_ids ? max_ids : limit)) {
+    pthread_mutex_unlock(&lock);
+    return false;
+  }
+
+  unsigned long chunk = id >> CHUNK_BITS;
+  if (!chunks[chunk]) {
+    chunks[chunk] = new std::string[CHUNK_SIZE];
+  }
+  chunks[chunk][id & (CHUNK_SIZE - 1)] = category;
+  ids[category] = id;
+
+  // make the name visible before the id can be handed out
+  __sync_synchronize();
+  numIds = id + 1;
+
+  pthread_mutex_unlock(&lock);
+  _return = id;
+  return true;
+}
+
+const std::string& CategoryTable::name(category_id_t id) {
+  return chunks[id >> CHUNK_BITS][id & (CHUNK_SIZE - 1)];
+}
+
+unsigned long CategoryTable::size() {
+  return numIds;
+}
+
+void CategoryTable::setLimit(unsigned long new_limit) {
+  pthread_mutex_lock(&lock);
+  limit = std::min(std::max(new_limit, 1UL), MAX_IDS);
+  pthread_mutex_unlock(&lock);
+}
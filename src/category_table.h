@@ -0,0 +1,76 @@
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+#ifndef SCRIBE_CATEGORY_TABLE_H
+#define SCRIBE_CATEGORY_TABLE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <boost/unordered_map.hpp>
+
+typedef uint32_t category_id_t;
+
+/*
+ * Process-wide table of interned category names.
+ *
+ * Each category name is given a small integer id the first time it is
+ * seen. Messages carry the id through the stores and the name is only
+ * looked up where it leaves the process, e.g. in file contents or Thrift
+ * sends. Ids are never reused and names are never freed, so the reference
+ * returned by name() stays valid for the life of the process.
+ *
+ * Since names are never freed, categories named by senders are interned
+ * with tryIntern(), which stops at a configurable limit so that a sender
+ * making up names can't grow the table without bound. intern() is for
+ * names scribe already knows, from its config or from messages it stored
+ * before, and only fails once the table can't hold any more ids.
+ *
+ * intern() and tryIntern() take a lock; name() does not.
+ */
+class CategoryTable {
+ public:
+  // Throws std::runtime_error if the table is full
+  static category_id_t intern(const std::string& category);
+  // Returns false if the category is new and the table has reached its
+  // limit
+  static bool tryIntern(const std::string& category, category_id_t& _return);
+  static const std::string& name(category_id_t id);
+  static unsigned long size();
+  static void setLimit(unsigned long limit);
+
+ private:
+  // names are stored in chunks that are never moved once allocated
+  static const unsigned CHUNK_BITS = 12;
+  static const unsigned CHUNK_SIZE = 1 << CHUNK_BITS;
+  static const unsigned MAX_CHUNKS = 4096;
+  static const unsigned long MAX_IDS = (unsigned long) MAX_CHUNKS * CHUNK_SIZE;
+
+  typedef boost::unordered_map<std::string, category_id_t> id_map_t;
+
+  static bool addId(const std::string& category, unsigned long max_ids,
+                    category_id_t& _return);
+
+  static pthread_mutex_t lock;
+  static id_map_t ids;  // guarded by lock
+  static std::string* volatile chunks[MAX_CHUNKS];
+  static volatile unsigned long numIds;
+  static unsigned long limit;  // guarded by lock
+
+  // not instantiable
+  CategoryTable();
+};
+
+#endif // !defined SCRIBE_CATEGORY_TABLE_H
@@ -0,0 +1,76 @@
+#include "category_table.h"
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+
+#include <sstream>
+
+class CategoryTableTest : public CppUnit::TestCase {
+public:
+    CPPUNIT_TEST_SUITE(CategoryTableTest);
+    CPPUNIT_TEST(testIntern);
+    CPPUNIT_TEST(testManyCategories);
+    CPPUNIT_TEST(testLimit);
+    CPPUNIT_TEST_SUITE_END();
+
+    void testIntern() {
+        category_id_t foo = CategoryTable::intern("foo");
+        category_id_t bar = CategoryTable::intern("bar");
+
+        CPPUNIT_ASSERT(foo != bar);
+        CPPUNIT_ASSERT_EQUAL(foo, CategoryTable::intern("foo"));
+        CPPUNIT_ASSERT_EQUAL(bar, CategoryTable::intern(std::string("bar")));
+        CPPUNIT_ASSERT_EQUAL(std::string("foo"), CategoryTable::name(foo));
+        CPPUNIT_ASSERT_EQUAL(std::string("bar"), CategoryTable::name(bar));
+    }
+
+    void testManyCategories() {
+        // crosses several chunks of the name table
+        const std::string& first = CategoryTable::name(CategoryTable::intern("cat0"));
+        for (int i = 0; i < 10000; ++i) {
+            std::ostringstream name;
+            name << "cat" << i;
+            category_id_t id = CategoryTable::intern(name.str());
+            CPPUNIT_ASSERT_EQUAL(name.str(), CategoryTable::name(id));
+        }
+
+        // names never move
+        CPPUNIT_ASSERT_EQUAL(&first, &CategoryTable::name(CategoryTable::intern("cat0")));
+        CPPUNIT_ASSERT(CategoryTable::size() >= 10000);
+    }
+
+    void testLimit() {
+        category_id_t id;
+        CPPUNIT_ASSERT(CategoryTable::tryIntern("limit_known", id));
+        CategoryTable::setLimit(CategoryTable::size());
+
+        // known names are still found, new ones aren't added
+        category_id_t known;
+        CPPUNIT_ASSERT(CategoryTable::tryIntern("limit_known", known));
+        CPPUNIT_ASSERT_EQUAL(id, known);
+        unsigned long size = CategoryTable::size();
+        CPPUNIT_ASSERT(!CategoryTable::tryIntern("limit_new", id));
+        CPPUNIT_ASSERT_EQUAL(size, CategoryTable::size());
+
+        // but names scribe already stored messages for are
+        id = CategoryTable::intern("limit_stored");
+        CPPUNIT_ASSERT_EQUAL(std::string("limit_stored"), CategoryTable::name(id));
+
+        CategoryTable::setLimit(size + 10);
+        CPPUNIT_ASSERT(CategoryTable::tryIntern("limit_new", id));
+        CPPUNIT_ASSERT_EQUAL(std::string("limit_new"), CategoryTable::name(id));
+    }
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(CategoryTableTest);
+
+int main(int argc, char **argv)
+{
+  CppUnit::TextUi::TestRunner runner;
+  CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+  runner.addTest( registry.makeTest() );
+  runner.run();
+  return 0;
+}
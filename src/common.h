@@ -43,6 +43,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
 #include "boost/filesystem.hpp"
 #include <boost/filesystem/operations.hpp>
 #include <boost/filesystem/convenience.hpp>
@@ -69,8 +70,40 @@
 #include "fb303/FacebookBase.h"
 
 #include "src/gen-cpp/scribe.h"
+#include "category_table.h"
 
-typedef boost::shared_ptr<scribe::thrift::LogEntry> logentry_ptr_t;
+/*
+ * A log entry as it is queued and passed between stores. The category is
+ * interned on the way in and only turned back into a name where it leaves
+ * the process, see CategoryTable.
+ */
+struct LogMessage {
+  category_id_t categoryId;
+  std::string message;
+
+  LogMessage() : categoryId(0) {}
+  LogMessage(category_id_t category_id, const std::string& msg)
+    : categoryId(category_id), message(msg) {}
+  LogMessage(category_id_t category_id, const char* msg, size_t msg_len)
+    : categoryId(category_id), message(msg, msg_len) {}
+
+  const std::string& category() const {
+    return CategoryTable::name(categoryId);
+  }
+
+  // Thrift form of this entry for sending to another scribe server
+  scribe::thrift::LogEntry toLogEntry() const {
+    scribe::thrift::LogEntry entry;
+    entry.category = category();
+    entry.message = message;
+    return entry;
+  }
+};
+
+// Log entries are immutable once queued so that a single entry can be shared
+// by every StoreQueue a category fans out to. Stores that need to modify a
+// message must build a new entry instead.
+typedef boost::shared_ptr<const LogMessage> logentry_ptr_t;
 typedef std::vector<logentry_ptr_t> logentry_vector_t;
 typedef std::vector<std::pair<std::string, int> > server_vector_t;
 
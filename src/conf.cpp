@@ -142,9 +142,9 @@ bool StoreConf::getString(const string& stringName,
   }
   // if we didn't find any.  then try g_Handler's config
   if (!found) {
-    const StoreConf& gconf = g_Handler->getConfig();
-    string_map_t::const_iterator iter = gconf.values.find(inheritedName);
-    if (iter != gconf.values.end()) {
+    boost::shared_ptr<const StoreConf> gconf = g_Handler->getConfig();
+    string_map_t::const_iterator iter = gconf->values.find(inheritedName);
+    if (iter != gconf->values.end()) {
       _return = iter->second;
       found = true;
     }
@@ -168,6 +168,16 @@ void StoreConf::setUnsignedLongLong(const string& stringName, unsigned long long
   setString(stringName, oss.str());
 }
 
+void StoreConf::getInheritedValues(string_map_t& _return) const {
+  for (string_map_t::const_iterator iter = values.begin();
+       iter != values.end();
+       ++iter) {
+    if (iter->first.find("::") != string::npos) {
+      _return.insert(*iter);
+    }
+  }
+}
+
 // reads and parses the config data
 void StoreConf::parseConfig(const string& filename) {
 
@@ -60,6 +60,9 @@ class StoreConf {
   void setUnsigned(const std::string& intName, unsigned long value);
   void setUnsignedLongLong(const std::string& intName, unsigned long long value);
 
+  // Values of the form type::name, which stores of that type inherit
+  void getInheritedValues(string_map_t& _return) const;
+
   // Reads configuration from a file and throws an exception if it fails.
   void parseConfig(const std::string& filename);
   void setParent(pStoreConf parent);
@@ -82,13 +82,15 @@ void ConnPool::close(const string &service) {
 }
 
 int ConnPool::send(const string& hostname, unsigned long port,
-                    shared_ptr<logentry_vector_t> messages) {
-  return sendCommon(makeKey(hostname, port), messages);
+                    shared_ptr<logentry_vector_t> messages,
+                    logentry_vector_t* rejected) {
+  return sendCommon(makeKey(hostname, port), messages, rejected);
 }
 
 int ConnPool::send(const string &service,
-                    shared_ptr<logentry_vector_t> messages) {
-  return sendCommon(service, messages);
+                    shared_ptr<logentry_vector_t> messages,
+                    logentry_vector_t* rejected) {
+  return sendCommon(service, messages, rejected);
 }
 
 void ConnPool::mergeReconnectThresholds(msg_threshold_map_t *newMap,
@@ -180,13 +182,14 @@ void ConnPool::closeCommon(const string &key) {
 }
 
 int ConnPool::sendCommon(const string &key,
-                          shared_ptr<logentry_vector_t> messages) {
+                          shared_ptr<logentry_vector_t> messages,
+                          logentry_vector_t* rejected) {
   pthread_mutex_lock(&mapMutex);
   conn_map_t::iterator iter = connMap.find(key);
   if (iter != connMap.end()) {
     (*iter).second->lock();
     pthread_mutex_unlock(&mapMutex);
-    int result = (*iter).second->send(messages);
+    int result = (*iter).second->send(messages, rejected);
     (*iter).second->unlock();
     return result;
   } else {
@@ -207,7 +210,9 @@ scribeConn::scribeConn(const string& hostname, unsigned long port, int timeout_,
   lastHeartbeat(time(NULL)),
   msgThresholdBeforeReconnect(msgThresholdBeforeReconnect_),
   allowableDeltaBeforeReconnect(allowableDeltaBeforeReconnect_),
-  currThresholdBeforeReconnect(msgThresholdBeforeReconnect_) {
+  currThresholdBeforeReconnect(msgThresholdBeforeReconnect_),
+  logMethod(LOG_V2),
+  backoffUntilMs(0) {
   pthread_mutex_init(&mutex, NULL);
 #ifdef USE_ZOOKEEPER
   zkRegistrationZnode = hostname;
@@ -225,7 +230,9 @@ scribeConn::scribeConn(const string& service, const server_vector_t &servers, in
   lastHeartbeat(time(NULL)),
   msgThresholdBeforeReconnect(msgThresholdBeforeReconnect_),
   allowableDeltaBeforeReconnect(allowableDeltaBeforeReconnect_),
-  currThresholdBeforeReconnect(msgThresholdBeforeReconnect_) {
+  currThresholdBeforeReconnect(msgThresholdBeforeReconnect_),
+  logMethod(LOG_V2),
+  backoffUntilMs(0) {
   pthread_mutex_init(&mutex, NULL);
 }
 
@@ -298,9 +305,18 @@ bool scribeConn::open() {
     }
 #endif
 
-    socket = serviceBased ?
-      shared_ptr<TSocket>(new TSocketPool(serverList)) :
-      shared_ptr<TSocket>(new TSocket(remoteHost, remotePort));
+    if (serviceBased) {
+      socket = shared_ptr<TSocket>(new TSocketPool(serverList));
+    } else if (isUnixSocketHost(remoteHost)) {
+#ifdef THRIFT_POST_2_0
+      socket = shared_ptr<TSocket>(new TSocket(
+        remoteHost.substr(sizeof(UNIX_SOCKET_PREFIX) - 1)));
+#else
+      throw std::runtime_error("unix:// remote hosts need a newer Thrift");
+#endif
+    } else {
+      socket = shared_ptr<TSocket>(new TSocket(remoteHost, remotePort));
+    }
 
     if (!socket) {
       throw std::runtime_error("Failed to create socket");
@@ -402,7 +418,8 @@ void scribeConn::reopenConnectionIfNeeded() {
 }
 
 int
-scribeConn::send(boost::shared_ptr<logentry_vector_t> messages) {
+scribeConn::send(boost::shared_ptr<logentry_vector_t> messages,
+                 logentry_vector_t* rejected) {
   bool fatal;
   int size = messages->size();
 
@@ -411,6 +428,11 @@ scribeConn::send(boost::shared_ptr<logentry_vector_t> messages) {
               connectionString().c_str());
     return CONN_OK;
   }
+  if (backoffUntilMs && scribe::clock::nowInMsec() < backoffUntilMs) {
+    LOG_DEBUG("[%s] DEBUG: backing off, not sending <%d> messages",
+              connectionString().c_str(), size);
+    return CONN_TRANSIENT;
+  }
   if (!isOpen()) {
     if (!open()) {
       return (CONN_FATAL);
@@ -421,17 +443,18 @@ scribeConn::send(boost::shared_ptr<logentry_vector_t> messages) {
   // This is because thrift doesn't support vectors of pointers,
   // but we need to use them internally to avoid even more copies.
   std::vector<LogEntry> msgs;
-  map<string, int> categorySendCounts;
+  map<category_id_t, int> categorySendCounts;
   msgs.reserve(size);
   for (logentry_vector_t::iterator iter = messages->begin();
        iter != messages->end();
        ++iter) {
-    msgs.push_back(**iter);
-    categorySendCounts[(*iter)->category] += 1;
+    msgs.push_back((*iter)->toLogEntry());
+    categorySendCounts[(*iter)->categoryId] += 1;
   }
   ResultCode::type result = ResultCode::TRY_LATER;
+  std::vector<bool> accepted;
   try {
-    result = resendClient->Log(msgs);
+    result = log(msgs, accepted);
 
     if (result == ResultCode::OK) {
       sentSinceLastReconnect += size;
@@ -440,10 +463,11 @@ scribeConn::send(boost::shared_ptr<logentry_vector_t> messages) {
       // Periodically log sent message stats. While these statistics are
       // available as counters they may not be being collected, and serve
       // as heartbeats useful when diagnosing issues.
-      for (map<string, int>::iterator it = categorySendCounts.begin();
+      for (map<category_id_t, int>::iterator it = categorySendCounts.begin();
            it != categorySendCounts.end();
            ++it) {
-        sendCounts[it->first + ":" + g_Handler->resultCodeToString(result)] += it->second;
+        sendCounts[CategoryTable::name(it->first) + ":" +
+                   g_Handler->resultCodeToString(result)] += it->second;
       }
       time_t now = time(NULL);
       if (now - lastHeartbeat > 60) {
@@ -462,9 +486,24 @@ scribeConn::send(boost::shared_ptr<logentry_vector_t> messages) {
       return (CONN_OK);
     }
     fatal = false;
-    LOG_OPER("Failed to send <%d> messages, remote scribe server %s "
-        "returned error code <%d>", size, connectionString().c_str(),
-        (int) result);
+    int num_rejected = size;
+    if (rejected && !accepted.empty()) {
+      // Hand back only the messages that were turned away for our caller
+      // to retry, instead of sending the accepted ones again. messages
+      // itself may be shared with other stores, so it is left alone.
+      rejected->clear();
+      for (int i = 0; i < size; ++i) {
+        if (!accepted[i]) {
+          rejected->push_back((*messages)[i]);
+        }
+      }
+      num_rejected = rejected->size();
+      sentSinceLastReconnect += size - num_rejected;
+      g_Handler->incCounter("sent", size - num_rejected);
+    }
+    LOG_OPER("Failed to send <%d> of <%d> messages, remote scribe server %s "
+        "returned error code <%d>", num_rejected, size,
+        connectionString().c_str(), (int) result);
   } catch (const TTransportException& ttx) {
     fatal = true;
     LOG_OPER("Failed to send <%d> messages to remote scribe server %s "
@@ -489,9 +528,55 @@ scribeConn::send(boost::shared_ptr<logentry_vector_t> messages) {
 
 }
 
+// Sends messages with the newest Log() variant the remote server supports,
+// and remembers how long the server asked us to back off. If the server took
+// only some of the messages, accepted is set to which ones.
+ResultCode::type scribeConn::log(const std::vector<LogEntry>& messages,
+                                 std::vector<bool>& accepted) {
+  if (logMethod == LOG_PLAIN) {
+    return resendClient->Log(messages);
+  }
+
+  ResultCode::type result;
+  int32_t retry_after_ms;
+  try {
+    if (logMethod == LOG_V2) {
+      LogV2Reply reply;
+      resendClient->LogV2(reply, messages);
+      result = reply.result;
+      retry_after_ms = reply.retry_after_ms;
+      if (result != ResultCode::OK &&
+          reply.accepted.size() == messages.size()) {
+        accepted.swap(reply.accepted);
+      }
+    } else {
+      LogReply reply;
+      resendClient->LogWithBackoff(reply, messages);
+      result = reply.result;
+      retry_after_ms = reply.retry_after_ms;
+    }
+  } catch (const TApplicationException& tax) {
+    if (tax.getType() != TApplicationException::UNKNOWN_METHOD) {
+      throw;
+    }
+    LOG_OPER("Remote scribe server %s does not support %s",
+             connectionString().c_str(),
+             logMethod == LOG_V2 ? "LogV2" : "LogWithBackoff");
+    logMethod = (logMethod == LOG_V2) ? LOG_WITH_BACKOFF : LOG_PLAIN;
+    return log(messages, accepted);
+  }
+
+  if (result == ResultCode::TRY_LATER && retry_after_ms > 0) {
+    backoffUntilMs = scribe::clock::nowInMsec() + retry_after_ms;
+  }
+  return result;
+}
+
 std::string scribeConn::connectionString() {
         if (serviceBased) {
                 return "<" + remoteHost + " Service: " + serviceName + ">";
+        } else if (isUnixSocketHost(remoteHost)) {
+                return "<" + remoteHost + ">";
         } else {
                 char port[10];
                 snprintf(port, 10, "%lu", remotePort);
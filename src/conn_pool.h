@@ -35,6 +35,15 @@
 #define NEVER_RECONNECT   (-1)
 #define NO_THRESHOLD      (-2)
 
+// A remote host of "unix:///path/to/socket" is a Unix domain socket, for
+// which the port is ignored
+#define UNIX_SOCKET_PREFIX "unix://"
+
+inline bool isUnixSocketHost(const std::string& host) {
+  return host.compare(0, sizeof(UNIX_SOCKET_PREFIX) - 1,
+                      UNIX_SOCKET_PREFIX) == 0;
+}
+
 // Basic scribe class to manage network connections. Used by network store
 
 class scribeConn {
@@ -56,11 +65,24 @@ class scribeConn {
   bool isOpen();
   bool open();
   void close();
-  int send(boost::shared_ptr<logentry_vector_t> messages);
+  // If the remote server takes only some of the messages, the ones it
+  // turned away are put in rejected when it is given
+  int send(boost::shared_ptr<logentry_vector_t> messages,
+           logentry_vector_t* rejected = NULL);
 
  private:
   std::string connectionString();
   void reopenConnectionIfNeeded();
+  scribe::thrift::ResultCode::type log(
+    const std::vector<scribe::thrift::LogEntry>& messages,
+    std::vector<bool>& accepted);
+
+  // Log() variants, newest first
+  enum log_method_t {
+    LOG_V2,
+    LOG_WITH_BACKOFF,
+    LOG_PLAIN
+  };
 
  protected:
   boost::shared_ptr<apache::thrift::transport::TSocket> socket;
@@ -83,6 +105,9 @@ class scribeConn {
   int allowableDeltaBeforeReconnect;
   int currThresholdBeforeReconnect;
   std::map<std::string, int> sendCounts; // Periodically logged for diagnostics
+  // Moved down once the remote server turns out not to implement it
+  log_method_t logMethod;
+  unsigned long backoffUntilMs; // don't send before this, as asked by remote
 #ifdef USE_ZOOKEEPER
   std::string zkRegistrationZnode; // Where to autodiscover a remote scribe
 #endif
@@ -112,9 +137,11 @@ class ConnPool {
   void close(const std::string &service);
 
   int send(const std::string& host, unsigned long port,
-            boost::shared_ptr<logentry_vector_t> messages);
+            boost::shared_ptr<logentry_vector_t> messages,
+            logentry_vector_t* rejected = NULL);
   int send(const std::string &service,
-            boost::shared_ptr<logentry_vector_t> messages);
+            boost::shared_ptr<logentry_vector_t> messages,
+            logentry_vector_t* rejected = NULL);
   void mergeReconnectThresholds(msg_threshold_map_t *newMap,
       int newThreshold, int newDelta);
   static std::string makeKey(const std::string& name, unsigned long port);
@@ -123,7 +150,8 @@ class ConnPool {
   bool openCommon(const std::string &key, boost::shared_ptr<scribeConn> conn);
   void closeCommon(const std::string &key);
   int sendCommon(const std::string &key,
-                  boost::shared_ptr<logentry_vector_t> messages);
+                  boost::shared_ptr<logentry_vector_t> messages,
+                  logentry_vector_t* rejected);
 
  protected:
   pthread_mutex_t mapMutex;
@@ -0,0 +1,95 @@
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+#include "counter_handle.h"
+
+// separates the category from the counter name
+static const std::string category_separator = ":";
+
+pthread_mutex_t CounterHandle::lock = PTHREAD_MUTEX_INITIALIZER;
+CounterHandle::slots_map_t CounterHandle::counters;
+unsigned CounterHandle::nextShard = 0;
+__thread unsigned CounterHandle::shard = 0;
+
+CounterHandle::CounterHandle(const std::string& name) {
+  pthread_mutex_lock(&lock);
+
+  slots_map_t::iterator iter = counters.find(name);
+  if (iter != counters.end()) {
+    slots = iter->second;
+  } else {
+    // shards only keep to their own cache lines if slots start on one.
+    // Counters are never freed, so nothing has to free() this.
+    void* memory = NULL;
+    if (posix_memalign(&memory, CACHE_LINE_SIZE, sizeof(Slots)) != 0) {
+      pthread_mutex_unlock(&lock);
+      throw std::bad_alloc();
+    }
+    slots = static_cast<Slots*>(memory);
+    memset(slots, 0, sizeof(Slots));
+    counters[name] = slots;
+  }
+
+  pthread_mutex_unlock(&lock);
+}
+
+unsigned CounterHandle::threadShard() {
+  if (shard == 0) {
+    // hand out shards round robin as threads first use a counter
+    shard = __sync_fetch_and_add(&nextShard, 1) % NUM_SHARDS + 1;
+  }
+  return shard - 1;
+}
+
+int64_t CounterHandle::sum(const Slots* slots) {
+  int64_t total = 0;
+  for (unsigned i = 0; i < NUM_SHARDS; ++i) {
+    total += slots->shards[i].value;
+  }
+  return total;
+}
+
+void CounterHandle::addAll(std::map<std::string, int64_t>& _return) {
+  pthread_mutex_lock(&lock);
+  for (slots_map_t::const_iterator iter = counters.begin();
+       iter != counters.end();
+       ++iter) {
+    _return[iter->first] += sum(iter->second);
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+int64_t CounterHandle::read(const std::string& name) {
+  int64_t total = 0;
+
+  pthread_mutex_lock(&lock);
+  slots_map_t::const_iterator iter = counters.find(name);
+  if (iter != counters.end()) {
+    total = sum(iter->second);
+  }
+  pthread_mutex_unlock(&lock);
+
+  return total;
+}
+
+CategoryCounterHandle::CategoryCounterHandle(const std::string& category,
+                                             const std::string& counter)
+  : categoryCounter(category + category_separator + counter),
+    totalCounter(counter) {
+}
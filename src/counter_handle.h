@@ -0,0 +1,96 @@
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+#ifndef SCRIBE_COUNTER_HANDLE_H
+#define SCRIBE_COUNTER_HANDLE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+
+/*
+ * Handle to a named counter that many threads can increment without a lock.
+ *
+ * A handle is resolved once by name and then incremented directly. Every
+ * counter has a slot per shard, padded to its own cache line, and each
+ * thread always adds to the same shard, so threads rarely touch the same
+ * line. Slots are only summed when the counters are read. Counters are
+ * never freed, so handles can be copied and kept anywhere.
+ */
+class CounterHandle {
+ public:
+  CounterHandle() : slots(NULL) {}
+  explicit CounterHandle(const std::string& name);
+
+  bool isResolved() const { return slots != NULL; }
+
+  void inc(long amount = 1) const {
+    __sync_fetch_and_add(&slots->shards[threadShard()].value,
+                         (int64_t)amount);
+  }
+
+  // Adds the value of every counter to _return, so the result can be
+  // combined with counters kept elsewhere under the same names.
+  static void addAll(std::map<std::string, int64_t>& _return);
+
+  // Returns the value of the named counter, or 0 if it was never resolved
+  static int64_t read(const std::string& name);
+
+ private:
+  static const unsigned NUM_SHARDS = 16;
+  static const size_t CACHE_LINE_SIZE = 64;
+
+  struct Shard {
+    volatile int64_t value;
+    char padding[CACHE_LINE_SIZE - sizeof(int64_t)];
+  };
+  struct Slots {
+    Shard shards[NUM_SHARDS];
+  };
+  typedef std::map<std::string, Slots*> slots_map_t;
+
+  static unsigned threadShard();
+  static int64_t sum(const Slots* slots);
+
+  static pthread_mutex_t lock;
+  static slots_map_t counters;  // guarded by lock
+  static unsigned nextShard;
+  static __thread unsigned shard;  // this thread's shard + 1, 0 if unset
+
+  Slots* slots;
+};
+
+/*
+ * Handle to a per-category counter. Like scribeHandler::incCounter() with a
+ * category, it increments both "<category>:<counter>" and "<counter>".
+ */
+class CategoryCounterHandle {
+ public:
+  CategoryCounterHandle() {}
+  CategoryCounterHandle(const std::string& category,
+                        const std::string& counter);
+
+  void inc(long amount = 1) const {
+    categoryCounter.inc(amount);
+    totalCounter.inc(amount);
+  }
+
+ private:
+  CounterHandle categoryCounter;
+  CounterHandle totalCounter;
+};
+
+#endif // !defined SCRIBE_COUNTER_HANDLE_H
@@ -0,0 +1,80 @@
+#include "counter_handle.h"
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+
+static const int NUM_THREADS = 8;
+static const int NUM_INCREMENTS = 100000;
+
+static void* incrementThread(void* arg) {
+    const CategoryCounterHandle* counter = (const CategoryCounterHandle*)arg;
+    for (int i = 0; i < NUM_INCREMENTS; ++i) {
+        counter->inc();
+    }
+    return NULL;
+}
+
+class CounterHandleTest : public CppUnit::TestCase {
+public:
+    CPPUNIT_TEST_SUITE(CounterHandleTest);
+    CPPUNIT_TEST(testSameName);
+    CPPUNIT_TEST(testCategoryCounter);
+    CPPUNIT_TEST(testThreads);
+    CPPUNIT_TEST_SUITE_END();
+
+    void testSameName() {
+        CounterHandle a("same");
+        CounterHandle b("same");
+        a.inc();
+        b.inc(2);
+
+        CPPUNIT_ASSERT(a.isResolved());
+        CPPUNIT_ASSERT(!CounterHandle().isResolved());
+        CPPUNIT_ASSERT_EQUAL((int64_t)3, CounterHandle::read("same"));
+        CPPUNIT_ASSERT_EQUAL((int64_t)0, CounterHandle::read("never resolved"));
+    }
+
+    void testCategoryCounter() {
+        CategoryCounterHandle foo("foo", "received good");
+        CategoryCounterHandle bar("bar", "received good");
+        foo.inc(5);
+        bar.inc();
+
+        std::map<std::string, int64_t> counters;
+        counters["received good"] = 10;
+        CounterHandle::addAll(counters);
+
+        CPPUNIT_ASSERT_EQUAL((int64_t)5, counters["foo:received good"]);
+        CPPUNIT_ASSERT_EQUAL((int64_t)1, counters["bar:received good"]);
+        CPPUNIT_ASSERT_EQUAL((int64_t)16, counters["received good"]);
+    }
+
+    void testThreads() {
+        CategoryCounterHandle counter("threaded", "count");
+        pthread_t threads[NUM_THREADS];
+        for (int i = 0; i < NUM_THREADS; ++i) {
+            pthread_create(&threads[i], NULL, incrementThread, &counter);
+        }
+        for (int i = 0; i < NUM_THREADS; ++i) {
+            pthread_join(threads[i], NULL);
+        }
+
+        CPPUNIT_ASSERT_EQUAL((int64_t)NUM_THREADS * NUM_INCREMENTS,
+                             CounterHandle::read("threaded:count"));
+        CPPUNIT_ASSERT_EQUAL((int64_t)NUM_THREADS * NUM_INCREMENTS,
+                             CounterHandle::read("count"));
+    }
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(CounterHandleTest);
+
+int main(int argc, char **argv)
+{
+  CppUnit::TextUi::TestRunner runner;
+  CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+  runner.addTest( registry.makeTest() );
+  runner.run();
+  return 0;
+}
@@ -21,8 +21,16 @@
 // @author Avinash Lakshman
 // @author Anthony Giardullo
 
+#include <netdb.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
 #include "common.h"
 #include "scribe_server.h"
+#include "log_processor.h"
 
 using namespace apache::thrift;
 using namespace apache::thrift::protocol;
@@ -95,14 +103,172 @@ uint32_t scribe::strhash::hash32(const char *s) {
 /*
  * Starting a scribe server.
  */
+
+#ifdef THRIFT_POST_2_0
+// Opens a listening socket on port with SO_REUSEPORT set, so that every I/O
+// reactor can listen on the same port with its own socket and the kernel
+// spreads new connections across them.
+static int openReusePortSocket(unsigned long port) {
+  struct addrinfo hints, *res, *res0;
+  char port_str[sizeof("65535")];
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = PF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG;
+  snprintf(port_str, sizeof(port_str), "%lu", port);
+
+  int error = getaddrinfo(NULL, port_str, &hints, &res0);
+  if (error) {
+    LOG_OPER("getaddrinfo failed for port %lu: %s", port, gai_strerror(error));
+    throw std::runtime_error("getaddrinfo failed");
+  }
+
+  // prefer IPv6, which also accepts IPv4 connections
+  for (res = res0; res; res = res->ai_next) {
+    if (res->ai_family == AF_INET6 || res->ai_next == NULL) {
+      break;
+    }
+  }
+
+  int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if (fd == -1) {
+    freeaddrinfo(res0);
+    throw std::runtime_error("failed to create listening socket");
+  }
+
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == -1) {
+    LOG_OPER("setsockopt SO_REUSEPORT failed: %s", strerror(errno));
+    close(fd);
+    freeaddrinfo(res0);
+    throw std::runtime_error("failed to set SO_REUSEPORT");
+  }
+#ifdef IPV6_V6ONLY
+  if (res->ai_family == AF_INET6) {
+    int zero = 0;
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+  }
+#endif
+
+  if (bind(fd, res->ai_addr, res->ai_addrlen) == -1 ||
+      listen(fd, SOMAXCONN) == -1) {
+    LOG_OPER("failed to listen on port %lu: %s", port, strerror(errno));
+    close(fd);
+    freeaddrinfo(res0);
+    throw std::runtime_error("failed to listen on port");
+  }
+
+  freeaddrinfo(res0);
+  return fd;
+}
+
+// Opens a listening Unix domain socket at path, replacing a socket a
+// previous run left there. Refuses to take over a socket another scribed
+// is still listening on.
+static int openUnixSocket(const std::string& path, unsigned long mode) {
+  struct sockaddr_un addr;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    LOG_OPER("unix_socket_path <%s> is too long", path.c_str());
+    throw std::runtime_error("unix_socket_path too long");
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path.data(), path.size());
+
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      LOG_OPER("not replacing <%s>, which is not a socket", path.c_str());
+      throw std::runtime_error("unix_socket_path is not a socket");
+    }
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe == -1) {
+      throw std::runtime_error("failed to create Unix domain socket");
+    }
+    int result = connect(probe, (struct sockaddr*)&addr, sizeof(addr));
+    int error = errno;
+    close(probe);
+    if (result == 0) {
+      LOG_OPER("another server is listening on <%s>", path.c_str());
+      throw std::runtime_error("Unix domain socket in use");
+    }
+    if (error != ECONNREFUSED) {
+      LOG_OPER("failed to check for a server on <%s>: %s", path.c_str(),
+               strerror(error));
+      throw std::runtime_error("failed to check Unix domain socket");
+    }
+    // left behind by a server that is gone
+    unlink(path.c_str());
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) {
+    throw std::runtime_error("failed to create Unix domain socket");
+  }
+
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+      listen(fd, SOMAXCONN) == -1) {
+    LOG_OPER("failed to listen on <%s>: %s", path.c_str(), strerror(errno));
+    close(fd);
+    throw std::runtime_error("failed to listen on Unix domain socket");
+  }
+
+  if (chmod(path.c_str(), mode) == -1) {
+    LOG_OPER("failed to set mode %lo on <%s>: %s", mode, path.c_str(),
+             strerror(errno));
+  }
+  return fd;
+}
+#endif
+
+// Pins the calling thread to one core, chosen round robin by reactor number
+static void pinReactor(size_t reactor) {
+  long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_cores <= 0) {
+    return;
+  }
+
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(reactor % num_cores, &cpus);
+  int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  if (error) {
+    LOG_OPER("failed to pin I/O reactor %lu to core %ld: %s",
+             (unsigned long)reactor, (long)(reactor % num_cores),
+             strerror(error));
+  }
+}
+
+struct ReactorArgs {
+  size_t reactor;
+  bool pin;
+  shared_ptr<TNonblockingServer> server;
+};
+
+static void* reactorThread(void* arg) {
+  ReactorArgs* args = (ReactorArgs*)arg;
+  if (args->pin) {
+    pinReactor(args->reactor);
+  }
+  args->server->serve();
+  delete args;
+  return NULL;
+}
+
 // note: this function uses global g_Handler.
 void scribe::startServer() {
-  boost::shared_ptr<TProcessor> processor(new scribeProcessor(g_Handler));
+  boost::shared_ptr<TProcessor> processor(new LogBatchProcessor(g_Handler));
   /* This factory is for binary compatibility. */
   boost::shared_ptr<TProtocolFactory> protocol_factory(
     new TBinaryProtocolFactory(0, 0, false, false)
   );
   boost::shared_ptr<ThreadManager> thread_manager;
+#ifdef THRIFT_POST_2_0
+  // lets Log() account each request to the client that sent it
+  boost::shared_ptr<TServerEventHandler> event_handler(new PeerEventHandler);
+#endif
 
   if (g_Handler->numThriftServerThreads > 1) {
     // create a ThreadManager to process incoming calls
@@ -115,27 +281,98 @@ void scribe::startServer() {
     thread_manager->start();
   }
 
-  shared_ptr<TNonblockingServer> server(new TNonblockingServer(
-                                          processor,
-                                          protocol_factory,
-                                          g_Handler->port,
-                                          thread_manager
-                                        ));
-  g_Handler->setServer(server);
-  LOG_OPER("Starting scribe server on port %lu", g_Handler->port);
-  fflush(stderr);
+  size_t num_reactors = g_Handler->numIoReactors;
+#ifndef THRIFT_POST_2_0
+  if (num_reactors > 1) {
+    LOG_OPER("num_io_reactors needs a newer Thrift, using one I/O reactor");
+    num_reactors = 1;
+  }
+#endif
 
-#ifdef THRIFT_POST_2_0    
-  // throttle concurrent connections
-  unsigned long mconn = g_Handler->getMaxConn();
-  if (mconn > 0) {
-    LOG_OPER("Throttle max_conn to %lu", mconn);
-    server->setMaxConnections(mconn);
-    server->setOverloadAction(T_OVERLOAD_CLOSE_ON_ACCEPT);
+  // Every reactor runs its own event loop and listening socket, and they
+  // all share the processor, handler and ThreadManager
+  std::vector<shared_ptr<TNonblockingServer> > servers;
+  for (size_t i = 0; i < num_reactors; ++i) {
+    shared_ptr<TNonblockingServer> server(new TNonblockingServer(
+                                            processor,
+                                            protocol_factory,
+                                            g_Handler->port,
+                                            thread_manager
+                                          ));
+#ifdef THRIFT_POST_2_0
+    server->setServerEventHandler(event_handler);
+    if (num_reactors > 1) {
+      server->listenSocket(openReusePortSocket(g_Handler->port));
+    }
+
+    // throttle concurrent connections, split evenly across reactors
+    unsigned long mconn = g_Handler->getMaxConn();
+    if (mconn > 0) {
+      unsigned long reactor_mconn = mconn / num_reactors;
+      if (reactor_mconn == 0) {
+        reactor_mconn = 1;
+      }
+      if (i == 0) {
+        LOG_OPER("Throttle max_conn to %lu", mconn);
+      }
+      server->setMaxConnections(reactor_mconn);
+      server->setOverloadAction(T_OVERLOAD_CLOSE_ON_ACCEPT);
+    }
+#endif
+
+    g_Handler->addServer(server);
+    servers.push_back(server);
   }
+
+  // Co-located clients can skip the TCP loopback stack. The Unix domain
+  // socket gets an event loop of its own.
+  if (!g_Handler->unixSocketPath.empty()) {
+#ifdef THRIFT_POST_2_0
+    shared_ptr<TNonblockingServer> server(new TNonblockingServer(
+                                            processor,
+                                            protocol_factory,
+                                            g_Handler->port,
+                                            thread_manager
+                                          ));
+    server->setServerEventHandler(event_handler);
+    server->listenSocket(openUnixSocket(g_Handler->unixSocketPath,
+                                        g_Handler->unixSocketMode));
+    g_Handler->addServer(server);
+    servers.push_back(server);
+    LOG_OPER("Also serving on Unix domain socket <%s>",
+             g_Handler->unixSocketPath.c_str());
+#else
+    LOG_OPER("unix_socket_path needs a newer Thrift, not listening on <%s>",
+             g_Handler->unixSocketPath.c_str());
 #endif
+  }
 
-  server->serve();
+  LOG_OPER("Starting scribe server on port %lu with %lu I/O reactors",
+           g_Handler->port, (unsigned long)num_reactors);
+  fflush(stderr);
+
+  for (size_t i = 1; i < servers.size(); ++i) {
+    ReactorArgs* args = new ReactorArgs;
+    args->reactor = i;
+    args->pin = num_reactors > 1;
+    args->server = servers[i];
+
+    pthread_t thread;
+    int error = pthread_create(&thread, NULL, reactorThread, (void*) args);
+    if (error) {
+      delete args;
+      LOG_OPER("failed to start I/O reactor %lu: %s",
+               (unsigned long)i, strerror(error));
+      throw std::runtime_error("failed to start I/O reactor");
+    }
+    pthread_detach(thread);
+  }
+
+  // the first reactor runs on this thread
+  if (num_reactors > 1) {
+    pinReactor(0);
+  }
+  servers[0]->serve();
   // this function never returns
 }
 
@@ -39,7 +39,7 @@
 #include "src/gen-cpp/scribe.h"
 #include "src/gen-cpp/BucketStoreMapping.h"
 
-typedef boost::shared_ptr<scribe::thrift::LogEntry> logentry_ptr_t;
+typedef boost::shared_ptr<const LogMessage> logentry_ptr_t;
 typedef std::vector<logentry_ptr_t> logentry_vector_t;
 typedef std::vector<std::pair<std::string, int> > server_vector_t;
 
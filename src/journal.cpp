@@ -0,0 +1,476 @@
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+#include <fcntl.h>
+#include <algorithm>
+#include <set>
+
+#include "journal.h"
+
+using std::string;
+
+// Each record is a checksum, the category and message lengths, then the
+// category and message. All integers are 32 bit little endian.
+static const uint32_t RECORD_HEADER_SIZE = 12;
+
+// When everything written so far has been handled, start a new segment
+// once the current one is at least this big so the old one can be deleted
+// and little has to be replayed after a crash.
+static const uint64_t MIN_ROTATE_BYTES = 1024 * 1024;
+
+static void putUint32(string& buf, uint32_t value) {
+  buf += (char)(value & 0xff);
+  buf += (char)((value >> 8) & 0xff);
+  buf += (char)((value >> 16) & 0xff);
+  buf += (char)((value >> 24) & 0xff);
+}
+
+static uint32_t getUint32(const char* p) {
+  const unsigned char* u = (const unsigned char*)p;
+  return (uint32_t)u[0] | ((uint32_t)u[1] << 8) |
+    ((uint32_t)u[2] << 16) | ((uint32_t)u[3] << 24);
+}
+
+// Base filenames of the journals that are open. A store being replaced by
+// reinitialize() keeps its journal until it has been stopped, and the store
+// replacing it must not replay or write the same segments in the meantime.
+static pthread_mutex_t openJournalsMutex = PTHREAD_MUTEX_INITIALIZER;
+static std::set<string> openJournals;
+
+// 32 bit FNV-1a
+static uint32_t checksum(const char* data, size_t len,
+                         uint32_t hash = 2166136261U) {
+  for (size_t i = 0; i < len; ++i) {
+    hash ^= (unsigned char)data[i];
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+Journal::Journal(const string& base_filename,
+                 unsigned long long segment_size)
+  : baseFilename(base_filename),
+    segmentSize(segment_size),
+    appendPos(0),
+    durablePos(0),
+    releasedPos(0),
+    syncing(false),
+    failed(false),
+    registered(false),
+    fd(-1),
+    segmentBytes(0),
+    syncCounter("journal syncs"),
+    syncBytesCounter("journal bytes synced") {
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&committed, NULL);
+}
+
+Journal::~Journal() {
+  if (fd >= 0) {
+    ::close(fd);
+  }
+  unregister();
+  pthread_mutex_destroy(&lock);
+  pthread_cond_destroy(&committed);
+}
+
+string Journal::segmentFilename(uint64_t start) {
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".%020llu", (unsigned long long)start);
+  return baseFilename + suffix;
+}
+
+bool Journal::isOpen(const string& base_filename) {
+  pthread_mutex_lock(&openJournalsMutex);
+  bool is_open = openJournals.count(base_filename) != 0;
+  pthread_mutex_unlock(&openJournalsMutex);
+  return is_open;
+}
+
+void Journal::unregister() {
+  if (registered) {
+    pthread_mutex_lock(&openJournalsMutex);
+    openJournals.erase(baseFilename);
+    pthread_mutex_unlock(&openJournalsMutex);
+    registered = false;
+  }
+}
+
+bool Journal::open(logentry_vector_t& replayed) {
+  pthread_mutex_lock(&openJournalsMutex);
+  registered = openJournals.insert(baseFilename).second;
+  pthread_mutex_unlock(&openJournalsMutex);
+  if (!registered) {
+    LOG_OPER("Journal <%s> is still open by another store",
+             baseFilename.c_str());
+    return false;
+  }
+
+  boost::filesystem::path base(baseFilename);
+  string dir = base.parent_path().string();
+  string prefix = base.filename().string() + ".";
+
+  if (dir.empty()) {
+    dir = ".";
+  }
+
+  // find the segments left by the last run
+  try {
+    boost::filesystem::create_directories(dir);
+    boost::filesystem::directory_iterator dir_iter(dir), end_iter;
+    for ( ; dir_iter != end_iter; ++dir_iter) {
+      string filename = dir_iter->path().filename().string();
+      if (filename.compare(0, prefix.size(), prefix) != 0) {
+        continue;
+      }
+      char* end;
+      Segment segment;
+      segment.start = strtoull(filename.c_str() + prefix.size(), &end, 10);
+      if (*end != '\0' || end == filename.c_str() + prefix.size()) {
+        continue;
+      }
+      segment.filename = dir_iter->path().string();
+      segments.push_back(segment);
+    }
+  } catch (const std::exception& e) {
+    LOG_OPER("Failed to list journal directory <%s>: %s",
+             dir.c_str(), e.what());
+    return false;
+  }
+
+  std::sort(segments.begin(), segments.end(), segmentLess);
+
+  for (std::deque<Segment>::iterator iter = segments.begin();
+       iter != segments.end();
+       ++iter) {
+    // A batch that failed to write is written again at the start of a new
+    // segment, so whatever made it into the old one past there is also in
+    // the new one
+    uint64_t limit = (uint64_t)-1;
+    if (iter + 1 != segments.end()) {
+      limit = (iter + 1)->start - iter->start;
+    }
+    uint64_t length = 0;
+    if (!replaySegment(*iter, limit, replayed, length)) {
+      return false;
+    }
+    appendPos = std::max(appendPos, iter->start + length);
+  }
+  durablePos = appendPos;
+  releasedPos = segments.empty() ? appendPos : segments.front().start;
+
+  if (!replayed.empty()) {
+    LOG_OPER("Replayed <%lu> messages from journal <%s>",
+             (unsigned long)replayed.size(), baseFilename.c_str());
+  }
+
+  if (!openSegment(appendPos)) {
+    return false;
+  }
+  // an empty segment from the last run is reused
+  if (segments.empty() || segments.back().start != appendPos) {
+    Segment segment;
+    segment.start = appendPos;
+    segment.filename = segmentFilename(appendPos);
+    segments.push_back(segment);
+  }
+  return true;
+}
+
+bool Journal::segmentLess(const Segment& a, const Segment& b) {
+  return a.start < b.start;
+}
+
+bool Journal::replaySegment(const Segment& segment, uint64_t limit,
+                            logentry_vector_t& replayed,
+                            uint64_t& length) {
+  FILE* file = fopen(segment.filename.c_str(), "r");
+  if (!file) {
+    LOG_OPER("Failed to open journal segment <%s>: %s",
+             segment.filename.c_str(), strerror(errno));
+    return false;
+  }
+
+  string data;
+  char buf[65536];
+  size_t num_read;
+  while ((num_read = fread(buf, 1, sizeof(buf), file)) > 0) {
+    data.append(buf, num_read);
+  }
+  bool read_error = ferror(file);
+  fclose(file);
+  if (read_error) {
+    LOG_OPER("Failed to read journal segment <%s>",
+             segment.filename.c_str());
+    return false;
+  }
+
+  // positions of later segments are based on the whole file, torn or not
+  length = data.size();
+  if (data.size() > limit) {
+    LOG_OPER("Ignoring <%lu> bytes of journal segment <%s> rewritten in the "
+             "next segment", (unsigned long)(data.size() - limit),
+             segment.filename.c_str());
+    data.resize(limit);
+  }
+
+  category_id_t category_id = 0;
+  string last_category;
+  size_t pos = 0;
+  while (data.size() - pos >= RECORD_HEADER_SIZE) {
+    const char* header = data.data() + pos;
+    uint32_t category_len = getUint32(header + 4);
+    uint32_t message_len = getUint32(header + 8);
+    uint64_t record_len =
+      (uint64_t)RECORD_HEADER_SIZE + category_len + message_len;
+    if (record_len > data.size() - pos) {
+      break;
+    }
+
+    const char* category = header + RECORD_HEADER_SIZE;
+    const char* message = category + category_len;
+    if (checksum(header + 4, record_len - 4) != getUint32(header)) {
+      break;
+    }
+
+    if (replayed.empty() || last_category.size() != category_len ||
+        last_category.compare(0, category_len, category, category_len) != 0) {
+      last_category.assign(category, category_len);
+      category_id = CategoryTable::intern(last_category);
+    }
+    replayed.push_back(
+      boost::make_shared<LogMessage>(category_id, message, message_len));
+    pos += record_len;
+  }
+
+  if (pos != data.size()) {
+    // a crash during a write can leave a partial record at the end
+    LOG_OPER("Ignoring <%lu> bytes at the end of journal segment <%s>",
+             (unsigned long)(data.size() - pos), segment.filename.c_str());
+  }
+  return true;
+}
+
+// Creates the segment that starts at start and makes it the one written to
+bool Journal::openSegment(uint64_t start) {
+  if (fd >= 0) {
+    ::close(fd);
+    fd = -1;
+  }
+
+  string filename = segmentFilename(start);
+  fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+              0644);
+  if (fd < 0) {
+    LOG_OPER("Failed to create journal segment <%s>: %s",
+             filename.c_str(), strerror(errno));
+    return false;
+  }
+  segmentBytes = 0;
+
+  // make the new directory entry durable too
+  string dir = boost::filesystem::path(filename).parent_path().string();
+  int dir_fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+  if (dir_fd >= 0) {
+    fsync(dir_fd);
+    ::close(dir_fd);
+  }
+  return true;
+}
+
+uint64_t Journal::append(const logentry_vector_t& entries) {
+  pthread_mutex_lock(&lock);
+
+  if (failed) {
+    // nothing more can become durable
+    uint64_t position = appendPos + 1;
+    pthread_mutex_unlock(&lock);
+    return position;
+  }
+
+  size_t old_size = buffer.size();
+  for (logentry_vector_t::const_iterator iter = entries.begin();
+       iter != entries.end();
+       ++iter) {
+    const string& category = (*iter)->category();
+    const string& message = (*iter)->message;
+
+    size_t record_start = buffer.size();
+    putUint32(buffer, 0);  // checksum, filled in below
+    putUint32(buffer, category.size());
+    putUint32(buffer, message.size());
+    buffer += category;
+    buffer += message;
+
+    uint32_t sum = checksum(buffer.data() + record_start + 4,
+                            buffer.size() - record_start - 4);
+    for (int i = 0; i < 4; ++i) {
+      buffer[record_start + i] = (char)((sum >> (8 * i)) & 0xff);
+    }
+  }
+  appendPos += buffer.size() - old_size;
+
+  uint64_t position = appendPos;
+  pthread_mutex_unlock(&lock);
+  return position;
+}
+
+uint64_t Journal::end() {
+  pthread_mutex_lock(&lock);
+  uint64_t position = appendPos;
+  pthread_mutex_unlock(&lock);
+  return position;
+}
+
+bool Journal::waitDurable(uint64_t position) {
+  pthread_mutex_lock(&lock);
+
+  while (durablePos < position && !failed) {
+    if (syncing) {
+      pthread_cond_wait(&committed, &lock);
+      continue;
+    }
+
+    // Nobody is writing, so write out everything buffered so far. Callers
+    // that append in the meantime wait and go in the next batch.
+    syncing = true;
+    string batch;
+    batch.swap(buffer);
+    uint64_t batch_start = durablePos;
+    uint64_t batch_end = appendPos;
+    bool rotate = releasedPos >= batch_start;
+    pthread_mutex_unlock(&lock);
+
+    bool ok = writeBatch(batch, batch_start, rotate);
+    if (!ok) {
+      // try once more in a new segment
+      ok = writeBatch(batch, batch_start, true);
+    }
+
+    pthread_mutex_lock(&lock);
+    syncing = false;
+    if (ok) {
+      durablePos = batch_end;
+    } else {
+      LOG_OPER("Failed to write journal <%s>, giving up on it",
+               baseFilename.c_str());
+      failed = true;
+    }
+    pthread_cond_broadcast(&committed);
+  }
+
+  bool durable = durablePos >= position;
+  pthread_mutex_unlock(&lock);
+  return durable;
+}
+
+// Writes and syncs batch, which starts at batch_start. Called without the
+// lock by the one caller that is syncing. If rotate is set, everything
+// before batch_start has been handled, so a new segment can be started
+// early.
+bool Journal::writeBatch(const string& batch, uint64_t batch_start,
+                         bool rotate) {
+  if (fd < 0 || segmentBytes >= segmentSize ||
+      (rotate && segmentBytes >= MIN_ROTATE_BYTES)) {
+    if (!openSegment(batch_start)) {
+      return false;
+    }
+    Segment segment;
+    segment.start = batch_start;
+    segment.filename = segmentFilename(batch_start);
+
+    pthread_mutex_lock(&lock);
+    if (segments.empty() || segments.back().start != batch_start) {
+      segments.push_back(segment);
+    }
+    pthread_mutex_unlock(&lock);
+  }
+
+  size_t written = 0;
+  while (written < batch.size()) {
+    ssize_t result = write(fd, batch.data() + written, batch.size() - written);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG_OPER("Failed to write journal segment for <%s>: %s",
+               baseFilename.c_str(), strerror(errno));
+      abandonSegment();
+      return false;
+    }
+    written += result;
+  }
+
+  if (fdatasync(fd) != 0) {
+    LOG_OPER("Failed to sync journal segment for <%s>: %s",
+             baseFilename.c_str(), strerror(errno));
+    abandonSegment();
+    return false;
+  }
+
+  segmentBytes += batch.size();
+  syncCounter.inc();
+  syncBytesCounter.inc(batch.size());
+  return true;
+}
+
+// Stops writing to the current segment after a failed write. The caller
+// writes the batch again in a new segment, so the part of it that made it
+// into this one is cut off; open() also skips it if this fails.
+void Journal::abandonSegment() {
+  if (ftruncate(fd, segmentBytes) != 0) {
+    LOG_OPER("Failed to truncate journal segment for <%s>: %s",
+             baseFilename.c_str(), strerror(errno));
+  }
+  ::close(fd);
+  fd = -1;
+}
+
+void Journal::release(uint64_t position) {
+  pthread_mutex_lock(&lock);
+
+  releasedPos = std::max(releasedPos, position);
+
+  // a segment can go once the next one starts at or before position
+  while (segments.size() > 1 && segments[1].start <= releasedPos) {
+    if (unlink(segments.front().filename.c_str()) != 0) {
+      LOG_OPER("Failed to delete journal segment <%s>: %s",
+               segments.front().filename.c_str(), strerror(errno));
+    }
+    segments.pop_front();
+  }
+
+  pthread_mutex_unlock(&lock);
+}
+
+void Journal::close() {
+  pthread_mutex_lock(&lock);
+
+  if (releasedPos >= appendPos && !syncing) {
+    for (std::deque<Segment>::iterator iter = segments.begin();
+         iter != segments.end();
+         ++iter) {
+      unlink(iter->filename.c_str());
+    }
+    segments.clear();
+  }
+  if (fd >= 0 && !syncing) {
+    ::close(fd);
+    fd = -1;
+  }
+  unregister();
+
+  pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,108 @@
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+#ifndef SCRIBE_JOURNAL_H
+#define SCRIBE_JOURNAL_H
+
+#include <deque>
+
+#include "common.h"
+#include "counter_handle.h"
+
+/*
+ * Write-ahead journal for the messages of one StoreQueue.
+ *
+ * Messages are appended to an in-memory buffer and made durable with group
+ * commit: the first caller that has to wait writes everything buffered so
+ * far and calls fdatasync once, while the callers that arrive in the
+ * meantime wait for it and are covered by the next sync. Positions are
+ * byte offsets that keep growing across segment files, which are named
+ * <base_filename>.<first position>. A segment is deleted once the store has
+ * handled every message in it, see release().
+ */
+class Journal {
+ public:
+  Journal(const std::string& base_filename,
+          unsigned long long segment_size);
+  ~Journal();
+
+  // Reads the messages left in existing segments into replayed and starts
+  // a new segment. Must be called before anything else. Fails if another
+  // Journal has the same base_filename open.
+  bool open(logentry_vector_t& replayed);
+
+  // Whether a Journal has base_filename open and not closed yet
+  static bool isOpen(const std::string& base_filename);
+
+  // Buffers entries and returns the position to pass to waitDurable()
+  uint64_t append(const logentry_vector_t& entries);
+
+  // Position after the last appended message
+  uint64_t end();
+
+  // Blocks until everything before position is on disk. Returns false if
+  // a write failed, after which nothing more is made durable.
+  bool waitDurable(uint64_t position);
+
+  // Everything before position has been handled and is no longer needed
+  void release(uint64_t position);
+
+  // Deletes every segment if everything appended has been released, and
+  // lets another Journal open the same base_filename
+  void close();
+
+ private:
+  struct Segment {
+    uint64_t start;
+    std::string filename;
+  };
+
+  static bool segmentLess(const Segment& a, const Segment& b);
+  std::string segmentFilename(uint64_t start);
+  bool replaySegment(const Segment& segment, uint64_t limit,
+                     logentry_vector_t& replayed, uint64_t& length);
+  bool openSegment(uint64_t start);
+  void abandonSegment();
+  bool writeBatch(const std::string& batch, uint64_t batch_start,
+                  bool rotate);
+  void unregister();
+
+  std::string baseFilename;
+  unsigned long long segmentSize;
+
+  pthread_mutex_t lock;
+  pthread_cond_t committed;
+  std::string buffer;        // appended but not yet written
+  uint64_t appendPos;        // position after the last appended message
+  uint64_t durablePos;       // everything before this is on disk
+  uint64_t releasedPos;      // everything before this has been handled
+  bool syncing;              // a caller is writing out a batch
+  bool failed;
+  bool registered;           // holds baseFilename in the open journals
+  std::deque<Segment> segments;  // oldest first, the last one is written to
+  // lock guards everything above. The current segment is only used by
+  // the caller writing out a batch.
+  int fd;
+  uint64_t segmentBytes;
+
+  CounterHandle syncCounter;
+  CounterHandle syncBytesCounter;
+
+  // disallow copy and assignment
+  Journal(const Journal& rhs);
+  Journal& operator=(const Journal& rhs);
+};
+
+#endif // !defined SCRIBE_JOURNAL_H
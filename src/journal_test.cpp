@@ -0,0 +1,199 @@
+#include "journal.h"
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+
+#include <fstream>
+#include <sstream>
+#include <boost/filesystem/operations.hpp>
+
+using namespace std;
+
+class JournalTest : public CppUnit::TestCase {
+public:
+    CPPUNIT_TEST_SUITE(JournalTest);
+    CPPUNIT_TEST(testReplay);
+    CPPUNIT_TEST(testRelease);
+    CPPUNIT_TEST(testTornTail);
+    CPPUNIT_TEST(testRewrittenBatch);
+    CPPUNIT_TEST(testInUse);
+    CPPUNIT_TEST_SUITE_END();
+
+    string dir;
+
+    void setUp() {
+        dir = boost::filesystem::temp_directory_path().string() +
+          "/journal_test." + boost::filesystem::unique_path().string();
+        boost::filesystem::create_directories(dir);
+    }
+
+    void tearDown() {
+        boost::filesystem::remove_all(dir);
+    }
+
+    logentry_vector_t makeEntries(int count) {
+        logentry_vector_t entries;
+        category_id_t id = CategoryTable::intern("journal_test");
+        for (int i = 0; i < count; ++i) {
+            ostringstream message;
+            message << "message " << i << "\n";
+            entries.push_back(boost::make_shared<LogMessage>(id, message.str()));
+        }
+        return entries;
+    }
+
+    int countSegments() {
+        int count = 0;
+        for (boost::filesystem::directory_iterator iter(dir);
+             iter != boost::filesystem::directory_iterator();
+             ++iter) {
+            ++count;
+        }
+        return count;
+    }
+
+    void testReplay() {
+        logentry_vector_t entries = makeEntries(100);
+        {
+            Journal journal(dir + "/test", 1024);
+            logentry_vector_t replayed;
+            CPPUNIT_ASSERT(journal.open(replayed));
+            CPPUNIT_ASSERT(replayed.empty());
+
+            uint64_t position = 0;
+            for (int i = 0; i < 100; i += 10) {
+                logentry_vector_t batch(entries.begin() + i, entries.begin() + i + 10);
+                position = journal.append(batch);
+            }
+            CPPUNIT_ASSERT_EQUAL(position, journal.end());
+            CPPUNIT_ASSERT(journal.waitDurable(position));
+            // nothing released, so the segments survive close()
+            journal.close();
+        }
+
+        Journal journal(dir + "/test", 1024);
+        logentry_vector_t replayed;
+        CPPUNIT_ASSERT(journal.open(replayed));
+        CPPUNIT_ASSERT_EQUAL(entries.size(), replayed.size());
+        for (size_t i = 0; i < entries.size(); ++i) {
+            CPPUNIT_ASSERT_EQUAL(entries[i]->category(), replayed[i]->category());
+            CPPUNIT_ASSERT_EQUAL(entries[i]->message, replayed[i]->message);
+        }
+    }
+
+    void testRelease() {
+        Journal journal(dir + "/test", 256);
+        logentry_vector_t replayed;
+        CPPUNIT_ASSERT(journal.open(replayed));
+
+        uint64_t position = 0;
+        logentry_vector_t entries = makeEntries(10);
+        for (int i = 0; i < 20; ++i) {
+            position = journal.append(entries);
+            CPPUNIT_ASSERT(journal.waitDurable(position));
+        }
+        CPPUNIT_ASSERT(countSegments() > 1);
+
+        journal.release(position);
+        journal.close();
+        CPPUNIT_ASSERT_EQUAL(0, countSegments());
+    }
+
+    void testTornTail() {
+        logentry_vector_t entries = makeEntries(10);
+        {
+            Journal journal(dir + "/test", 1024 * 1024);
+            logentry_vector_t replayed;
+            CPPUNIT_ASSERT(journal.open(replayed));
+            CPPUNIT_ASSERT(journal.waitDurable(journal.append(entries)));
+            journal.close();
+        }
+
+        // a crash in the middle of a write leaves part of a record behind
+        boost::filesystem::directory_iterator segment(dir);
+        {
+            ofstream out(segment->path().string().c_str(), ios::app | ios::binary);
+            out.write("\x01\x02\x03\x04\x05", 5);
+        }
+
+        Journal journal(dir + "/test", 1024 * 1024);
+        logentry_vector_t replayed;
+        CPPUNIT_ASSERT(journal.open(replayed));
+        CPPUNIT_ASSERT_EQUAL(entries.size(), replayed.size());
+        CPPUNIT_ASSERT_EQUAL(entries.back()->message, replayed.back()->message);
+    }
+
+    void testRewrittenBatch() {
+        logentry_vector_t entries = makeEntries(10);
+        logentry_vector_t first(entries.begin(), entries.begin() + 5);
+        logentry_vector_t second(entries.begin() + 5, entries.end());
+        uint64_t first_end;
+        {
+            Journal journal(dir + "/test", 1024 * 1024);
+            logentry_vector_t replayed;
+            CPPUNIT_ASSERT(journal.open(replayed));
+            first_end = journal.append(first);
+            CPPUNIT_ASSERT(journal.waitDurable(first_end));
+            CPPUNIT_ASSERT(journal.waitDurable(journal.append(second)));
+            journal.close();
+        }
+
+        // the second batch failed to sync and was written again in a new
+        // segment, but made it into the old one too
+        boost::filesystem::directory_iterator segment(dir);
+        string data;
+        {
+            ifstream in(segment->path().string().c_str(), ios::binary);
+            ostringstream contents;
+            contents << in.rdbuf();
+            data = contents.str();
+        }
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), ".%020llu",
+                 (unsigned long long)first_end);
+        {
+            ofstream out((dir + "/test" + suffix).c_str(), ios::binary);
+            out.write(data.data() + first_end, data.size() - first_end);
+        }
+
+        Journal journal(dir + "/test", 1024 * 1024);
+        logentry_vector_t replayed;
+        CPPUNIT_ASSERT(journal.open(replayed));
+        CPPUNIT_ASSERT_EQUAL(entries.size(), replayed.size());
+        for (size_t i = 0; i < entries.size(); ++i) {
+            CPPUNIT_ASSERT_EQUAL(entries[i]->message, replayed[i]->message);
+        }
+    }
+
+    void testInUse() {
+        logentry_vector_t entries = makeEntries(10);
+        Journal journal(dir + "/test", 1024 * 1024);
+        logentry_vector_t replayed;
+        CPPUNIT_ASSERT(journal.open(replayed));
+        CPPUNIT_ASSERT(journal.waitDurable(journal.append(entries)));
+        CPPUNIT_ASSERT(Journal::isOpen(dir + "/test"));
+
+        // a replacement can't open it until the old one is closed
+        Journal replacement(dir + "/test", 1024 * 1024);
+        CPPUNIT_ASSERT(!replacement.open(replayed));
+        journal.close();
+        CPPUNIT_ASSERT(!Journal::isOpen(dir + "/test"));
+
+        Journal reopened(dir + "/test", 1024 * 1024);
+        CPPUNIT_ASSERT(reopened.open(replayed));
+        CPPUNIT_ASSERT_EQUAL(entries.size(), replayed.size());
+    }
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(JournalTest);
+
+int main(int argc, char **argv)
+{
+  CppUnit::TextUi::TestRunner runner;
+  CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+  runner.addTest( registry.makeTest() );
+  runner.run();
+  return 0;
+}
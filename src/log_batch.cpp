@@ -0,0 +1,287 @@
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+#include <algorithm>
+
+#include "log_batch.h"
+
+// TBinaryProtocol constants
+static const int32_t VERSION_MASK = 0xffff0000;
+static const int32_t VERSION_1 = 0x80010000;
+static const int8_t T_CALL = 1;
+
+static const int8_t T_STOP = 0;
+static const int8_t T_BOOL = 2;
+static const int8_t T_BYTE = 3;
+static const int8_t T_DOUBLE = 4;
+static const int8_t T_I16 = 6;
+static const int8_t T_I32 = 8;
+static const int8_t T_I64 = 10;
+static const int8_t T_STRING = 11;
+static const int8_t T_STRUCT = 12;
+static const int8_t T_MAP = 13;
+static const int8_t T_SET = 14;
+static const int8_t T_LIST = 15;
+
+// deeper nesting than this is treated as malformed
+static const int MAX_SKIP_DEPTH = 64;
+
+/*
+ * Bounds checked reader for TBinaryProtocol data. Every read returns false
+ * once the data runs out, after which the reader stays failed.
+ */
+class BinaryReader {
+ public:
+  BinaryReader(const char* data, uint32_t len)
+    : pos(data), end(data + len) {}
+
+  bool readByte(int8_t& value) {
+    if (end - pos < 1) {
+      return false;
+    }
+    value = *pos++;
+    return true;
+  }
+
+  bool readI16(int16_t& value) {
+    if (end - pos < 2) {
+      return false;
+    }
+    const unsigned char* p = (const unsigned char*)pos;
+    value = (int16_t)((p[0] << 8) | p[1]);
+    pos += 2;
+    return true;
+  }
+
+  bool readI32(int32_t& value) {
+    if (end - pos < 4) {
+      return false;
+    }
+    const unsigned char* p = (const unsigned char*)pos;
+    value = (int32_t)(((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+                      ((uint32_t)p[2] << 8) | (uint32_t)p[3]);
+    pos += 4;
+    return true;
+  }
+
+  // reads a string of len bytes whose length has already been read
+  bool readBytes(int32_t len, StringSlice& value) {
+    if (len < 0 || end - pos < len) {
+      return false;
+    }
+    value = StringSlice(pos, len);
+    pos += len;
+    return true;
+  }
+
+  bool readString(StringSlice& value) {
+    int32_t len;
+    return readI32(len) && readBytes(len, value);
+  }
+
+  bool skip(int8_t type, int depth = 0);
+
+  uint32_t remaining() const { return end - pos; }
+
+ private:
+  bool advance(uint32_t len) {
+    if ((uint32_t)(end - pos) < len) {
+      return false;
+    }
+    pos += len;
+    return true;
+  }
+
+  const char* pos;
+  const char* end;
+};
+
+bool BinaryReader::skip(int8_t type, int depth) {
+  if (depth > MAX_SKIP_DEPTH) {
+    return false;
+  }
+
+  switch (type) {
+  case T_BOOL:
+  case T_BYTE:
+    return advance(1);
+  case T_I16:
+    return advance(2);
+  case T_I32:
+    return advance(4);
+  case T_I64:
+  case T_DOUBLE:
+    return advance(8);
+  case T_STRING: {
+    StringSlice ignored;
+    return readString(ignored);
+  }
+  case T_STRUCT: {
+    int8_t field_type;
+    int16_t field_id;
+    while (readByte(field_type)) {
+      if (field_type == T_STOP) {
+        return true;
+      }
+      if (!readI16(field_id) || !skip(field_type, depth + 1)) {
+        return false;
+      }
+    }
+    return false;
+  }
+  case T_MAP: {
+    int8_t key_type, value_type;
+    int32_t size;
+    if (!readByte(key_type) || !readByte(value_type) || !readI32(size) ||
+        size < 0) {
+      return false;
+    }
+    for (int32_t i = 0; i < size; ++i) {
+      if (!skip(key_type, depth + 1) || !skip(value_type, depth + 1)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  case T_SET:
+  case T_LIST: {
+    int8_t elem_type;
+    int32_t size;
+    if (!readByte(elem_type) || !readI32(size) || size < 0) {
+      return false;
+    }
+    for (int32_t i = 0; i < size; ++i) {
+      if (!skip(elem_type, depth + 1)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+// Reads a message header, accepting both strict and old style headers like
+// TBinaryProtocol does without strict_read.
+static bool readMessageBegin(BinaryReader& reader, StringSlice& name,
+                             int8_t& type, int32_t& seqid) {
+  int32_t size;
+  if (!reader.readI32(size)) {
+    return false;
+  }
+
+  if (size < 0) {
+    if ((size & VERSION_MASK) != VERSION_1) {
+      return false;
+    }
+    type = (int8_t)(size & 0xff);
+    return reader.readString(name) && reader.readI32(seqid);
+  }
+
+  return reader.readBytes(size, name) && reader.readByte(type) &&
+    reader.readI32(seqid);
+}
+
+// Reads one LogEntry struct
+static bool readLogEntry(BinaryReader& reader, LogEntrySlice& entry) {
+  int8_t field_type;
+  int16_t field_id;
+
+  while (reader.readByte(field_type)) {
+    if (field_type == T_STOP) {
+      return true;
+    }
+    if (!reader.readI16(field_id)) {
+      return false;
+    }
+
+    if (field_id == 1 && field_type == T_STRING) {
+      if (!reader.readString(entry.category)) {
+        return false;
+      }
+    } else if (field_id == 2 && field_type == T_STRING) {
+      if (!reader.readString(entry.message)) {
+        return false;
+      }
+    } else if (!reader.skip(field_type)) {
+      return false;
+    }
+  }
+  return false;
+}
+
+LogBatch::LogBatch()
+  : seqId(0) {
+}
+
+bool LogBatch::isLogCall(const uint8_t* data, uint32_t len) {
+  BinaryReader reader((const char*)data, len);
+  StringSlice name;
+  int8_t type;
+  int32_t seqid;
+
+  return readMessageBegin(reader, name, type, seqid) &&
+    type == T_CALL && name.size == 3 && memcmp(name.data, "Log", 3) == 0;
+}
+
+bool LogBatch::parseCall(const uint8_t* data, uint32_t len) {
+  entryList.clear();
+
+  BinaryReader reader((const char*)data, len);
+  StringSlice name;
+  int8_t type;
+  if (!readMessageBegin(reader, name, type, seqId)) {
+    return false;
+  }
+
+  // scribe_Log_args: field 1 is list<LogEntry> messages
+  int8_t field_type;
+  int16_t field_id;
+  while (reader.readByte(field_type)) {
+    if (field_type == T_STOP) {
+      return true;
+    }
+    if (!reader.readI16(field_id)) {
+      return false;
+    }
+
+    if (field_id != 1 || field_type != T_LIST) {
+      if (!reader.skip(field_type)) {
+        return false;
+      }
+      continue;
+    }
+
+    int8_t elem_type;
+    int32_t size;
+    if (!reader.readByte(elem_type) || !reader.readI32(size) ||
+        elem_type != T_STRUCT || size < 0) {
+      return false;
+    }
+
+    // every entry takes at least one byte, so a bogus size can't make us
+    // reserve more than the call could hold
+    entryList.reserve(std::min((uint32_t)size, reader.remaining()));
+    for (int32_t i = 0; i < size; ++i) {
+      entryList.push_back(LogEntrySlice());
+      if (!readLogEntry(reader, entryList.back())) {
+        return false;
+      }
+    }
+  }
+
+  return false;
+}
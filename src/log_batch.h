@@ -0,0 +1,98 @@
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+#ifndef SCRIBE_LOG_BATCH_H
+#define SCRIBE_LOG_BATCH_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <boost/functional/hash.hpp>
+
+// A run of bytes that belongs to someone else, e.g. a Thrift read buffer
+struct StringSlice {
+  const char* data;
+  uint32_t size;
+
+  StringSlice() : data(NULL), size(0) {}
+  StringSlice(const char* slice_data, uint32_t slice_size)
+    : data(slice_data), size(slice_size) {}
+  explicit StringSlice(const std::string& str)
+    : data(str.data()), size(str.size()) {}
+
+  bool empty() const { return size == 0; }
+  std::string str() const { return std::string(data, size); }
+};
+
+// Hashes and compares slices the same way boost::hash and operator== do
+// std::strings, so slices can be looked up in string keyed hash maps.
+struct StringSliceHash {
+  size_t operator()(const StringSlice& slice) const {
+    return boost::hash_range(slice.data, slice.data + slice.size);
+  }
+};
+
+struct StringSliceEqual {
+  bool operator()(const StringSlice& slice, const std::string& str) const {
+    return slice.size == str.size() &&
+      memcmp(slice.data, str.data(), slice.size) == 0;
+  }
+  bool operator()(const std::string& str, const StringSlice& slice) const {
+    return (*this)(slice, str);
+  }
+};
+
+struct LogEntrySlice {
+  StringSlice category;
+  StringSlice message;
+
+  LogEntrySlice() {}
+  LogEntrySlice(const StringSlice& entry_category,
+                const StringSlice& entry_message)
+    : category(entry_category), message(entry_message) {}
+};
+typedef std::vector<LogEntrySlice> logentry_slice_vector_t;
+
+/*
+ * A Log() call parsed in place.
+ *
+ * The category and message of every entry are slices of the serialized
+ * call, which is neither copied nor owned, so a batch is parsed without
+ * any per-message allocation. The only copy of a message is the one that
+ * queues it. The caller keeps the call's bytes, e.g. the transport's read
+ * buffer, valid for as long as it uses the entries.
+ */
+class LogBatch {
+ public:
+  LogBatch();
+
+  // Returns true if data starts with the header of a TBinaryProtocol call
+  // to Log(). Looks at the header only and copies nothing.
+  static bool isLogCall(const uint8_t* data, uint32_t len);
+
+  // Parses a whole TBinaryProtocol message for a call to Log() without
+  // copying it. Returns false if it is not a well formed call.
+  bool parseCall(const uint8_t* data, uint32_t len);
+
+  int32_t seqid() const { return seqId; }
+  const logentry_slice_vector_t& entries() const { return entryList; }
+
+ private:
+  logentry_slice_vector_t entryList;
+  int32_t seqId;
+};
+
+#endif // !defined SCRIBE_LOG_BATCH_H
@@ -0,0 +1,150 @@
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+// Counts heap allocations made while turning a serialized Log() call into
+// queued LogMessages, once through the generated Thrift deserializer and
+// once through LogBatch.
+//
+// usage: log_batch_bench [messages_per_call] [message_size] [iterations]
+
+#include <new>
+#include <sys/time.h>
+
+#include "common.h"
+#include "log_batch.h"
+
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+using namespace scribe::thrift;
+
+static unsigned long long num_allocations = 0;
+
+void* operator new(size_t size) throw(std::bad_alloc) {
+  ++num_allocations;
+  void* p = malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t size) throw(std::bad_alloc) {
+  return operator new(size);
+}
+
+void operator delete(void* p) throw() {
+  free(p);
+}
+
+void operator delete[](void* p) throw() {
+  free(p);
+}
+
+static double nowInSec() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void report(const char* name, unsigned long long allocations,
+                   double seconds, unsigned long iterations,
+                   unsigned long num_messages) {
+  printf("%-10s %8.2f allocations/message %10.0f messages/sec\n",
+         name, (double)allocations / (iterations * num_messages),
+         iterations * num_messages / seconds);
+}
+
+int main(int argc, char** argv) {
+  unsigned long num_messages = argc > 1 ? strtoul(argv[1], NULL, 0) : 100;
+  unsigned long message_size = argc > 2 ? strtoul(argv[2], NULL, 0) : 200;
+  unsigned long iterations = argc > 3 ? strtoul(argv[3], NULL, 0) : 10000;
+
+  category_id_t category_id = CategoryTable::intern("benchmark_category");
+
+  // serialize one call the way a client would
+  boost::shared_ptr<TMemoryBuffer> call(new TMemoryBuffer());
+  {
+    TBinaryProtocol protocol(call);
+    scribe_Log_args args;
+    LogEntry entry;
+    entry.category = "benchmark_category";
+    entry.message = std::string(message_size, 'x');
+    args.messages.assign(num_messages, entry);
+
+    protocol.writeMessageBegin("Log", T_CALL, 0);
+    args.write(&protocol);
+    protocol.writeMessageEnd();
+  }
+  uint8_t* call_data;
+  uint32_t call_len;
+  call->getBuffer(&call_data, &call_len);
+
+  printf("%lu calls of %lu messages of %lu bytes\n",
+         iterations, num_messages, message_size);
+
+  // before: generated deserializer, then a LogMessage copy per message
+  boost::shared_ptr<TMemoryBuffer> in(new TMemoryBuffer());
+  TBinaryProtocol protocol(in);
+  num_allocations = 0;
+  double start = nowInSec();
+  for (unsigned long i = 0; i < iterations; ++i) {
+    in->resetBuffer(call_data, call_len);
+
+    std::string name;
+    TMessageType type;
+    int32_t seqid;
+    protocol.readMessageBegin(name, type, seqid);
+    scribe_Log_args args;
+    args.read(&protocol);
+    protocol.readMessageEnd();
+
+    logentry_vector_t queued;
+    queued.reserve(args.messages.size());
+    for (std::vector<LogEntry>::const_iterator iter = args.messages.begin();
+         iter != args.messages.end();
+         ++iter) {
+      queued.push_back(logentry_ptr_t(new LogMessage(category_id,
+                                                     iter->message)));
+    }
+  }
+  report("generated", num_allocations, nowInSec() - start,
+         iterations, num_messages);
+
+  // after: LogBatch, then a LogMessage made straight from the call
+  num_allocations = 0;
+  start = nowInSec();
+  for (unsigned long i = 0; i < iterations; ++i) {
+    LogBatch batch;
+    if (!batch.parseCall(call_data, call_len)) {
+      fprintf(stderr, "failed to parse call\n");
+      return 1;
+    }
+
+    logentry_vector_t queued;
+    queued.reserve(batch.entries().size());
+    for (logentry_slice_vector_t::const_iterator iter =
+           batch.entries().begin();
+         iter != batch.entries().end();
+         ++iter) {
+      queued.push_back(boost::make_shared<LogMessage>(category_id,
+                                                      iter->message.data,
+                                                      iter->message.size));
+    }
+  }
+  report("LogBatch", num_allocations, nowInSec() - start,
+         iterations, num_messages);
+
+  return 0;
+}
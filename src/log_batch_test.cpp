@@ -0,0 +1,189 @@
+#include "log_batch.h"
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+
+// Builds TBinaryProtocol data by hand
+class BinaryWriter {
+public:
+    void writeByte(int8_t value) {
+        data.push_back((char)value);
+    }
+    void writeI16(int16_t value) {
+        writeByte(value >> 8);
+        writeByte(value);
+    }
+    void writeI32(int32_t value) {
+        writeByte(value >> 24);
+        writeByte(value >> 16);
+        writeByte(value >> 8);
+        writeByte(value);
+    }
+    void writeString(const std::string& value) {
+        writeI32(value.size());
+        data += value;
+    }
+    void writeField(int8_t type, int16_t id) {
+        writeByte(type);
+        writeI16(id);
+    }
+    void writeStrictCallBegin(const std::string& name, int32_t seqid) {
+        writeI32(0x80010000 | 1);
+        writeString(name);
+        writeI32(seqid);
+    }
+    void writeOldCallBegin(const std::string& name, int32_t seqid) {
+        writeString(name);
+        writeByte(1);
+        writeI32(seqid);
+    }
+    void writeEntries(int num_entries) {
+        writeField(15, 1);
+        writeByte(12);
+        writeI32(num_entries);
+    }
+    void writeEntry(const std::string& category, const std::string& message) {
+        writeField(11, 1);
+        writeString(category);
+        writeField(11, 2);
+        writeString(message);
+        writeByte(0);
+    }
+
+    const uint8_t* bytes() const { return (const uint8_t*)data.data(); }
+    uint32_t size() const { return data.size(); }
+
+    std::string data;
+};
+
+class LogBatchTest : public CppUnit::TestCase {
+public:
+    CPPUNIT_TEST_SUITE(LogBatchTest);
+    CPPUNIT_TEST(testParse);
+    CPPUNIT_TEST(testOldHeader);
+    CPPUNIT_TEST(testSkipUnknownFields);
+    CPPUNIT_TEST(testNotLog);
+    CPPUNIT_TEST(testTruncated);
+    CPPUNIT_TEST(testInPlace);
+    CPPUNIT_TEST_SUITE_END();
+
+    void testParse() {
+        BinaryWriter writer;
+        writer.writeStrictCallBegin("Log", 7);
+        writer.writeEntries(2);
+        writer.writeEntry("foo", "hello");
+        writer.writeEntry("bar", "");
+        writer.writeByte(0);
+        writer.writeByte(0);
+
+        CPPUNIT_ASSERT(LogBatch::isLogCall(writer.bytes(), writer.size()));
+
+        LogBatch batch;
+        CPPUNIT_ASSERT(batch.parseCall(writer.bytes(), writer.size()));
+        CPPUNIT_ASSERT_EQUAL(7, batch.seqid());
+        CPPUNIT_ASSERT_EQUAL((size_t)2, batch.entries().size());
+        CPPUNIT_ASSERT_EQUAL(std::string("foo"), batch.entries()[0].category.str());
+        CPPUNIT_ASSERT_EQUAL(std::string("hello"), batch.entries()[0].message.str());
+        CPPUNIT_ASSERT_EQUAL(std::string("bar"), batch.entries()[1].category.str());
+        CPPUNIT_ASSERT(batch.entries()[1].message.empty());
+    }
+
+    void testOldHeader() {
+        BinaryWriter writer;
+        writer.writeOldCallBegin("Log", 3);
+        writer.writeEntries(1);
+        writer.writeEntry("foo", "hello");
+        writer.writeByte(0);
+
+        CPPUNIT_ASSERT(LogBatch::isLogCall(writer.bytes(), writer.size()));
+
+        LogBatch batch;
+        CPPUNIT_ASSERT(batch.parseCall(writer.bytes(), writer.size()));
+        CPPUNIT_ASSERT_EQUAL(3, batch.seqid());
+        CPPUNIT_ASSERT_EQUAL((size_t)1, batch.entries().size());
+    }
+
+    void testSkipUnknownFields() {
+        BinaryWriter writer;
+        writer.writeStrictCallBegin("Log", 1);
+        writer.writeField(8, 5);    // unknown i32 argument
+        writer.writeI32(42);
+        writer.writeEntries(1);
+        writer.writeField(15, 9);   // unknown list<string> in the entry
+        writer.writeByte(11);
+        writer.writeI32(1);
+        writer.writeString("ignored");
+        writer.writeField(11, 2);
+        writer.writeString("hello");
+        writer.writeField(11, 1);
+        writer.writeString("foo");
+        writer.writeByte(0);
+        writer.writeByte(0);
+
+        LogBatch batch;
+        CPPUNIT_ASSERT(batch.parseCall(writer.bytes(), writer.size()));
+        CPPUNIT_ASSERT_EQUAL((size_t)1, batch.entries().size());
+        CPPUNIT_ASSERT_EQUAL(std::string("foo"), batch.entries()[0].category.str());
+        CPPUNIT_ASSERT_EQUAL(std::string("hello"), batch.entries()[0].message.str());
+    }
+
+    void testNotLog() {
+        BinaryWriter writer;
+        writer.writeStrictCallBegin("getCounters", 1);
+        writer.writeByte(0);
+        CPPUNIT_ASSERT(!LogBatch::isLogCall(writer.bytes(), writer.size()));
+        CPPUNIT_ASSERT(!LogBatch::isLogCall(writer.bytes(), 2));
+    }
+
+    void testTruncated() {
+        BinaryWriter writer;
+        writer.writeStrictCallBegin("Log", 1);
+        writer.writeEntries(2);
+        writer.writeEntry("foo", "hello");
+        writer.writeEntry("bar", "world");
+        writer.writeByte(0);
+
+        for (uint32_t len = 0; len < writer.size(); ++len) {
+            LogBatch batch;
+            CPPUNIT_ASSERT(!batch.parseCall(writer.bytes(), len));
+        }
+
+        // a huge element count must not be trusted
+        BinaryWriter bogus;
+        bogus.writeStrictCallBegin("Log", 1);
+        bogus.writeEntries(0x7fffffff);
+        LogBatch batch;
+        CPPUNIT_ASSERT(!batch.parseCall(bogus.bytes(), bogus.size()));
+    }
+
+    void testInPlace() {
+        BinaryWriter writer;
+        writer.writeStrictCallBegin("Log", 1);
+        writer.writeEntries(1);
+        writer.writeEntry("foo", "hello");
+        writer.writeByte(0);
+
+        LogBatch batch;
+        CPPUNIT_ASSERT(batch.parseCall(writer.bytes(), writer.size()));
+
+        // the slices point into the call, which is not copied
+        const char* begin = (const char*) writer.bytes();
+        const StringSlice& message = batch.entries()[0].message;
+        CPPUNIT_ASSERT(message.data >= begin &&
+                       message.data + message.size <= begin + writer.size());
+        CPPUNIT_ASSERT_EQUAL(std::string("hello"), message.str());
+    }
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(LogBatchTest);
+
+int main(int argc, char **argv)
+{
+  CppUnit::TextUi::TestRunner runner;
+  CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+  runner.addTest( registry.makeTest() );
+  runner.run();
+  return 0;
+}
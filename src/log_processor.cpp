@@ -0,0 +1,121 @@
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+#include "log_processor.h"
+#include "log_batch.h"
+#include "scribe_server.h"
+
+using namespace apache::thrift;
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+using namespace scribe::thrift;
+
+using boost::shared_ptr;
+
+// Makes the client of a request known to the handler for its duration
+class CurrentPeerGuard {
+ public:
+  explicit CurrentPeerGuard(const std::string* peer) {
+    scribeHandler::currentPeer = peer;
+  }
+  ~CurrentPeerGuard() {
+    scribeHandler::currentPeer = NULL;
+  }
+};
+
+LogBatchProcessor::LogBatchProcessor(shared_ptr<scribeHandler> handler)
+  : scribeProcessor(handler),
+    handler(handler) {
+}
+
+bool LogBatchProcessor::process(shared_ptr<TProtocol> in,
+                                shared_ptr<TProtocol> out,
+                                void* connectionContext) {
+  // the context is only set by PeerEventHandler
+  CurrentPeerGuard peer_guard(static_cast<std::string*>(connectionContext));
+  shared_ptr<TTransport> in_transport = in->getTransport();
+
+  // A memory buffer lends out everything that is left of the frame. The
+  // batch is parsed in that buffer, so it is only consumed once Log() has
+  // copied the messages out.
+  uint32_t len = 0;
+  const uint8_t* data = in_transport->borrow(NULL, &len);
+  if (data == NULL || !LogBatch::isLogCall(data, len)) {
+    return scribeProcessor::process(in, out, connectionContext);
+  }
+
+  LogBatch batch;
+  if (!batch.parseCall(data, len)) {
+    throw TProtocolException(TProtocolException::INVALID_DATA,
+                             "malformed Log() call");
+  }
+
+  // reply the same way the generated processor does
+  scribe_Log_result result;
+  try {
+    result.success = handler->Log(batch);
+    result.__isset.success = true;
+  } catch (const std::exception& e) {
+    in_transport->consume(len);
+    in_transport->readEnd();
+    TApplicationException x(e.what());
+    out->writeMessageBegin("Log", T_EXCEPTION, batch.seqid());
+    x.write(out.get());
+    out->writeMessageEnd();
+    out->getTransport()->writeEnd();
+    out->getTransport()->flush();
+    return true;
+  }
+  in_transport->consume(len);
+  in_transport->readEnd();
+
+  out->writeMessageBegin("Log", T_REPLY, batch.seqid());
+  result.write(out.get());
+  out->writeMessageEnd();
+  out->getTransport()->writeEnd();
+  out->getTransport()->flush();
+  return true;
+}
+
+#ifdef THRIFT_POST_2_0
+void* PeerEventHandler::createContext(shared_ptr<TProtocol> input,
+                                      shared_ptr<TProtocol> output) {
+  return new std::string;
+}
+
+void PeerEventHandler::deleteContext(void* serverContext,
+                                     shared_ptr<TProtocol> input,
+                                     shared_ptr<TProtocol> output) {
+  delete static_cast<std::string*>(serverContext);
+}
+
+// Called with the client's socket before each request
+void PeerEventHandler::processContext(void* serverContext,
+                                      shared_ptr<TTransport> transport) {
+  std::string* peer = static_cast<std::string*>(serverContext);
+  if (!peer->empty()) {
+    return;
+  }
+
+  shared_ptr<TSocket> socket = boost::dynamic_pointer_cast<TSocket>(transport);
+  if (socket) {
+    *peer = socket->getPeerAddress();
+  }
+  if (peer->empty()) {
+    // Unix domain socket clients have no address
+    *peer = "local";
+  }
+}
+#endif
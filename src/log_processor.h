@@ -0,0 +1,61 @@
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+#ifndef SCRIBE_LOG_PROCESSOR_H
+#define SCRIBE_LOG_PROCESSOR_H
+
+#include "common.h"
+
+class scribeHandler;
+
+/*
+ * scribe Thrift processor that parses Log() calls in place with LogBatch
+ * instead of deserializing them into LogEntry objects. Other calls, and
+ * Log() calls on transports that can't lend out their buffer, go through
+ * the generated scribeProcessor.
+ */
+class LogBatchProcessor : public scribe::thrift::scribeProcessor {
+ public:
+  LogBatchProcessor(boost::shared_ptr<scribeHandler> handler);
+
+  bool process(boost::shared_ptr<apache::thrift::protocol::TProtocol> in,
+               boost::shared_ptr<apache::thrift::protocol::TProtocol> out,
+               void* connectionContext);
+
+ private:
+  boost::shared_ptr<scribeHandler> handler;
+};
+
+#ifdef THRIFT_POST_2_0
+/*
+ * Keeps the address of each client as its connection context, so that
+ * LogBatchProcessor can tell the handler who a request came from.
+ */
+class PeerEventHandler : public apache::thrift::server::TServerEventHandler {
+ public:
+  void* createContext(
+    boost::shared_ptr<apache::thrift::protocol::TProtocol> input,
+    boost::shared_ptr<apache::thrift::protocol::TProtocol> output);
+  void deleteContext(
+    void* serverContext,
+    boost::shared_ptr<apache::thrift::protocol::TProtocol> input,
+    boost::shared_ptr<apache::thrift::protocol::TProtocol> output);
+  void processContext(
+    void* serverContext,
+    boost::shared_ptr<apache::thrift::transport::TTransport> transport);
+};
+#endif
+
+#endif // !defined SCRIBE_LOG_PROCESSOR_H
@@ -0,0 +1,81 @@
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+#ifndef SCRIBE_MPSC_QUEUE_H
+#define SCRIBE_MPSC_QUEUE_H
+
+#include <stddef.h>
+
+/*
+ * Lock-free multi-producer single-consumer queue of nodes that have a
+ * Node* next member.
+ *
+ * Producers push onto a stack with compare-and-swap. The consumer never
+ * takes nodes one at a time: it swaps the whole stack out in one atomic
+ * exchange and reverses it, so nodes come out in the order they were
+ * pushed and there is no ABA problem. The queue doesn't own its nodes.
+ */
+template <class Node>
+class MpscQueue {
+ public:
+  MpscQueue() : head(NULL) {}
+
+  // Returns true if the queue was empty, so that the producer that makes
+  // it non-empty can wake up the consumer.
+  bool push(Node* node) {
+    Node* old_head = head;
+    do {
+      node->next = old_head;
+    } while (!casHead(old_head, node));
+    return node->next == NULL;
+  }
+
+  // Takes everything pushed so far, oldest first, or NULL if empty.
+  // Only one thread may call this.
+  Node* popAll() {
+    Node* node = __sync_lock_test_and_set(&head, (Node*) NULL);
+    Node* reversed = NULL;
+    while (node) {
+      Node* next = node->next;
+      node->next = reversed;
+      reversed = node;
+      node = next;
+    }
+    return reversed;
+  }
+
+  bool empty() const {
+    return head == NULL;
+  }
+
+ private:
+  // Sets old_head to the current head on failure
+  bool casHead(Node*& old_head, Node* new_head) {
+    Node* seen = __sync_val_compare_and_swap(&head, old_head, new_head);
+    if (seen == old_head) {
+      return true;
+    }
+    old_head = seen;
+    return false;
+  }
+
+  Node* volatile head;
+
+  // disallow copy and assignment
+  MpscQueue(const MpscQueue& rhs);
+  MpscQueue& operator=(const MpscQueue& rhs);
+};
+
+#endif // SCRIBE_MPSC_QUEUE_H
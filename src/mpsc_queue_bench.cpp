@@ -0,0 +1,253 @@
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+// Measures contention on one hot category's store queue: many Thrift
+// worker threads adding messages while a single store thread drains them.
+// Runs the way StoreQueue used to queue messages, a vector swapped under
+// a mutex with a condition variable for wakeups, and the way it does now,
+// through MpscQueue with the store's task scheduled on a StoreExecutor.
+//
+// usage: mpsc_queue_bench [threads] [messages_per_call] [message_size]
+//                         [calls_per_thread]
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+#include "mpsc_queue.h"
+#include "store_executor.h"
+
+typedef boost::shared_ptr<std::string> message_ptr_t;
+typedef std::vector<message_ptr_t> message_vector_t;
+
+// StoreQueue's default target_write_size
+static const unsigned long long TARGET_WRITE_SIZE = 16384;
+
+static unsigned long messagesPerCall;
+static unsigned long callsPerThread;
+static message_vector_t call;
+
+static double nowInSec() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static unsigned long long callBytes() {
+  unsigned long long size = 0;
+  for (message_vector_t::const_iterator iter = call.begin();
+       iter != call.end();
+       ++iter) {
+    size += (*iter)->size();
+  }
+  return size;
+}
+
+// The way StoreQueue queued messages before
+class LockedQueue {
+ public:
+  LockedQueue()
+    : queue(new message_vector_t), size(0), hasWork(false), done(false),
+      taken(0), wakeups(0) {
+    pthread_mutex_init(&msgMutex, NULL);
+    pthread_mutex_init(&hasWorkMutex, NULL);
+    pthread_cond_init(&hasWorkCond, NULL);
+  }
+
+  void add(const message_vector_t& messages, unsigned long long bytes) {
+    pthread_mutex_lock(&msgMutex);
+    queue->insert(queue->end(), messages.begin(), messages.end());
+    size += bytes;
+    bool wait_for_work = size >= TARGET_WRITE_SIZE;
+    pthread_mutex_unlock(&msgMutex);
+
+    if (wait_for_work) {
+      pthread_mutex_lock(&hasWorkMutex);
+      if (!hasWork) {
+        hasWork = true;
+        pthread_cond_signal(&hasWorkCond);
+      }
+      pthread_mutex_unlock(&hasWorkMutex);
+    }
+  }
+
+  void drain() {
+    while (true) {
+      pthread_mutex_lock(&msgMutex);
+      boost::shared_ptr<message_vector_t> messages = queue;
+      queue.reset(new message_vector_t);
+      size = 0;
+      pthread_mutex_unlock(&msgMutex);
+      taken += messages->size();
+
+      pthread_mutex_lock(&hasWorkMutex);
+      if (done && messages->empty()) {
+        pthread_mutex_unlock(&hasWorkMutex);
+        return;
+      }
+      if (!hasWork) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        struct timespec timeout;
+        timeout.tv_sec = now.tv_sec + 1;
+        timeout.tv_nsec = now.tv_usec * 1000;
+        pthread_cond_timedwait(&hasWorkCond, &hasWorkMutex, &timeout);
+        ++wakeups;
+      }
+      hasWork = false;
+      pthread_mutex_unlock(&hasWorkMutex);
+    }
+  }
+
+  void finish() {
+    pthread_mutex_lock(&hasWorkMutex);
+    done = true;
+    hasWork = true;
+    pthread_cond_signal(&hasWorkCond);
+    pthread_mutex_unlock(&hasWorkMutex);
+  }
+
+  boost::shared_ptr<message_vector_t> queue;
+  unsigned long long size;
+  bool hasWork;
+  bool done;
+  unsigned long long taken;
+  unsigned long long wakeups;
+  pthread_mutex_t msgMutex;
+  pthread_mutex_t hasWorkMutex;
+  pthread_cond_t hasWorkCond;
+};
+
+// The way StoreQueue queues messages now. There is no consumer thread of
+// its own: the queue is drained by a task the producers schedule.
+class LockFreeQueue : public ExecutorTask {
+ public:
+  LockFreeQueue()
+    : ExecutorTask(StoreExecutor::instance()), size(0), taken(0),
+      wakeups(0) {}
+
+  ~LockFreeQueue() {
+    waitIdle();
+  }
+
+  void add(const message_vector_t& messages, unsigned long long bytes) {
+    Batch* batch = new Batch;
+    batch->messages = messages;
+    batch->size = bytes;
+    unsigned long long new_size = __sync_add_and_fetch(&size, bytes);
+    bool was_empty = queue.push(batch);
+    if (new_size >= TARGET_WRITE_SIZE &&
+        (was_empty || new_size - bytes < TARGET_WRITE_SIZE)) {
+      schedule();
+    }
+  }
+
+  // the executor drains the queue
+  void drain() {}
+
+  void finish() {
+    schedule();
+    waitIdle();
+  }
+
+  struct Batch {
+    message_vector_t messages;
+    unsigned long long size;
+    Batch* next;
+  };
+
+  MpscQueue<Batch> queue;
+  volatile unsigned long long size;
+  unsigned long long taken;
+  unsigned long long wakeups;
+
+ protected:
+  void run() {
+    ++wakeups;
+    Batch* batch = queue.popAll();
+    unsigned long long bytes = 0;
+    while (batch) {
+      taken += batch->messages.size();
+      bytes += batch->size;
+      Batch* next = batch->next;
+      delete batch;
+      batch = next;
+    }
+    __sync_sub_and_fetch(&size, bytes);
+  }
+};
+
+template <class Queue>
+static void* produce(void* arg) {
+  Queue* queue = (Queue*) arg;
+  unsigned long long bytes = callBytes();
+  for (unsigned long i = 0; i < callsPerThread; ++i) {
+    queue->add(call, bytes);
+  }
+  return NULL;
+}
+
+template <class Queue>
+static void* consume(void* arg) {
+  ((Queue*) arg)->drain();
+  return NULL;
+}
+
+template <class Queue>
+static void run(const char* name, unsigned num_threads) {
+  Queue queue;
+  pthread_t consumer;
+  std::vector<pthread_t> producers(num_threads);
+
+  double start = nowInSec();
+  pthread_create(&consumer, NULL, consume<Queue>, &queue);
+  for (unsigned i = 0; i < num_threads; ++i) {
+    pthread_create(&producers[i], NULL, produce<Queue>, &queue);
+  }
+  for (unsigned i = 0; i < num_threads; ++i) {
+    pthread_join(producers[i], NULL);
+  }
+  double produced = nowInSec() - start;
+  queue.finish();
+  pthread_join(consumer, NULL);
+
+  unsigned long long expected =
+    (unsigned long long) num_threads * callsPerThread * messagesPerCall;
+  printf("%-10s %12.0f messages/sec %10llu store thread wakeups%s\n",
+         name, expected / produced, queue.wakeups,
+         queue.taken == expected ? "" : "  LOST MESSAGES");
+}
+
+int main(int argc, char** argv) {
+  unsigned num_threads = argc > 1 ? strtoul(argv[1], NULL, 0) : 32;
+  messagesPerCall = argc > 2 ? strtoul(argv[2], NULL, 0) : 10;
+  unsigned long message_size = argc > 3 ? strtoul(argv[3], NULL, 0) : 200;
+  callsPerThread = argc > 4 ? strtoul(argv[4], NULL, 0) : 100000;
+
+  for (unsigned long i = 0; i < messagesPerCall; ++i) {
+    call.push_back(message_ptr_t(new std::string(message_size, 'x')));
+  }
+
+  printf("%u threads, %lu messages of %lu bytes per call, "
+         "%lu calls per thread\n",
+         num_threads, messagesPerCall, message_size, callsPerThread);
+  run<LockedQueue>("mutex", num_threads);
+  run<LockFreeQueue>("lock-free", num_threads);
+  return 0;
+}
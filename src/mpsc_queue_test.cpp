@@ -0,0 +1,115 @@
+#include "mpsc_queue.h"
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+
+#include <pthread.h>
+#include <unistd.h>
+#include <vector>
+
+struct TestNode {
+  unsigned producer;
+  unsigned long sequence;
+  TestNode* next;
+
+  TestNode(unsigned p, unsigned long s) : producer(p), sequence(s), next(NULL) {}
+};
+
+static const unsigned NUM_PRODUCERS = 8;
+static const unsigned long PUSHES_PER_PRODUCER = 100000;
+
+struct ProducerArgs {
+  MpscQueue<TestNode>* queue;
+  unsigned producer;
+};
+
+static void* produce(void* arg) {
+  ProducerArgs* args = (ProducerArgs*) arg;
+  for (unsigned long i = 0; i < PUSHES_PER_PRODUCER; ++i) {
+    args->queue->push(new TestNode(args->producer, i));
+  }
+  return NULL;
+}
+
+class MpscQueueTest : public CppUnit::TestCase {
+public:
+    CPPUNIT_TEST_SUITE(MpscQueueTest);
+    CPPUNIT_TEST(testOrder);
+    CPPUNIT_TEST(testConcurrentProducers);
+    CPPUNIT_TEST_SUITE_END();
+
+    void testOrder() {
+        MpscQueue<TestNode> queue;
+        CPPUNIT_ASSERT(queue.empty());
+        CPPUNIT_ASSERT(queue.popAll() == NULL);
+
+        CPPUNIT_ASSERT(queue.push(new TestNode(0, 0)));
+        CPPUNIT_ASSERT(!queue.push(new TestNode(0, 1)));
+        CPPUNIT_ASSERT(!queue.push(new TestNode(0, 2)));
+        CPPUNIT_ASSERT(!queue.empty());
+
+        TestNode* node = queue.popAll();
+        CPPUNIT_ASSERT(queue.empty());
+        for (unsigned long i = 0; i < 3; ++i) {
+            CPPUNIT_ASSERT(node != NULL);
+            CPPUNIT_ASSERT_EQUAL(i, node->sequence);
+            TestNode* next = node->next;
+            delete node;
+            node = next;
+        }
+        CPPUNIT_ASSERT(node == NULL);
+
+        // empty again, so the next push is the first one
+        CPPUNIT_ASSERT(queue.push(new TestNode(0, 3)));
+        delete queue.popAll();
+    }
+
+    void testConcurrentProducers() {
+        MpscQueue<TestNode> queue;
+        pthread_t threads[NUM_PRODUCERS];
+        ProducerArgs args[NUM_PRODUCERS];
+        for (unsigned i = 0; i < NUM_PRODUCERS; ++i) {
+            args[i].queue = &queue;
+            args[i].producer = i;
+            pthread_create(&threads[i], NULL, produce, &args[i]);
+        }
+
+        // every producer's nodes must come out in the order it pushed them
+        std::vector<unsigned long> next_sequence(NUM_PRODUCERS, 0);
+        unsigned long total = 0;
+        while (total < NUM_PRODUCERS * PUSHES_PER_PRODUCER) {
+            TestNode* node = queue.popAll();
+            if (!node) {
+                usleep(1000);
+                continue;
+            }
+            while (node) {
+                CPPUNIT_ASSERT_EQUAL(next_sequence[node->producer],
+                                     node->sequence);
+                ++next_sequence[node->producer];
+                ++total;
+                TestNode* next = node->next;
+                delete node;
+                node = next;
+            }
+        }
+
+        for (unsigned i = 0; i < NUM_PRODUCERS; ++i) {
+            pthread_join(threads[i], NULL);
+        }
+        CPPUNIT_ASSERT(queue.empty());
+    }
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(MpscQueueTest);
+
+int main(int argc, char **argv)
+{
+  CppUnit::TextUi::TestRunner runner;
+  CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+  runner.addTest( registry.makeTest() );
+  runner.run();
+  return 0;
+}
@@ -0,0 +1,228 @@
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+#include <time.h>
+#include <algorithm>
+#include <boost/functional/hash.hpp>
+
+#include "peer_table.h"
+
+static const unsigned long DEFAULT_WINDOW_MS = 1000;
+static const unsigned long DEFAULT_FAIR_SHARE_FACTOR = 2;
+static const unsigned long DEFAULT_IDLE_WINDOWS = 60;
+
+static uint64_t monotonicNowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool moreRecentBytes(const PeerStats& a, const PeerStats& b) {
+  return a.recentBytes > b.recentBytes;
+}
+
+PeerTable::PeerTable()
+  : now(monotonicNowMs),
+    currentWindow(0),
+    fairShare(0),
+    windowMs(DEFAULT_WINDOW_MS),
+    fairShareFactor(DEFAULT_FAIR_SHARE_FACTOR),
+    idleWindows(DEFAULT_IDLE_WINDOWS) {
+  for (unsigned i = 0; i < NUM_SHARDS; ++i) {
+    pthread_mutex_init(&shards[i].lock, NULL);
+    shards[i].window = 0;
+    shards[i].bytes = 0;
+    shards[i].active = 0;
+    shards[i].prevBytes = 0;
+    shards[i].prevActive = 0;
+  }
+}
+
+PeerTable::~PeerTable() {
+  for (unsigned i = 0; i < NUM_SHARDS; ++i) {
+    pthread_mutex_destroy(&shards[i].lock);
+  }
+}
+
+void PeerTable::configure(unsigned long window_ms,
+                          unsigned long fair_share_factor,
+                          unsigned long idle_windows) {
+  windowMs = window_ms ? window_ms : DEFAULT_WINDOW_MS;
+  fairShareFactor = fair_share_factor;
+  idleWindows = idle_windows ? idle_windows : 1;
+}
+
+bool PeerTable::allow(const std::string& peer, unsigned long num_messages,
+                      unsigned long long num_bytes, bool congested) {
+  if (!congested || !fairShareFactor) {
+    return true;
+  }
+
+  Peer* entry;
+  Shard& shard = lockPeer(peer, entry);
+  uint64_t share = fairShare;
+  bool allowed = !share ||
+    entry->windowBytes + num_bytes <= share * fairShareFactor;
+  if (!allowed) {
+    entry->denied += num_messages;
+  }
+  pthread_mutex_unlock(&shard.lock);
+  return allowed;
+}
+
+void PeerTable::record(const std::string& peer, unsigned long num_messages,
+                       unsigned long long num_bytes) {
+  if (num_messages == 0) {
+    return;
+  }
+
+  Peer* entry;
+  Shard& shard = lockPeer(peer, entry);
+  if (entry->windowBytes == 0 && num_bytes > 0) {
+    ++shard.active;
+  }
+  entry->windowBytes += num_bytes;
+  entry->messages += num_messages;
+  entry->bytes += num_bytes;
+  shard.bytes += num_bytes;
+  pthread_mutex_unlock(&shard.lock);
+}
+
+bool PeerTable::admit(const std::string& peer, unsigned long num_messages,
+                      unsigned long long num_bytes, bool congested) {
+  if (!allow(peer, num_messages, num_bytes, congested)) {
+    return false;
+  }
+  record(peer, num_messages, num_bytes);
+  return true;
+}
+
+// Finds the peer's entry for the current window, starting a new window
+// first if it is time to. Returns its shard, locked.
+PeerTable::Shard& PeerTable::lockPeer(const std::string& peer,
+                                      Peer*& _return) {
+  uint64_t window = now() / windowMs;
+  uint64_t current = currentWindow;
+  if (window > current &&
+      __sync_bool_compare_and_swap(&currentWindow, current, window)) {
+    startWindow(window);
+  }
+
+  Shard& shard = shards[boost::hash<std::string>()(peer) % NUM_SHARDS];
+  pthread_mutex_lock(&shard.lock);
+  rollShard(shard, window);
+  Peer& entry = shard.peers[peer];
+  rollPeer(entry, shard.window);
+  _return = &entry;
+  return shard;
+}
+
+// Sets the fair share from what every shard accepted in the window before
+// window, and forgets idle peers. Only called by the thread that moved
+// currentWindow to window.
+void PeerTable::startWindow(uint64_t window) {
+  uint64_t bytes = 0;
+  uint64_t active = 0;
+
+  for (unsigned i = 0; i < NUM_SHARDS; ++i) {
+    Shard& shard = shards[i];
+    pthread_mutex_lock(&shard.lock);
+    rollShard(shard, window);
+    if (shard.window == window) {
+      bytes += shard.prevBytes;
+      active += shard.prevActive;
+    }
+
+    for (peer_map_t::iterator iter = shard.peers.begin();
+         iter != shard.peers.end();) {
+      if (iter->second.window + idleWindows < window) {
+        iter = shard.peers.erase(iter);
+      } else {
+        ++iter;
+      }
+    }
+    pthread_mutex_unlock(&shard.lock);
+  }
+
+  fairShare = active > 1 ? bytes / active : 0;
+}
+
+void PeerTable::rollShard(Shard& shard, uint64_t window) {
+  if (window <= shard.window) {
+    return;
+  }
+  if (window == shard.window + 1) {
+    shard.prevBytes = shard.bytes;
+    shard.prevActive = shard.active;
+  } else {
+    shard.prevBytes = 0;
+    shard.prevActive = 0;
+  }
+  shard.bytes = 0;
+  shard.active = 0;
+  shard.window = window;
+}
+
+void PeerTable::rollPeer(Peer& peer, uint64_t window) {
+  if (window <= peer.window) {
+    return;
+  }
+  peer.prevBytes = (window == peer.window + 1) ? peer.windowBytes : 0;
+  peer.windowBytes = 0;
+  peer.window = window;
+}
+
+void PeerTable::getTopTalkers(size_t n, std::vector<PeerStats>& _return) {
+  uint64_t window = now() / windowMs;
+  std::vector<PeerStats> stats;
+
+  for (unsigned i = 0; i < NUM_SHARDS; ++i) {
+    Shard& shard = shards[i];
+    pthread_mutex_lock(&shard.lock);
+    for (peer_map_t::iterator iter = shard.peers.begin();
+         iter != shard.peers.end();
+         ++iter) {
+      rollPeer(iter->second, window);
+      PeerStats peer_stats;
+      peer_stats.peer = iter->first;
+      peer_stats.messages = iter->second.messages;
+      peer_stats.bytes = iter->second.bytes;
+      peer_stats.denied = iter->second.denied;
+      peer_stats.recentBytes = iter->second.prevBytes;
+      stats.push_back(peer_stats);
+    }
+    pthread_mutex_unlock(&shard.lock);
+  }
+
+  n = std::min(n, stats.size());
+  std::partial_sort(stats.begin(), stats.begin() + n, stats.end(),
+                    moreRecentBytes);
+  stats.resize(n);
+  _return.swap(stats);
+}
+
+size_t PeerTable::getNumPeers() {
+  size_t num_peers = 0;
+  for (unsigned i = 0; i < NUM_SHARDS; ++i) {
+    pthread_mutex_lock(&shards[i].lock);
+    num_peers += shards[i].peers.size();
+    pthread_mutex_unlock(&shards[i].lock);
+  }
+  return num_peers;
+}
+
+unsigned long PeerTable::getWindowRemainingMs() {
+  return windowMs - now() % windowMs;
+}
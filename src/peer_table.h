@@ -0,0 +1,126 @@
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+#ifndef SCRIBE_PEER_TABLE_H
+#define SCRIBE_PEER_TABLE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <boost/unordered_map.hpp>
+
+// What a peer has sent, as reported by PeerTable::getTopTalkers()
+struct PeerStats {
+  std::string peer;
+  uint64_t messages;      // accepted since the peer was first seen
+  uint64_t bytes;
+  uint64_t denied;        // messages turned away for exceeding its share
+  uint64_t recentBytes;   // accepted in the last full window
+
+  PeerStats() : messages(0), bytes(0), denied(0), recentBytes(0) {}
+};
+
+/*
+ * Per-peer accounting for fair-share admission.
+ *
+ * Time is split into fixed windows. At the start of each window the fair
+ * share is set to the bytes accepted in the previous window divided by the
+ * number of peers that sent anything in it. While the server is congested,
+ * a peer that has already been accepted more than fairShareFactor times
+ * that in the current window is turned away, so one client sending at full
+ * speed cannot take the queue space every other client needs. Nothing is
+ * turned away while there is only one peer.
+ *
+ * Peers are spread over shards with a lock each, so that requests from
+ * different peers rarely contend. Peers that have been idle for
+ * idleWindows windows are forgotten.
+ */
+class PeerTable {
+ public:
+  PeerTable();
+  ~PeerTable();
+
+  void configure(unsigned long window_ms, unsigned long fair_share_factor,
+                 unsigned long idle_windows);
+
+  // Returns false, counting the denial, if congested and a request of
+  // num_bytes would put peer over its fair share. Accounts for nothing
+  // else: only what record() is told was accepted counts towards shares.
+  bool allow(const std::string& peer, unsigned long num_messages,
+             unsigned long long num_bytes, bool congested);
+  // Accounts for messages accepted from peer
+  void record(const std::string& peer, unsigned long num_messages,
+              unsigned long long num_bytes);
+  // allow() and, if allowed, record() the whole request
+  bool admit(const std::string& peer, unsigned long num_messages,
+             unsigned long long num_bytes, bool congested);
+
+  // The n peers with the most bytes accepted in the last full window, most
+  // first
+  void getTopTalkers(size_t n, std::vector<PeerStats>& _return);
+
+  size_t getNumPeers();
+
+  // Milliseconds until the current window ends
+  unsigned long getWindowRemainingMs();
+
+  // Time source in milliseconds, only exposed for testing
+  uint64_t (*now)();
+
+ private:
+  struct Peer {
+    uint64_t window;       // window that windowBytes is for
+    uint64_t windowBytes;
+    uint64_t prevBytes;    // bytes in the window before window
+    uint64_t messages;
+    uint64_t bytes;
+    uint64_t denied;
+
+    Peer() : window(0), windowBytes(0), prevBytes(0),
+             messages(0), bytes(0), denied(0) {}
+  };
+  typedef boost::unordered_map<std::string, Peer> peer_map_t;
+
+  struct Shard {
+    pthread_mutex_t lock;
+    peer_map_t peers;
+    uint64_t window;        // window that bytes and active are for
+    uint64_t bytes;
+    uint64_t active;        // peers that sent something in window
+    uint64_t prevBytes;     // same for the window before
+    uint64_t prevActive;
+  };
+
+  static const unsigned NUM_SHARDS = 16;
+
+  Shard& lockPeer(const std::string& peer, Peer*& _return);
+  void startWindow(uint64_t window);
+  static void rollShard(Shard& shard, uint64_t window);
+  static void rollPeer(Peer& peer, uint64_t window);
+
+  Shard shards[NUM_SHARDS];
+  volatile uint64_t currentWindow;
+  volatile uint64_t fairShare;     // bytes per peer per window, 0 if none
+  unsigned long windowMs;
+  unsigned long fairShareFactor;
+  unsigned long idleWindows;
+
+  // disallow copy and assignment
+  PeerTable(const PeerTable& rhs);
+  PeerTable& operator=(const PeerTable& rhs);
+};
+
+#endif // SCRIBE_PEER_TABLE_H
@@ -0,0 +1,134 @@
+#include "peer_table.h"
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+
+static uint64_t fakeNow = 0;
+
+static uint64_t getFakeNow() {
+  return fakeNow;
+}
+
+class PeerTableTest : public CppUnit::TestCase {
+public:
+    CPPUNIT_TEST_SUITE(PeerTableTest);
+    CPPUNIT_TEST(testUncongested);
+    CPPUNIT_TEST(testSinglePeer);
+    CPPUNIT_TEST(testFairShare);
+    CPPUNIT_TEST(testAllowOnly);
+    CPPUNIT_TEST(testTopTalkers);
+    CPPUNIT_TEST(testIdlePeers);
+    CPPUNIT_TEST_SUITE_END();
+
+    void setUp() {
+        fakeNow = 1000000;
+    }
+
+    void testUncongested() {
+        PeerTable table;
+        table.now = getFakeNow;
+        CPPUNIT_ASSERT(table.admit("a", 1, 1000, false));
+        CPPUNIT_ASSERT(table.admit("b", 1, 10, false));
+        fakeNow += 1000;
+        CPPUNIT_ASSERT(table.admit("a", 1, 1000000, false));
+        CPPUNIT_ASSERT_EQUAL((size_t) 2, table.getNumPeers());
+    }
+
+    void testSinglePeer() {
+        PeerTable table;
+        table.now = getFakeNow;
+        CPPUNIT_ASSERT(table.admit("a", 1, 1000, true));
+        fakeNow += 1000;
+        // nobody else to be fair to
+        CPPUNIT_ASSERT(table.admit("a", 1, 1000000, true));
+    }
+
+    void testFairShare() {
+        PeerTable table;
+        table.now = getFakeNow;
+        table.configure(1000, 2, 60);
+
+        // 1000 bytes from two peers makes a fair share of 500
+        CPPUNIT_ASSERT(table.admit("a", 1, 900, true));
+        CPPUNIT_ASSERT(table.admit("b", 1, 100, true));
+        fakeNow += 1000;
+
+        CPPUNIT_ASSERT(table.admit("a", 1, 600, true));
+        CPPUNIT_ASSERT(table.admit("a", 1, 400, true));
+        CPPUNIT_ASSERT(!table.admit("a", 1, 1, true));
+        CPPUNIT_ASSERT(table.admit("a", 1, 1, false));
+        CPPUNIT_ASSERT(table.admit("b", 1, 900, true));
+
+        // a fresh window starts a fresh budget
+        fakeNow += 1000;
+        CPPUNIT_ASSERT(table.admit("a", 1, 1000, true));
+    }
+
+    // Requests that are allowed but then turned away for other reasons
+    // don't use up the peer's share
+    void testAllowOnly() {
+        PeerTable table;
+        table.now = getFakeNow;
+        table.configure(1000, 1, 60);
+
+        table.record("a", 1, 500);
+        table.record("b", 1, 500);
+        fakeNow += 1000;
+
+        for (int i = 0; i < 10; ++i) {
+            CPPUNIT_ASSERT(table.allow("a", 1, 400, true));
+        }
+        table.record("a", 1, 400);
+        CPPUNIT_ASSERT(table.allow("a", 1, 100, true));
+        CPPUNIT_ASSERT(!table.allow("a", 1, 101, true));
+    }
+
+    void testTopTalkers() {
+        PeerTable table;
+        table.now = getFakeNow;
+        table.admit("a", 1, 100, false);
+        table.admit("b", 2, 300, false);
+        table.admit("c", 3, 200, false);
+        fakeNow += 1000;
+        table.admit("a", 1, 5000, false);
+
+        std::vector<PeerStats> top;
+        table.getTopTalkers(2, top);
+        CPPUNIT_ASSERT_EQUAL((size_t) 2, top.size());
+        CPPUNIT_ASSERT_EQUAL(std::string("b"), top[0].peer);
+        CPPUNIT_ASSERT_EQUAL((uint64_t) 300, top[0].recentBytes);
+        CPPUNIT_ASSERT_EQUAL((uint64_t) 2, top[0].messages);
+        CPPUNIT_ASSERT_EQUAL(std::string("c"), top[1].peer);
+
+        table.getTopTalkers(10, top);
+        CPPUNIT_ASSERT_EQUAL((size_t) 3, top.size());
+        CPPUNIT_ASSERT_EQUAL(std::string("a"), top[2].peer);
+        CPPUNIT_ASSERT_EQUAL((uint64_t) 5100, top[2].bytes);
+    }
+
+    void testIdlePeers() {
+        PeerTable table;
+        table.now = getFakeNow;
+        table.configure(1000, 2, 5);
+        table.admit("a", 1, 100, false);
+        table.admit("b", 1, 100, false);
+        for (int i = 0; i < 10; i++) {
+            fakeNow += 1000;
+            table.admit("b", 1, 100, false);
+        }
+        CPPUNIT_ASSERT_EQUAL((size_t) 1, table.getNumPeers());
+    }
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(PeerTableTest);
+
+int main(int argc, char **argv)
+{
+  CppUnit::TextUi::TestRunner runner;
+  CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+  runner.addTest( registry.makeTest() );
+  runner.run();
+  return 0;
+}
@@ -0,0 +1,121 @@
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+#ifndef SCRIBE_PREFIX_TRIE_H
+#define SCRIBE_PREFIX_TRIE_H
+
+#include <map>
+#include <string>
+#include <boost/shared_ptr.hpp>
+
+/*
+ * Radix tree mapping string prefixes to values, used to find the model
+ * stores for a new category in time proportional to the category length.
+ * Each edge is labelled with the longest run of characters shared by all
+ * prefixes below it.
+ */
+template <class T>
+class PrefixTrie {
+ public:
+  PrefixTrie() {}
+
+  // Adds a prefix, replacing its value if it was added before
+  void insert(const std::string& prefix, const T& value) {
+    Node* node = &root;
+    std::string::size_type pos = 0;
+
+    while (pos < prefix.size()) {
+      typename child_map_t::iterator iter = node->children.find(prefix[pos]);
+      if (iter == node->children.end()) {
+        boost::shared_ptr<Node> leaf(new Node(prefix.substr(pos)));
+        node->children[prefix[pos]] = leaf;
+        node = leaf.get();
+        break;
+      }
+
+      Node* child = iter->second.get();
+      std::string::size_type common = 0;
+      while (common < child->label.size() && pos + common < prefix.size() &&
+             child->label[common] == prefix[pos + common]) {
+        ++common;
+      }
+
+      if (common < child->label.size()) {
+        // split the edge where the new prefix diverges from it
+        boost::shared_ptr<Node> middle(new Node(child->label.substr(0, common)));
+        child->label.erase(0, common);
+        middle->children[child->label[0]] = iter->second;
+        iter->second = middle;
+        child = middle.get();
+      }
+
+      node = child;
+      pos += common;
+    }
+
+    node->hasValue = true;
+    node->value = value;
+  }
+
+  // Returns the value of the longest added prefix of key, or NULL if no
+  // prefix of key was added
+  const T* longestPrefixMatch(const std::string& key) const {
+    const Node* node = &root;
+    const T* best = root.hasValue ? &root.value : NULL;
+    std::string::size_type pos = 0;
+
+    while (pos < key.size()) {
+      typename child_map_t::const_iterator iter =
+        node->children.find(key[pos]);
+      if (iter == node->children.end()) {
+        break;
+      }
+
+      node = iter->second.get();
+      if (key.compare(pos, node->label.size(), node->label) != 0) {
+        break;
+      }
+
+      pos += node->label.size();
+      if (node->hasValue) {
+        best = &node->value;
+      }
+    }
+
+    return best;
+  }
+
+ private:
+  struct Node;
+  typedef std::map<char, boost::shared_ptr<Node> > child_map_t;
+
+  struct Node {
+    std::string label;  // characters on the edge leading to this node
+    bool hasValue;
+    T value;
+    child_map_t children;
+
+    explicit Node(const std::string& l = std::string())
+      : label(l), hasValue(false), value() {}
+  };
+
+  Node root;
+
+  // disallow copy and assignment
+  PrefixTrie(const PrefixTrie& rhs);
+  PrefixTrie& operator=(const PrefixTrie& rhs);
+};
+
+#endif // SCRIBE_PREFIX_TRIE_H
@@ -0,0 +1,72 @@
+#include "prefix_trie.h"
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+
+class PrefixTrieTest : public CppUnit::TestCase {
+public:
+    CPPUNIT_TEST_SUITE(PrefixTrieTest);
+    CPPUNIT_TEST(testEmpty);
+    CPPUNIT_TEST(testLongestMatch);
+    CPPUNIT_TEST(testSplit);
+    CPPUNIT_TEST(testEmptyPrefix);
+    CPPUNIT_TEST_SUITE_END();
+
+    void testEmpty() {
+        PrefixTrie<int> trie;
+        CPPUNIT_ASSERT(trie.longestPrefixMatch("foo") == NULL);
+        CPPUNIT_ASSERT(trie.longestPrefixMatch("") == NULL);
+    }
+
+    void testLongestMatch() {
+        PrefixTrie<int> trie;
+        trie.insert("foo_", 1);
+        trie.insert("foo_bar_", 2);
+        trie.insert("baz", 3);
+
+        CPPUNIT_ASSERT_EQUAL(1, *trie.longestPrefixMatch("foo_x"));
+        CPPUNIT_ASSERT_EQUAL(1, *trie.longestPrefixMatch("foo_bar"));
+        CPPUNIT_ASSERT_EQUAL(2, *trie.longestPrefixMatch("foo_bar_x"));
+        CPPUNIT_ASSERT_EQUAL(3, *trie.longestPrefixMatch("baz"));
+        CPPUNIT_ASSERT(trie.longestPrefixMatch("foo") == NULL);
+        CPPUNIT_ASSERT(trie.longestPrefixMatch("ba") == NULL);
+        CPPUNIT_ASSERT(trie.longestPrefixMatch("other") == NULL);
+    }
+
+    void testSplit() {
+        PrefixTrie<int> trie;
+        trie.insert("abcdef", 1);
+        trie.insert("abcxyz", 2);
+        trie.insert("abc", 3);
+        trie.insert("abcdef", 4);
+
+        CPPUNIT_ASSERT_EQUAL(4, *trie.longestPrefixMatch("abcdefg"));
+        CPPUNIT_ASSERT_EQUAL(2, *trie.longestPrefixMatch("abcxyz"));
+        CPPUNIT_ASSERT_EQUAL(3, *trie.longestPrefixMatch("abcxy"));
+        CPPUNIT_ASSERT_EQUAL(3, *trie.longestPrefixMatch("abcd"));
+        CPPUNIT_ASSERT(trie.longestPrefixMatch("ab") == NULL);
+    }
+
+    void testEmptyPrefix() {
+        PrefixTrie<int> trie;
+        trie.insert("", 1);
+        trie.insert("a", 2);
+
+        CPPUNIT_ASSERT_EQUAL(1, *trie.longestPrefixMatch(""));
+        CPPUNIT_ASSERT_EQUAL(1, *trie.longestPrefixMatch("b"));
+        CPPUNIT_ASSERT_EQUAL(2, *trie.longestPrefixMatch("ab"));
+    }
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(PrefixTrieTest);
+
+int main(int argc, char **argv)
+{
+  CppUnit::TextUi::TestRunner runner;
+  CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+  runner.addTest( registry.makeTest() );
+  runner.run();
+  return 0;
+}
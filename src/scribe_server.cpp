@@ -39,16 +39,34 @@ using boost::shared_ptr;
 
 shared_ptr<scribeHandler> g_Handler;
 
+__thread const string* scribeHandler::currentPeer = NULL;
+
 #define DEFAULT_CHECK_PERIOD       5
 #define DEFAULT_MAX_MSG_PER_SECOND 0
+#define DEFAULT_MAX_BYTES_PER_SECOND 0
 #define DEFAULT_MAX_QUEUE_SIZE     5000000LL
 #define DEFAULT_SERVER_THREADS     3
+#define DEFAULT_IO_REACTORS        1
+#define DEFAULT_UNIX_SOCKET_MODE   0660
 #define DEFAULT_MAX_CONN           0
+#define DEFAULT_MAX_PARKED_MESSAGES 100000
+#define DEFAULT_CATEGORY_IDLE_TIMEOUT 0
+#define DEFAULT_MAX_QUEUE_DELAY_MS 0
+#define MAX_RETRY_AFTER_MS         30000
+#define DEFAULT_PEER_FAIR_SHARE_FACTOR 0
+#define DEFAULT_PEER_WINDOW_MS     1000
+#define PEER_COUNTERS_TOP_TALKERS  10
+#define PEER_IDLE_MS               60000
 
-static string log_separator = ":";
 
 #define DEFAULT_UPDATE_STATUS_INTERVAL  60
 
+void* materializerStarter(void *this_ptr) {
+  scribeHandler *handler_ptr = (scribeHandler*)this_ptr;
+  handler_ptr->materializerThreadMember();
+  return NULL;
+}
+
 void print_usage(const char* program_name) {
   cout << "Usage: " << program_name << " [-p port] [-c config_file]" << endl;
 }
@@ -58,8 +76,7 @@ void scribeHandler::incCounter(string category, string counter) {
 }
 
 void scribeHandler::incCounter(string category, string counter, long amount) {
-  incrementCounter(category + log_separator + counter, amount);
-  incrementCounter(counter, amount);
+  CategoryCounterHandle(category, counter).inc(amount);
 }
 
 void scribeHandler::incCounter(string counter) {
@@ -67,7 +84,7 @@ void scribeHandler::incCounter(string counter) {
 }
 
 void scribeHandler::incCounter(string counter, long amount) {
-  incrementCounter(counter, amount);
+  CounterHandle(counter).inc(amount);
 }
 
 void scribeHandler::setCounter(string counter, long amount) {
@@ -152,21 +169,55 @@ scribeHandler::scribeHandler(unsigned long int server_port, const std::string& c
   : FacebookBase("Scribe"),
     port(server_port),
     numThriftServerThreads(DEFAULT_SERVER_THREADS),
+    numIoReactors(DEFAULT_IO_REACTORS),
+    unixSocketMode(DEFAULT_UNIX_SOCKET_MODE),
     checkPeriod(DEFAULT_CHECK_PERIOD),
+    numParkedMessages(0),
+    maxParkedMessages(DEFAULT_MAX_PARKED_MESSAGES),
+    maxCategoryCreateMs(0),
+    materializerStopping(false),
+    categoryIdleTimeout(DEFAULT_CATEGORY_IDLE_TIMEOUT),
     configFilename(config_file),
     status(STARTING),
     statusDetails("initial state"),
-    numMsgLastSecond(0),
     maxMsgPerSecond(DEFAULT_MAX_MSG_PER_SECOND),
+    maxBytesPerSecond(DEFAULT_MAX_BYTES_PER_SECOND),
     maxQueueSize(DEFAULT_MAX_QUEUE_SIZE),
+    maxQueueDelayMs(DEFAULT_MAX_QUEUE_DELAY_MS),
+    peerFairShareFactor(DEFAULT_PEER_FAIR_SHARE_FACTOR),
+    peerWindowMs(DEFAULT_PEER_WINDOW_MS),
+    deniedForPeerShare("denied for peer share"),
     maxConn(DEFAULT_MAX_CONN),
     newThreadPerCategory(true),
     zkClient(NULL) {
-  time(&lastMsgTime);
   scribeHandlerLock = scribe::concurrency::createReadWriteMutex();
+  categoryTables = category_tables_ptr_t(new CategoryTables);
+  config = boost::shared_ptr<const StoreConf>(new StoreConf);
+  categoryPrefixTrie =
+    shared_ptr<const category_prefix_trie_t>(new category_prefix_trie_t);
+
+  for (int i = 0; i < NUM_PRIORITIES; ++i) {
+    deniedForPriority[i] =
+      CounterHandle(string("denied for queue size ") +
+                    priorityName((store_priority_t) i) + " priority");
+  }
+
+  pthread_mutex_init(&pendingMutex, NULL);
+  pthread_cond_init(&materializeCond, NULL);
+  pthread_mutex_init(&initializeMutex, NULL);
+  pthread_create(&materializerThread, NULL, materializerStarter, (void*) this);
 }
 
 scribeHandler::~scribeHandler() {
+  pthread_mutex_lock(&pendingMutex);
+  materializerStopping = true;
+  pthread_cond_signal(&materializeCond);
+  pthread_mutex_unlock(&pendingMutex);
+  pthread_join(materializerThread, NULL);
+  pthread_mutex_destroy(&pendingMutex);
+  pthread_cond_destroy(&materializeCond);
+  pthread_mutex_destroy(&initializeMutex);
+
   deleteCategoryMap(categories);
   deleteCategoryMap(category_prefixes);
 }
@@ -174,16 +225,16 @@ scribeHandler::~scribeHandler() {
 // Returns the handler status, but overwrites it with WARNING if it's
 // ALIVE and at least one store has a nonempty status.
 fb_status scribeHandler::getStatus() {
-  RWGuard monitor(*scribeHandlerLock);
+  category_tables_ptr_t tables = getCategoryTables();
   Guard status_monitor(statusLock);
 
   fb_status return_status(status);
   if (status == ALIVE) {
-    for (category_map_t::iterator cat_iter = categories.begin();
-        cat_iter != categories.end();
+    for (category_hash_t::const_iterator cat_iter = tables->categories.begin();
+        cat_iter != tables->categories.end();
         ++cat_iter) {
-      for (store_list_t::iterator store_iter = cat_iter->second->begin();
-           store_iter != cat_iter->second->end();
+      for (store_list_t::iterator store_iter = cat_iter->second.stores->begin();
+           store_iter != cat_iter->second.stores->end();
            ++store_iter) {
         if (!(*store_iter)->getStatus().empty()) {
           return_status = WARNING;
@@ -204,16 +255,16 @@ void scribeHandler::setStatus(fb_status new_status) {
 // Returns the handler status details if non-empty,
 // otherwise the first non-empty store status found
 void scribeHandler::getStatusDetails(std::string& _return) {
-  RWGuard monitor(*scribeHandlerLock);
+  category_tables_ptr_t tables = getCategoryTables();
   Guard status_monitor(statusLock);
 
   _return = statusDetails;
   if (_return.empty()) {
-    for (category_map_t::iterator cat_iter = categories.begin();
-        cat_iter != categories.end();
+    for (category_hash_t::const_iterator cat_iter = tables->categories.begin();
+        cat_iter != tables->categories.end();
         ++cat_iter) {
-      for (store_list_t::iterator store_iter = cat_iter->second->begin();
-          store_iter != cat_iter->second->end();
+      for (store_list_t::iterator store_iter = cat_iter->second.stores->begin();
+          store_iter != cat_iter->second.stores->end();
           ++store_iter) {
 
         if (!(_return = (*store_iter)->getStatus()).empty()) {
@@ -298,62 +349,83 @@ bool scribeHandler::createCategoryFromModel(
   return true;
 }
 
-void scribeHandler::setQueueSizeCounter(bool get_read_lock) {
-  if (get_read_lock) scribeHandlerLock->acquireRead();
-  unsigned long long queue_size = 0;
-  for (category_map_t::iterator cat_iter = categories.begin();
-      cat_iter != categories.end();
-      ++cat_iter) {
-    shared_ptr<store_list_t> pstores = cat_iter->second;
-    if (!pstores) {
-      throw std::logic_error("throttle check: iterator in category map holds null pointer");
-    }
-    for (store_list_t::iterator store_iter = pstores->begin();
-        store_iter != pstores->end();
-        ++store_iter) {
-      if (*store_iter == NULL) {
-        throw std::logic_error("throttle check: iterator in store map holds null pointer");
-      } else {
-        unsigned long long size = (*store_iter)->getSize();
-        queue_size += size;
-      }
-    }
+void scribeHandler::setQueueSizeCounter() {
+  setCounter("queue size", StoreQueue::getTotalSize());
+}
+
+void scribeHandler::getCounters(map<string, int64_t>& _return) {
+  setQueueSizeCounter();
+  FacebookBase::getCounters(_return);
+  CounterHandle::addAll(_return);
+  addPeerCounters(_return);
+
+  StoreExecutor& executor = StoreExecutor::instance();
+  _return["store threads"] = executor.getNumThreads();
+  _return["store tasks run"] = executor.getTasksRun();
+  _return["store tasks stolen"] = executor.getTasksStolen();
+  _return["store timer wakeups"] = executor.getTimerWakeups();
+}
+
+// Exports the clients that sent the most in the last window, so that one
+// flooding the server can be found from its counters
+void scribeHandler::addPeerCounters(map<string, int64_t>& _return) {
+  vector<PeerStats> top_talkers;
+  peerTable.getTopTalkers(PEER_COUNTERS_TOP_TALKERS, top_talkers);
+  for (vector<PeerStats>::const_iterator iter = top_talkers.begin();
+       iter != top_talkers.end();
+       ++iter) {
+    _return[iter->peer + ":peer recent bytes"] = iter->recentBytes;
+    _return[iter->peer + ":peer bytes"] = iter->bytes;
+    _return[iter->peer + ":peer messages"] = iter->messages;
+    _return[iter->peer + ":peer denied"] = iter->denied;
   }
-  g_Handler->setCounter("queue size", queue_size);
-  if (get_read_lock) scribeHandlerLock->release();
+  _return["peers"] = peerTable.getNumPeers();
+}
+
+int64_t scribeHandler::getCounter(const string& key) {
+  if (key == "queue size") {
+    setQueueSizeCounter();
+  }
+  return FacebookBase::getCounter(key) + CounterHandle::read(key);
 }
 
 // Check if we need to deny this request due to throttling
-bool scribeHandler::throttleRequest(const vector<LogEntry>&  messages) {
+bool scribeHandler::throttleRequest(unsigned long num_messages,
+                                    unsigned long long num_bytes) {
   // Check if we need to rate limit
-  if (throttleDeny(messages.size())) {
+  if (throttleDeny(num_messages, num_bytes)) {
     incCounter("denied for rate");
     return true;
   }
 
-  // Accept messages if this single vector is larger than maxQueueSize.
-  // Denying would be worse as the memory has already been consumed and
-  // misbehaving clients may continue sending it over and over.
-  if (messages.capacity() > maxQueueSize) {
-    LOG_OPER("Throttle allowing ridiculously large <%lu> byte packet with <%lu> messages for exceeding queue size.",
-        messages.capacity(), messages.size())
+  // Accept these messages. The queue size is checked per category, see
+  // shedForQueueSize().
+  return false;
+}
+
+// Returns true if a request from the current peer has to be turned away
+// because the queues are half full and the peer has sent more than its
+// share. What the peer sent is only accounted for by chargePeer(), once
+// the request has been accepted.
+bool scribeHandler::throttlePeer(unsigned long num_messages,
+                                 unsigned long long num_bytes,
+                                 unsigned long* retry_after_ms) {
+  if (!currentPeer) {
     return false;
   }
 
-  // Deny messages if the total size of all queues, plus new messages,
-  // would exceed maxQueueSize.
-  setQueueSizeCounter(false);
-  unsigned long long queue_size = getCounter("queue size");
-  if ((queue_size + messages.capacity()) > maxQueueSize) {
-    LOG_OPER("Throttle denying <%lu> byte packet with <%lu> messages for queue size. ",
-      messages.size(), messages.capacity());
-    LOG_OPER("Current queue size: <%llu>. Max queue size: <%llu>.",
-      queue_size, maxQueueSize);
-    return true;
+  bool congested = peerFairShareFactor > 0 &&
+    StoreQueue::getTotalSize() > maxQueueSize / 2;
+  if (peerTable.allow(*currentPeer, num_messages, num_bytes, congested)) {
+    return false;
   }
 
-  // Accept these messages.
-  return false;
+  deniedForPeerShare.inc(num_messages);
+  if (retry_after_ms) {
+    // the peer gets a new share with the next window
+    *retry_after_ms = peerTable.getWindowRemainingMs();
+  }
+  return true;
 }
 
 // Should be called while holding a writeLock on scribeHandlerLock
@@ -362,30 +434,25 @@ shared_ptr<store_list_t> scribeHandler::createNewCategory(
 
   shared_ptr<store_list_t> store_list;
 
-  // First, check the list of category prefixes for a model
-  category_map_t::iterator cat_prefix_iter = category_prefixes.begin();
-  while (cat_prefix_iter != category_prefixes.end()) {
-    string::size_type len = cat_prefix_iter->first.size();
-    if (cat_prefix_iter->first.compare(0, len-1, category, 0, len-1) == 0) {
-      // Found a matching prefix model
-
-      shared_ptr<store_list_t> pstores = cat_prefix_iter->second;
-      for (store_list_t::iterator store_iter = pstores->begin();
-          store_iter != pstores->end(); ++store_iter) {
-        createCategoryFromModel(category, *store_iter);
-      }
-      category_map_t::iterator cat_iter = categories.find(category);
-
-      if (cat_iter != categories.end()) {
-        store_list = cat_iter->second;
-      } else {
-        LOG_OPER("failed to create new prefix store for category <%s>",
-            category.c_str());
-      }
+  // First, check the category prefixes for a model, using the longest
+  // matching prefix
+  const shared_ptr<store_list_t>* prefix_stores =
+    categoryPrefixTrie->longestPrefixMatch(category);
+  if (prefix_stores) {
+    // Found a matching prefix model
+    shared_ptr<store_list_t> pstores = *prefix_stores;
+    for (store_list_t::iterator store_iter = pstores->begin();
+        store_iter != pstores->end(); ++store_iter) {
+      createCategoryFromModel(category, *store_iter);
+    }
+    category_map_t::iterator cat_iter = categories.find(category);
 
-      break;
+    if (cat_iter != categories.end()) {
+      store_list = cat_iter->second;
+    } else {
+      LOG_OPER("failed to create new prefix store for category <%s>",
+          category.c_str());
     }
-    cat_prefix_iter++;
   }
 
 
@@ -404,137 +471,844 @@ shared_ptr<store_list_t> scribeHandler::createNewCategory(
     }
   }
 
+  if (store_list) {
+    createdCategories.insert(category);
+  }
   return store_list;
 }
 
-// Add this message to every store in list
+CategoryRoute::CategoryRoute(const string& category,
+                             const shared_ptr<store_list_t>& store_list)
+  : id(CategoryTable::intern(category)),
+    stores(store_list),
+    priority(PRIORITY_LOW),
+    journaled(false),
+    receivedGood(category, "received good"),
+    receivedBad(category, "received bad"),
+    deniedForRate(category, "denied for rate"),
+    deniedForDelay(category, "denied for queue delay"),
+    deniedForQueueSize(category, "denied for queue size") {
+  for (store_list_t::const_iterator store_iter = stores->begin();
+       store_iter != stores->end();
+       ++store_iter) {
+    priority = max(priority, (*store_iter)->getPriority());
+    journaled |= (*store_iter)->isJournaled();
+  }
+  if (stores->empty()) {
+    priority = PRIORITY_NORMAL;
+  }
+}
+
+// Add this message to every store of its category. The same immutable
+// entry is shared by every store.
 void scribeHandler::addMessage(
-    const LogEntry& entry,
-    const shared_ptr<store_list_t>& store_list) {
+    const logentry_ptr_t& entry,
+    const CategoryRoute& route) {
 
   int numstores = 0;
 
   // Add message to store_list
-  for (store_list_t::iterator store_iter = store_list->begin();
-      store_iter != store_list->end();
+  for (store_list_t::const_iterator store_iter = route.stores->begin();
+      store_iter != route.stores->end();
       ++store_iter) {
     ++numstores;
-    boost::shared_ptr<LogEntry> ptr(new LogEntry);
-    ptr->category = entry.category;
-    ptr->message = entry.message;
+    (*store_iter)->addMessage(entry);
+  }
+
+  if (numstores) {
+    route.receivedGood.inc();
+  } else {
+    route.receivedBad.inc();
+  }
+}
+
+// Add a batch of messages for a single category to every store in list
+// If journal_waits is given, journaled stores are added to it along with
+// the position they have to sync before the messages are durable.
+void scribeHandler::addMessages(
+    const logentry_vector_t& entries,
+    const CategoryRoute& route,
+    journal_wait_list_t* journal_waits) {
+
+  if (entries.empty()) {
+    return;
+  }
 
-    (*store_iter)->addMessage(ptr);
+  int numstores = 0;
+
+  for (store_list_t::const_iterator store_iter = route.stores->begin();
+      store_iter != route.stores->end();
+      ++store_iter) {
+    ++numstores;
+    uint64_t position = (*store_iter)->addMessages(entries);
+    if (journal_waits && (*store_iter)->isJournaled()) {
+      journal_waits->push_back(make_pair(store_iter->get(), position));
+    }
   }
 
   if (numstores) {
-    incCounter(entry.category, "received good");
+    route.receivedGood.inc(entries.size());
   } else {
-    incCounter(entry.category, "received bad");
+    route.receivedBad.inc(entries.size());
   }
 }
 
+// Called by Log() for a message whose category was not found in its tables.
+// If the category has been published in the meantime, sets found_route to
+// it and found_tables to the snapshot that holds it, for the caller to add
+// the message like any other. Otherwise parks the message until the
+// materializer thread has created the category. Returns false if the
+// message can't be taken now.
+bool scribeHandler::parkMessage(const LogEntrySlice& entry,
+                                category_tables_ptr_t& found_tables,
+                                const CategoryRoute*& found_route) {
+  string category = entry.category.str();
+  bool parked = false;
+
+  pthread_mutex_lock(&pendingMutex);
+
+  // The materializer publishes new tables while holding pendingMutex, so
+  // checking again here keeps parked messages ahead of later ones
+  category_tables_ptr_t tables = getCategoryTables();
+  category_hash_t::const_iterator cat_iter = tables->categories.find(category);
+  if (cat_iter != tables->categories.end()) {
+    pthread_mutex_unlock(&pendingMutex);
+    found_tables = tables;
+    found_route = &cat_iter->second;
+    return true;
+  }
 
-ResultCode::type scribeHandler::Log(const vector<LogEntry>&  messages) {
-  ResultCode::type result = ResultCode::TRY_LATER;
+  // A category no model matches can't be created, so its messages are
+  // dropped as they would be once the materializer found that out
+  const store_list_t* models = findModels(*tables, category);
+  if (!models) {
+    pthread_mutex_unlock(&pendingMutex);
+    LOG_DEBUG("log entry has invalid category <%s>", category.c_str());
+    incCounter(category, "received bad");
+    return true;
+  }
+
+  // Category names are never freed, so stop taking new ones from senders
+  // once there are too many
+  category_id_t category_id;
+  if (!CategoryTable::tryIntern(category, category_id)) {
+    pthread_mutex_unlock(&pendingMutex);
+    incCounter("denied for category names");
+    return false;
+  }
+
+  // A parked message is only journaled once its category is created, so
+  // when that may be too late for the durability the sender was promised,
+  // the category is created without it and the sender has to try again
+  bool journaled = false;
+  for (store_list_t::const_iterator model_iter = models->begin();
+       model_iter != models->end();
+       ++model_iter) {
+    journaled |= (*model_iter)->isJournaled();
+  }
+  if (journaled || numParkedMessages < maxParkedMessages) {
+    PendingCategory& pending = pendingCategories[category];
+    if (!pending.messages) {
+      pending.messages =
+        shared_ptr<logentry_vector_t>(new logentry_vector_t);
+      pending.firstParkedMs = scribe::clock::nowInMsec();
+      materializeQueue.push(category);
+      pthread_cond_signal(&materializeCond);
+    }
+    if (!journaled) {
+      pending.messages->push_back(
+        boost::make_shared<LogMessage>(category_id,
+                                       entry.message.data,
+                                       entry.message.size));
+      ++numParkedMessages;
+      parked = true;
+    }
+  }
+
+  pthread_mutex_unlock(&pendingMutex);
+
+  if (parked) {
+    incCounter(category, "parked");
+  } else if (journaled) {
+    incCounter(category, "denied for journal");
+  } else {
+    incCounter(category, "denied for parked");
+  }
+  return parked;
+}
+
+void scribeHandler::materializerThreadMember() {
+  time_t next_reclaim = time(NULL) + checkPeriod;
+
+  pthread_mutex_lock(&pendingMutex);
+  while (!materializerStopping) {
+    if (materializeQueue.empty()) {
+      time_t now = time(NULL);
+      if (now >= next_reclaim) {
+        pthread_mutex_unlock(&pendingMutex);
+        reclaimIdleCategories();
+        pthread_mutex_lock(&pendingMutex);
+        next_reclaim = time(NULL) + checkPeriod;
+        continue;
+      }
+
+      // in case the clock went back
+      next_reclaim = min(next_reclaim, (time_t) (now + checkPeriod));
+      struct timespec deadline;
+      deadline.tv_sec = next_reclaim;
+      deadline.tv_nsec = 0;
+      pthread_cond_timedwait(&materializeCond, &pendingMutex, &deadline);
+      continue;
+    }
+
+    // Create everything queued so far in one pass, so that a burst of new
+    // categories is published together rather than one snapshot each
+    vector<string> new_categories;
+    while (!materializeQueue.empty()) {
+      new_categories.push_back(materializeQueue.front());
+      materializeQueue.pop();
+    }
 
-  scribeHandlerLock->acquireRead();
-  if(status == STOPPING) {
-    result = ResultCode::TRY_LATER;
-    goto end;
+    pthread_mutex_unlock(&pendingMutex);
+    materializeCategories(new_categories);
+    pthread_mutex_lock(&pendingMutex);
   }
+  pthread_mutex_unlock(&pendingMutex);
+}
 
-  if (throttleRequest(messages)) {
-    result = ResultCode::TRY_LATER;
-    goto end;
+// Creates the stores for new_categories, hands them the messages parked for
+// them and publishes them so Log() can find them.
+void scribeHandler::materializeCategories(
+    const vector<string>& new_categories) {
+  RWGuard monitor(*scribeHandlerLock, true);
+  if (status == STOPPING) {
+    // the stores are being torn down
+    return;
   }
 
+  vector<shared_ptr<store_list_t> > store_lists;
+  vector<bool> created_now;
+  bool created = false;
+  for (vector<string>::const_iterator new_iter = new_categories.begin();
+       new_iter != new_categories.end();
+       ++new_iter) {
+    shared_ptr<store_list_t> store_list;
+    category_map_t::iterator cat_iter = categories.find(*new_iter);
+    if (cat_iter != categories.end()) {
+      // already configured, e.g. by a reinitialize while this was queued
+      store_list = cat_iter->second;
+    } else {
+      store_list = createNewCategory(*new_iter);
+    }
+    store_lists.push_back(store_list);
+    created_now.push_back(cat_iter == categories.end() && store_list);
+    created |= (bool) store_list;
+  }
+
+  pthread_mutex_lock(&pendingMutex);
+
+  for (size_t i = 0; i < new_categories.size(); ++i) {
+    const string& category = new_categories[i];
+    pending_category_map_t::iterator pending_iter =
+      pendingCategories.find(category);
+    if (pending_iter == pendingCategories.end()) {
+      continue;
+    }
+
+    shared_ptr<logentry_vector_t> messages = pending_iter->second.messages;
+    if (store_lists[i]) {
+      addMessages(*messages, CategoryRoute(category, store_lists[i]));
+    } else {
+      LOG_DEBUG("log entry has invalid category <%s>", category.c_str());
+      incCounter(category, "received bad", messages->size());
+    }
+
+    numParkedMessages -= messages->size();
+    if (created_now[i]) {
+      // how long the category's first message waited for it, which
+      // averages to "category create total ms" / "categories created"
+      unsigned long create_ms =
+        scribe::clock::nowInMsec() - pending_iter->second.firstParkedMs;
+      incCounter("categories created");
+      incCounter("category create total ms", create_ms);
+      if (create_ms > maxCategoryCreateMs) {
+        maxCategoryCreateMs = create_ms;
+        setCounter("category create max ms", maxCategoryCreateMs);
+      }
+    }
+    pendingCategories.erase(pending_iter);
+  }
+
+  // Publish before releasing pendingMutex so that no message for these
+  // categories can reach their stores ahead of the parked ones
+  if (created) {
+    publishCategoryTables();
+  }
+
+  pthread_mutex_unlock(&pendingMutex);
+}
+
+
+// Refer to the deserialized entries instead of copying them
+static void sliceEntries(const vector<LogEntry>& messages,
+                         logentry_slice_vector_t& entries) {
+  entries.reserve(messages.size());
   for (vector<LogEntry>::const_iterator msg_iter = messages.begin();
       msg_iter != messages.end();
       ++msg_iter) {
+    entries.push_back(LogEntrySlice(StringSlice(msg_iter->category),
+                                    StringSlice(msg_iter->message)));
+  }
+}
+
+ResultCode::type scribeHandler::Log(const vector<LogEntry>&  messages) {
+  logentry_slice_vector_t entries;
+  sliceEntries(messages, entries);
+  return logEntries(entries);
+}
+
+void scribeHandler::LogWithBackoff(LogReply& _return,
+                                   const vector<LogEntry>& messages) {
+  logentry_slice_vector_t entries;
+  sliceEntries(messages, entries);
+
+  unsigned long retry_after_ms = 0;
+  _return.result = logEntries(entries, &retry_after_ms);
+  _return.retry_after_ms = (int32_t) retry_after_ms;
+}
+
+void scribeHandler::LogV2(LogV2Reply& _return,
+                          const vector<LogEntry>& messages) {
+  logentry_slice_vector_t entries;
+  sliceEntries(messages, entries);
+
+  unsigned long retry_after_ms = 0;
+  _return.result = logEntries(entries, &retry_after_ms, &_return.accepted);
+  if (_return.result == ResultCode::OK) {
+    // no need to send back a list of trues
+    _return.accepted.clear();
+  }
+  _return.retry_after_ms = (int32_t) retry_after_ms;
+}
+
+ResultCode::type scribeHandler::Log(const LogBatch& batch) {
+  return logEntries(batch.entries());
+}
+
+// Turns away a whole request, marking every message not accepted if the
+// caller takes partial results
+static ResultCode::type rejectRequest(const logentry_slice_vector_t& entries,
+                                      vector<bool>* accepted) {
+  if (accepted) {
+    accepted->assign(entries.size(), false);
+  }
+  return ResultCode::TRY_LATER;
+}
+
+// If retry_after_ms is given, it is set to how long the client should wait
+// before retrying when TRY_LATER is returned, or left alone if there is no
+// suggestion.
+// If accepted is given, a category that is falling behind or over its rate
+// limit only turns away its own messages rather than the whole request.
+// accepted is then set to which messages were taken, and TRY_LATER is
+// returned if any of them were not.
+ResultCode::type scribeHandler::logEntries(
+    const logentry_slice_vector_t& entries,
+    unsigned long* retry_after_ms,
+    vector<bool>* accepted) {
+  if (accepted) {
+    accepted->assign(entries.size(), true);
+  }
+
+  if (status == STOPPING) {
+    return rejectRequest(entries, accepted);
+  }
+
+  unsigned long long num_bytes = 0;
+  for (logentry_slice_vector_t::const_iterator msg_iter = entries.begin();
+      msg_iter != entries.end();
+      ++msg_iter) {
+    num_bytes += msg_iter->message.size;
+  }
+
+  if (throttlePeer(entries.size(), num_bytes, retry_after_ms) ||
+      throttleRequest(entries.size(), num_bytes)) {
+    return rejectRequest(entries, accepted);
+  }
+
+  // Existing categories are looked up in the published snapshot without
+  // taking scribeHandlerLock
+  category_tables_ptr_t tables = getCategoryTables();
+
+  // Messages for existing categories are grouped by store list so that each
+  // StoreQueue gets everything from this call in a single addMessages()
+  store_batch_map_t batches;
+  batch_index_map_t indexes;
+  vector<const LogEntrySlice*> new_category_messages;
+
+  for (logentry_slice_vector_t::const_iterator msg_iter = entries.begin();
+      msg_iter != entries.end();
+      ++msg_iter) {
 
     // disallow blank category from the start
-    if ((*msg_iter).category.empty()) {
+    if (msg_iter->category.empty()) {
       incCounter("received blank category");
       continue;
     }
 
-    shared_ptr<store_list_t> store_list;
-    string category = (*msg_iter).category;
-
-    category_map_t::iterator cat_iter;
     // First look for an exact match of the category
-    if ((cat_iter = categories.find(category)) != categories.end()) {
-      store_list = cat_iter->second;
+    category_hash_t::const_iterator cat_iter =
+      tables->categories.find(msg_iter->category, StringSliceHash(),
+                              StringSliceEqual());
+    if (cat_iter != tables->categories.end()) {
+      // the only copy of the message, made straight from the request
+      batches[&cat_iter->second].push_back(
+        boost::make_shared<LogMessage>(cat_iter->second.id,
+                                       msg_iter->message.data,
+                                       msg_iter->message.size));
+      if (accepted) {
+        indexes[&cat_iter->second].push_back(msg_iter - entries.begin());
+      }
+      continue;
     }
 
-    // Try creating a new store for this category if we didn't find one
-    if (store_list == NULL) {
-      // Need write lock to create a new category
-      scribeHandlerLock->release();
-      scribeHandlerLock->acquireWrite();
+    new_category_messages.push_back(&*msg_iter);
+  }
 
-      // This may cause some duplicate messages if some messages in this batch
-      // were already added to queues
-      if(status == STOPPING) {
-        result = ResultCode::TRY_LATER;
-        goto end;
+  // Messages for categories that don't exist yet are judged together as
+  // normal priority
+  unsigned long long new_category_bytes = 0;
+  for (vector<const LogEntrySlice*>::const_iterator new_iter =
+         new_category_messages.begin();
+       new_iter != new_category_messages.end();
+       ++new_iter) {
+    new_category_bytes += (*new_iter)->message.size;
+  }
+  bool park_denied = !new_category_messages.empty() &&
+    queueFull(PRIORITY_NORMAL, new_category_bytes);
+  if (park_denied) {
+    deniedForPriority[PRIORITY_NORMAL].inc(new_category_messages.size());
+  }
+
+  // Nothing has been queued yet, so a category that is falling behind,
+  // over its rate limit, or too low a priority for how full the queues are
+  // can still fail the whole request
+  unsigned long dropped_messages = 0;
+  unsigned long long dropped_bytes = 0;
+  if (accepted) {
+    vector<const CategoryRoute*> rejected;
+    if (shedForQueueSize(batches, &rejected)) {
+      rejectBatches(rejected, batches, indexes, *accepted);
+    }
+    if (shedForQueueDelay(batches, retry_after_ms, &rejected)) {
+      rejectBatches(rejected, batches, indexes, *accepted);
+    }
+    if (throttleCategories(batches, &rejected)) {
+      rejectBatches(rejected, batches, indexes, *accepted);
+    }
+  } else {
+    // Without partial results, failing the request for its low priority
+    // messages would turn its other messages away with them. The low
+    // priority ones are dropped instead, so that the rest get in, unless
+    // they are journaled and so must not be lost.
+    vector<const CategoryRoute*> shed;
+    bool shed_all = park_denied;
+    if (!shed_all && shedForQueueSize(batches, &shed)) {
+      for (vector<const CategoryRoute*>::const_iterator route_iter =
+             shed.begin();
+           route_iter != shed.end();
+           ++route_iter) {
+        if ((*route_iter)->priority != PRIORITY_LOW ||
+            (*route_iter)->journaled) {
+          shed_all = true;
+        }
       }
+      if (!shed_all) {
+        dropBatches(shed, batches, &dropped_messages, &dropped_bytes);
+      }
+    }
 
-      if ((cat_iter = categories.find(category)) != categories.end()) {
-        store_list = cat_iter->second;
-      } else {
-        store_list = createNewCategory(category);
+    if (shed_all ||
+        shedForQueueDelay(batches, retry_after_ms) ||
+        throttleCategories(batches)) {
+      msgRateLimit.refund(entries.size() - dropped_messages);
+      byteRateLimit.refund(num_bytes - dropped_bytes);
+      return ResultCode::TRY_LATER;
+    }
+  }
+
+  // Have the materializer thread create categories we didn't find.
+  // This may cause some duplicate messages if some messages in this batch
+  // were already parked
+  journal_wait_list_t journal_waits;
+  vector<const CategoryRoute*> wait_routes;
+  vector<category_tables_ptr_t> found_tables;
+  for (vector<const LogEntrySlice*>::iterator new_iter =
+         new_category_messages.begin();
+       new_iter != new_category_messages.end();
+       ++new_iter) {
+    category_tables_ptr_t tables_found;
+    const CategoryRoute* route = NULL;
+    if (park_denied || !parkMessage(**new_iter, tables_found, route)) {
+      if (accepted) {
+        (*accepted)[*new_iter - &entries[0]] = false;
+        msgRateLimit.refund(1);
+        byteRateLimit.refund((*new_iter)->message.size);
+        continue;
       }
+      msgRateLimit.refund(entries.size() - dropped_messages);
+      byteRateLimit.refund(num_bytes - dropped_bytes);
+      refundCategories(batches);
+      return ResultCode::TRY_LATER;
+    }
 
+    if (route) {
+      // created since we looked, so it is journaled like the others
+      found_tables.push_back(tables_found);
+      addMessages(logentry_vector_t(1, boost::make_shared<LogMessage>(
+                                      route->id,
+                                      (*new_iter)->message.data,
+                                      (*new_iter)->message.size)),
+                  *route, &journal_waits);
+      wait_routes.resize(journal_waits.size(), route);
+      if (accepted) {
+        indexes[route].push_back(*new_iter - &entries[0]);
+      }
     }
+  }
 
-    if (store_list == NULL) {
-      LOG_DEBUG("log entry has invalid category <%s>", category.c_str());
-      incCounter(category, "received bad");
+  // Log the messages for existing categories
+  for (store_batch_map_t::iterator batch_iter = batches.begin();
+       batch_iter != batches.end();
+       ++batch_iter) {
+    addMessages(batch_iter->second, *batch_iter->first, &journal_waits);
+    wait_routes.resize(journal_waits.size(), batch_iter->first);
+  }
 
+  // Messages for journaled stores are only acknowledged once they are
+  // synced. They stay queued if that fails, so a retry by the client can
+  // duplicate them.
+  for (size_t i = 0; i < journal_waits.size(); ++i) {
+    if (journal_waits[i].first->waitDurable(journal_waits[i].second)) {
       continue;
     }
+    incCounter("journal failed");
+    if (!accepted) {
+      return ResultCode::TRY_LATER;
+    }
+    const vector<uint32_t>& positions = indexes[wait_routes[i]];
+    for (vector<uint32_t>::const_iterator pos_iter = positions.begin();
+         pos_iter != positions.end();
+         ++pos_iter) {
+      (*accepted)[*pos_iter] = false;
+    }
+  }
 
-    // Log this message
-    addMessage(*msg_iter, store_list);
-
+  chargePeer(entries, accepted, dropped_messages, dropped_bytes);
+  if (accepted &&
+      find(accepted->begin(), accepted->end(), false) != accepted->end()) {
+    return ResultCode::TRY_LATER;
   }
+  return ResultCode::OK;
+}
 
-  result = ResultCode::OK;
+// Accounts the messages accepted from the current peer towards its share:
+// those marked in accepted, or if it is NULL all but the dropped ones
+void scribeHandler::chargePeer(const logentry_slice_vector_t& entries,
+                               const vector<bool>* accepted,
+                               unsigned long dropped_messages,
+                               unsigned long long dropped_bytes) {
+  if (!currentPeer) {
+    return;
+  }
 
- end:
-  scribeHandlerLock->release();
-  return result;
+  unsigned long num_messages = 0;
+  unsigned long long num_bytes = 0;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (!accepted || (*accepted)[i]) {
+      ++num_messages;
+      num_bytes += entries[i].message.size;
+    }
+  }
+  peerTable.record(*currentPeer, num_messages - dropped_messages,
+                   num_bytes - dropped_bytes);
 }
 
 // Returns true if overloaded.
-// Allows a fixed number of messages per second.
-bool scribeHandler::throttleDeny(int num_messages) {
-  time_t now;
-  if (0 == maxMsgPerSecond)
-    return false;
+// Applies the global max_msg_per_second and max_bytes_per_second limits.
+bool scribeHandler::throttleDeny(unsigned long num_messages,
+                                 unsigned long long num_bytes) {
+  // A single huge packet is accepted whenever the limit has not been used
+  // recently, otherwise we would keep having to read it and deny it
+  // indefinitely. Later requests pay for it.
+  if (!msgRateLimit.consume(num_messages)) {
+    LOG_OPER("throttle denying request with <%lu> messages. It would exceed max of <%lu> messages per second",
+        num_messages, maxMsgPerSecond);
+    return true;
+  }
 
-  time(&now);
-  if (now != lastMsgTime) {
-    lastMsgTime = now;
-    numMsgLastSecond = 0;
+  if (!byteRateLimit.consume(num_bytes)) {
+    msgRateLimit.refund(num_messages);
+    LOG_OPER("throttle denying request with <%llu> bytes. It would exceed max of <%llu> bytes per second",
+        num_bytes, maxBytesPerSecond);
+    return true;
   }
 
-  // If we get a single huge packet it's not cool, but we'd better
-  // accept it or we'll keep having to read it and deny it indefinitely
-  if (num_messages > (int)maxMsgPerSecond/2) {
-    LOG_OPER("throttle allowing ridiculously large packet with <%d> messages", num_messages);
+  return false;
+}
+
+// Uniform in [0, bound) from a per-thread generator
+static unsigned long randomBelow(unsigned long bound) {
+  static __thread unsigned int seed = 0;
+  if (seed == 0) {
+    seed = (unsigned int) pthread_self() ^ (unsigned int) time(NULL);
+  }
+  return bound ? (unsigned long) rand_r(&seed) % bound : 0;
+}
+
+static unsigned long long batchBytes(const logentry_vector_t& entries) {
+  unsigned long long num_bytes = 0;
+  for (logentry_vector_t::const_iterator iter = entries.begin();
+       iter != entries.end();
+       ++iter) {
+    num_bytes += (*iter)->message.size();
+  }
+  return num_bytes;
+}
+
+// Returns true if num_bytes more bytes of messages of the given priority
+// should be shed because the store queues are filling up. Low priority messages are
+// shed with a probability that grows from 0 at half of maxQueueSize to 1 at
+// maxQueueSize, normal ones once maxQueueSize would be exceeded, and high
+// ones only once it would be exceeded by more than a quarter.
+bool scribeHandler::queueFull(store_priority_t priority,
+                              unsigned long long num_bytes) {
+  // Accept messages if this single request is larger than maxQueueSize.
+  // Denying would be worse as the memory has already been consumed and
+  // misbehaving clients may continue sending it over and over.
+  if (num_bytes > maxQueueSize) {
+    LOG_OPER("Throttle allowing ridiculously large <%llu> byte packet for exceeding queue size.",
+        num_bytes)
     return false;
   }
 
-  if (numMsgLastSecond + num_messages > maxMsgPerSecond) {
-    LOG_OPER("throttle denying request with <%d> messages. It would exceed max of <%lu> messages this second",
-        num_messages, maxMsgPerSecond);
-    return true;
+  unsigned long long queue_size = StoreQueue::getTotalSize() + num_bytes;
+  unsigned long long limit = maxQueueSize;
+  if (priority == PRIORITY_LOW) {
+    unsigned long long start = maxQueueSize / 2;
+    if (queue_size <= start ||
+        (queue_size < limit &&
+         randomBelow(limit - start) >= queue_size - start)) {
+      return false;
+    }
   } else {
-    numMsgLastSecond += num_messages;
+    if (priority == PRIORITY_HIGH) {
+      limit += maxQueueSize / 4;
+    }
+    if (queue_size <= limit) {
+      return false;
+    }
+    LOG_OPER("Throttle denying <%llu> bytes of %s priority for queue size. "
+             "Current queue size: <%llu>. Max queue size: <%llu>.",
+             num_bytes, priorityName(priority),
+             queue_size - num_bytes, maxQueueSize);
+  }
+  return true;
+}
+
+// Returns true if the request should be shed because one of its categories
+// is too low a priority for how full the store queues are, see queueFull().
+// Each category is judged by its own share of the request.
+// If shed is given, every category to shed is added to it instead of
+// stopping at the first.
+bool scribeHandler::shedForQueueSize(const store_batch_map_t& batches,
+                                     vector<const CategoryRoute*>* shed) {
+  for (store_batch_map_t::const_iterator batch_iter = batches.begin();
+       batch_iter != batches.end();
+       ++batch_iter) {
+    const CategoryRoute* route = batch_iter->first;
+    if (!queueFull(route->priority, batchBytes(batch_iter->second))) {
+      continue;
+    }
+
+    route->deniedForQueueSize.inc(batch_iter->second.size());
+    deniedForPriority[route->priority].inc(batch_iter->second.size());
+    if (!shed) {
+      return true;
+    }
+    shed->push_back(route);
+  }
+
+  return shed && !shed->empty();
+}
+
+// Returns true if the request should be shed because a store of one of its
+// categories has had messages queued for longer than maxQueueDelayMs.
+// Requests are shed with a probability that grows from 0 at
+// maxQueueDelayMs to 1 at twice that, so that load backs off gradually
+// rather than all clients being turned away at once.
+// If shed is given, every category to shed is added to it instead of
+// stopping at the first, and retry_after_ms is the longest of their hints.
+bool scribeHandler::shedForQueueDelay(const store_batch_map_t& batches,
+                                      unsigned long* retry_after_ms,
+                                      vector<const CategoryRoute*>* shed) {
+  if (maxQueueDelayMs == 0) {
     return false;
   }
+
+  for (store_batch_map_t::const_iterator batch_iter = batches.begin();
+       batch_iter != batches.end();
+       ++batch_iter) {
+    const store_list_t& store_list = *batch_iter->first->stores;
+
+    unsigned long delay = 0;
+    for (store_list_t::const_iterator store_iter = store_list.begin();
+         store_iter != store_list.end();
+         ++store_iter) {
+      delay = max(delay, (*store_iter)->getQueueDelayMs());
+    }
+    if (delay <= maxQueueDelayMs) {
+      continue;
+    }
+
+    unsigned long excess = delay - maxQueueDelayMs;
+    if (excess < maxQueueDelayMs && randomBelow(maxQueueDelayMs) >= excess) {
+      continue;
+    }
+
+    batch_iter->first->deniedForDelay.inc();
+    if (retry_after_ms) {
+      // Roughly how long the store needs to get back under the target,
+      // jittered so that shed clients don't all come back together
+      unsigned long hint = excess / 2 + randomBelow(excess + 1);
+      hint = min(max(hint, 1UL), (unsigned long) MAX_RETRY_AFTER_MS);
+      *retry_after_ms = shed ? max(*retry_after_ms, hint) : hint;
+    }
+    if (!shed) {
+      return true;
+    }
+    shed->push_back(batch_iter->first);
+  }
+
+  return shed && !shed->empty();
+}
+
+// Returns true if any category in batches is over the rate limit of one of
+// its stores, in which case no rate limit is charged for any of them.
+// If denied is given, those categories are added to it instead and are the
+// only ones not charged.
+bool scribeHandler::throttleCategories(const store_batch_map_t& batches,
+                                       vector<const CategoryRoute*>* denied) {
+  vector<pair<StoreQueue*, const logentry_vector_t*> > admitted;
+
+  for (store_batch_map_t::const_iterator batch_iter = batches.begin();
+       batch_iter != batches.end();
+       ++batch_iter) {
+    const logentry_vector_t& entries = batch_iter->second;
+    const store_list_t& store_list = *batch_iter->first->stores;
+    vector<pair<StoreQueue*, const logentry_vector_t*> >::size_type
+      first_refund = denied ? admitted.size() : 0;
+
+    for (store_list_t::const_iterator store_iter = store_list.begin();
+         store_iter != store_list.end();
+         ++store_iter) {
+      if (!(*store_iter)->isRateLimited()) {
+        continue;
+      }
+
+      if ((*store_iter)->admitMessages(entries.size(), batchBytes(entries))) {
+        admitted.push_back(make_pair(store_iter->get(), &entries));
+        continue;
+      }
+
+      batch_iter->first->deniedForRate.inc();
+      for (vector<pair<StoreQueue*, const logentry_vector_t*> >::iterator
+             admitted_iter = admitted.begin() + first_refund;
+           admitted_iter != admitted.end();
+           ++admitted_iter) {
+        admitted_iter->first->refundMessages(admitted_iter->second->size(),
+                                             batchBytes(*admitted_iter->second));
+      }
+      if (!denied) {
+        return true;
+      }
+      admitted.resize(first_refund);
+      denied->push_back(batch_iter->first);
+      break;
+    }
+  }
+
+  return denied && !denied->empty();
+}
+
+// Gives back the rate limit taken by a successful throttleCategories()
+void scribeHandler::refundCategories(const store_batch_map_t& batches) {
+  for (store_batch_map_t::const_iterator batch_iter = batches.begin();
+       batch_iter != batches.end();
+       ++batch_iter) {
+    const logentry_vector_t& entries = batch_iter->second;
+    const store_list_t& store_list = *batch_iter->first->stores;
+
+    for (store_list_t::const_iterator store_iter = store_list.begin();
+         store_iter != store_list.end();
+         ++store_iter) {
+      if ((*store_iter)->isRateLimited()) {
+        (*store_iter)->refundMessages(entries.size(), batchBytes(entries));
+      }
+    }
+  }
+}
+
+// Takes the messages of the given categories out of a partially accepted
+// request, gives back the global rate limit they were charged and clears
+// routes.
+void scribeHandler::rejectBatches(vector<const CategoryRoute*>& routes,
+                                  store_batch_map_t& batches,
+                                  const batch_index_map_t& indexes,
+                                  vector<bool>& accepted) {
+  for (vector<const CategoryRoute*>::iterator route_iter = routes.begin();
+       route_iter != routes.end();
+       ++route_iter) {
+    store_batch_map_t::iterator batch_iter = batches.find(*route_iter);
+    if (batch_iter == batches.end()) {
+      continue;
+    }
+    msgRateLimit.refund(batch_iter->second.size());
+    byteRateLimit.refund(batchBytes(batch_iter->second));
+    batches.erase(batch_iter);
+
+    const vector<uint32_t>& positions = indexes.find(*route_iter)->second;
+    for (vector<uint32_t>::const_iterator pos_iter = positions.begin();
+         pos_iter != positions.end();
+         ++pos_iter) {
+      accepted[*pos_iter] = false;
+    }
+  }
+  routes.clear();
+}
+
+// Drops the messages of routes from batches, for requests that can't
+// reject only some of their messages
+void scribeHandler::dropBatches(const vector<const CategoryRoute*>& routes,
+                                store_batch_map_t& batches,
+                                unsigned long* dropped_messages,
+                                unsigned long long* dropped_bytes) {
+  for (vector<const CategoryRoute*>::const_iterator route_iter =
+         routes.begin();
+       route_iter != routes.end();
+       ++route_iter) {
+    store_batch_map_t::iterator batch_iter = batches.find(*route_iter);
+    if (batch_iter == batches.end()) {
+      continue;
+    }
+    unsigned long long bytes = batchBytes(batch_iter->second);
+    msgRateLimit.refund(batch_iter->second.size());
+    byteRateLimit.refund(bytes);
+    incCounter("dropped for queue size", batch_iter->second.size());
+    *dropped_messages += batch_iter->second.size();
+    *dropped_bytes += bytes;
+    batches.erase(batch_iter);
+  }
 }
 
 /*
@@ -558,6 +1332,41 @@ bool scribeHandler::throttleDeny(int num_messages) {
  * In this example we see just one `source', however, there could be more in the
  * same `sources' config.
  *
+ * A `syslog' source receives syslog messages over UDP. Its `category' may
+ * use {facility}, {severity}, {host} and {program}, which are filled in
+ * from each message. {host} and {program} come from the senders, so they
+ * can create any number of categories.
+ *
+ *   <source>
+ *     <category>syslog_{facility}</category>
+ *     <type>syslog</type>
+ *     <port>514</port>
+ *     <!-- optional: bind, batch_size, max_message_size, receive_buffer -->
+ *   </source>
+ *
+ * A `shm' source creates shared memory rings /scribe.<name>.0 to
+ * .<rings - 1> for producers on this host, which write to them with
+ * ShmRingWriter from shm_ring.h. `category' is used for records without
+ * one.
+ *
+ *   <source>
+ *     <category>default</category>
+ *     <type>shm</type>
+ *     <name>scribe</name>
+ *     <!-- optional: rings, ring_size, batch_size -->
+ *   </source>
+ *
+ * A `lines' source listens for plain TCP connections that send a category
+ * line, or an empty line for `category', and then newline-terminated
+ * messages, e.g. (echo httpd; tail -f /var/log/httpd.log) | nc host 1465
+ *
+ *   <source>
+ *     <category>default</category>
+ *     <type>lines</type>
+ *     <port>1465</port>
+ *     <!-- optional: bind, buffer_size, max_line_size, max_connections -->
+ *   </source>
+ *
  * By default, configuration files are read from `/etc/scribe.d', unless moved
  * elsewhere via the `config_dir' global option. This method allows one to add
  * sources when installing a log-producing application.
@@ -565,7 +1374,7 @@ bool scribeHandler::throttleDeny(int num_messages) {
 void scribeHandler::startSources() {
 
   string configDir;
-  if (!config.getString("config_dir", configDir)) {
+  if (!getConfig()->getString("config_dir", configDir)) {
     configDir = "/etc/scribe.d";
   }
 
@@ -609,8 +1418,9 @@ void scribeHandler::stopSources() {
   runningSources.clear();
 }
 
+// Should be called while holding a writeLock on scribeHandlerLock, after
+// retireCategoryTables() and waiting for the generation it returned
 void scribeHandler::stopStores() {
-  setStatus(STOPPING);
   shared_ptr<store_list_t> store_list;
   for (store_list_t::iterator store_iter = defaultStores.begin();
       store_iter != defaultStores.end(); ++store_iter) {
@@ -619,33 +1429,46 @@ void scribeHandler::stopStores() {
     }
   }
   defaultStores.clear();
+  createdCategories.clear();
   deleteCategoryMap(categories);
   deleteCategoryMap(category_prefixes);
+  compileCategoryPrefixes();
 
 }
 
 void scribeHandler::shutdown() {
+  tables_generation_ptr_t old_generation;
+  {
+    RWGuard monitor(*scribeHandlerLock, true);
+    setStatus(STOPPING);
+    stopSources();
+    old_generation = retireCategoryTables();
+  }
+  waitForGeneration(old_generation);
+
   RWGuard monitor(*scribeHandlerLock, true);
-  stopSources();
   stopStores();
   // calling stop to allow thrift to clean up client states and exit
-  server->stop();
+  for (server_list_t::iterator server_iter = servers.begin();
+       server_iter != servers.end();
+       ++server_iter) {
+    (*server_iter)->stop();
+  }
   scribe::stopServer();
 }
 
 void scribeHandler::reinitialize() {
-  RWGuard monitor(*scribeHandlerLock, true);
-
   // reinitialize() will re-read the config file and re-configure the stores.
   // This is done without shutting down the Thrift server, so this will not
   // reconfigure any server settings such as port number.
+  // Log() keeps using the running stores until the new ones are ready, and
+  // stores whose configuration has not changed are kept.
   LOG_OPER("reinitializing");
-  stopSources();
-  stopStores();
   initialize();
 }
 
 void scribeHandler::initialize() {
+  pthread_mutex_lock(&initializeMutex);
 
   // This clears out the error state, grep for setStatus below for details
   setStatus(STARTING);
@@ -654,6 +1477,9 @@ void scribeHandler::initialize() {
   bool perfect_config = true;
   bool enough_config_to_run = true;
   int numstores = 0;
+  StoreGraph graph;
+  store_key_map_t running_stores;
+  size_t num_running = 0;
 
 
   try {
@@ -662,7 +1488,7 @@ void scribeHandler::initialize() {
     // which is very handy for testing and one-off applications.
     // Otherwise we'll try to get it from the service management console and
     // fall back to a default file location. This is for production.
-    StoreConf localconfig;
+    pStoreConf localconfig(new StoreConf);
     string config_file;
 
     if (configFilename.empty()) {
@@ -670,44 +1496,152 @@ void scribeHandler::initialize() {
     } else {
       config_file = configFilename;
     }
-    localconfig.parseConfig(config_file);
-    // overwrite the current StoreConf
-    config = localconfig;
-
-    // load the global config
-    config.getUnsigned("max_msg_per_second", maxMsgPerSecond);
-    config.getUnsignedLongLong("max_queue_size", maxQueueSize);
-    config.getUnsigned("check_interval", checkPeriod);
-    config.getUnsigned("update_status_interval", updateStatusInterval);
-    if (updateStatusInterval <= 0) {
-      updateStatusInterval = DEFAULT_UPDATE_STATUS_INTERVAL; 
+    localconfig->parseConfig(config_file);
+
+    // Read the global config into locals, and publish it all at once below.
+    // Settings missing from the file keep their current values, which only
+    // this thread writes.
+    unsigned long max_msg_per_second = maxMsgPerSecond;
+    unsigned long long max_bytes_per_second = maxBytesPerSecond;
+    unsigned long long max_queue_size = maxQueueSize;
+    unsigned long max_queue_delay_ms = maxQueueDelayMs;
+    unsigned long peer_fair_share_factor = peerFairShareFactor;
+    unsigned long peer_window_ms = peerWindowMs;
+    unsigned long check_period = checkPeriod;
+    unsigned long update_status_interval = updateStatusInterval;
+    unsigned long max_conn = maxConn;
+    unsigned long max_parked_messages = maxParkedMessages;
+    unsigned long category_idle_timeout = categoryIdleTimeout;
+    localconfig->getUnsigned("max_msg_per_second", max_msg_per_second);
+    localconfig->getUnsignedLongLong("max_bytes_per_second",
+                                     max_bytes_per_second);
+    localconfig->getUnsignedLongLong("max_queue_size", max_queue_size);
+    localconfig->getUnsigned("max_queue_delay_ms", max_queue_delay_ms);
+    localconfig->getUnsigned("peer_fair_share_factor", peer_fair_share_factor);
+    localconfig->getUnsigned("peer_window_ms", peer_window_ms);
+    if (peer_window_ms == 0) {
+      peer_window_ms = DEFAULT_PEER_WINDOW_MS;
+    }
+#ifndef THRIFT_POST_2_0
+    // only PeerEventHandler can tell who sent a request, so every peer
+    // would go unaccounted
+    if (peer_fair_share_factor > 0) {
+      LOG_OPER("peer_fair_share_factor needs a newer Thrift "
+               "(--enable-thriftpost20), ignoring it");
+      peer_fair_share_factor = 0;
+    }
+#endif
+    localconfig->getUnsigned("check_interval", check_period);
+    localconfig->getUnsigned("update_status_interval", update_status_interval);
+    if (update_status_interval <= 0) {
+      update_status_interval = DEFAULT_UPDATE_STATUS_INTERVAL;
     }
-    if (checkPeriod == 0) {
-      checkPeriod = 1;
+    if (check_period == 0) {
+      check_period = 1;
     }
-    config.getUnsigned("max_conn", maxConn);
+    localconfig->getUnsigned("max_conn", max_conn);
+    localconfig->getUnsigned("max_parked_messages", max_parked_messages);
+    localconfig->getUnsigned("category_idle_timeout", category_idle_timeout);
+    unsigned long max_category_names = 0;
+    bool limit_category_names =
+      localconfig->getUnsigned("max_category_names", max_category_names);
 
     // If new_thread_per_category, then we will create a new thread/StoreQueue
     // for every unique message category seen.  Otherwise, we will just create
     // one thread for each top-level store defined in the config file.
     string temp;
-    config.getString("new_thread_per_category", temp);
-    if (0 == temp.compare("no")) {
-      newThreadPerCategory = false;
-    } else {
-      newThreadPerCategory = true;
+    localconfig->getString("new_thread_per_category", temp);
+    bool new_thread_per_category = (0 != temp.compare("no"));
+
+    unsigned long int new_port = port;
+    localconfig->getUnsigned("port", new_port);
+    if (port != 0 && new_port != port) {
+      LOG_OPER("port %lu from conf file overriding old port %lu",
+               new_port, port);
+    }
+    if (new_port <= 0) {
+      throw runtime_error("No port number configured");
     }
+    string unix_socket_path = unixSocketPath;
+    localconfig->getString("unix_socket_path", unix_socket_path);
+    // octal, as for chmod
+    unsigned long unix_socket_mode = unixSocketMode;
+    string socket_mode;
+    if (localconfig->getString("unix_socket_mode", socket_mode)) {
+      unix_socket_mode = strtoul(socket_mode.c_str(), NULL, 8) & 0777;
+    }
+
+    // check if config sets the size to use for the ThreadManager
+    size_t num_thrift_server_threads = numThriftServerThreads;
+    unsigned long int num_threads;
+    if (localconfig->getUnsigned("num_thrift_server_threads", num_threads)) {
+      num_thrift_server_threads = (size_t) num_threads;
 
-    unsigned long int old_port = port;
-    config.getUnsigned("port", port);
-    if (old_port != 0 && port != old_port) {
-      LOG_OPER("port %lu from conf file overriding old port %lu", port, old_port);
+      if (num_thrift_server_threads <= 0) {
+        LOG_OPER("invalid value for num_thrift_server_threads: %lu",
+            num_threads);
+        throw runtime_error("invalid value for num_thrift_server_threads");
+      }
     }
-    if (port <= 0) {
-      throw runtime_error("No port number configured");
+
+    // number of event loops accepting and reading Thrift connections
+    size_t num_io_reactors = numIoReactors;
+    unsigned long int num_reactors;
+    if (localconfig->getUnsigned("num_io_reactors", num_reactors)) {
+      num_io_reactors = (size_t) num_reactors;
+
+      if (num_io_reactors <= 0) {
+        LOG_OPER("invalid value for num_io_reactors: %lu", num_reactors);
+        throw runtime_error("invalid value for num_io_reactors");
+      }
     }
 
-    startSources();
+    // number of threads running the store queues, which can only grow.
+    // Stores that block, like network stores waiting on a slow remote
+    // host, each hold one of them, so leave room for those.
+    unsigned long int num_store_threads = 0;
+    if (localconfig->getUnsigned("num_store_threads", num_store_threads) &&
+        num_store_threads <= 0) {
+      LOG_OPER("invalid value for num_store_threads: %lu",
+               num_store_threads);
+      throw runtime_error("invalid value for num_store_threads");
+    }
+
+    // Log() and the store threads read these without waiting for
+    // initialize(), so they only change together under the write lock, and
+    // the config, which StoreConf falls back to, is swapped atomically
+    {
+      RWGuard monitor(*scribeHandlerLock, true);
+      boost::atomic_store(&config,
+                          boost::shared_ptr<const StoreConf>(localconfig));
+      maxMsgPerSecond = max_msg_per_second;
+      maxBytesPerSecond = max_bytes_per_second;
+      msgRateLimit.configure(maxMsgPerSecond);
+      byteRateLimit.configure(maxBytesPerSecond);
+      maxQueueSize = max_queue_size;
+      maxQueueDelayMs = max_queue_delay_ms;
+      peerFairShareFactor = peer_fair_share_factor;
+      peerWindowMs = peer_window_ms;
+      peerTable.configure(peerWindowMs, peerFairShareFactor,
+                          PEER_IDLE_MS / peerWindowMs);
+      checkPeriod = check_period;
+      updateStatusInterval = update_status_interval;
+      maxConn = max_conn;
+      maxParkedMessages = max_parked_messages;
+      categoryIdleTimeout = category_idle_timeout;
+      if (limit_category_names) {
+        CategoryTable::setLimit(max_category_names);
+      }
+      newThreadPerCategory = new_thread_per_category;
+      port = new_port;
+      unixSocketPath = unix_socket_path;
+      unixSocketMode = unix_socket_mode;
+      numThriftServerThreads = num_thrift_server_threads;
+      numIoReactors = num_io_reactors;
+    }
+    if (num_store_threads) {
+      StoreExecutor::instance().setNumThreads(num_store_threads);
+    }
 
 #ifdef USE_ZOOKEEPER
     setStatusDetails("initialize ZKClient");
@@ -728,19 +1662,19 @@ void scribeHandler::initialize() {
 
     // comma separated host:port pairs, each corresponding to a zk
     // server. e.g. "127.0.0.1:3000,127.0.0.1:3001,127.0.0.1:3002"
-    if (config.getString("zk_server", zkServer)) {
+    if (localconfig->getString("zk_server", zkServer)) {
         LOG_OPER("Using zk_server %s", zkServer.c_str());
     } else {
         LOG_OPER("No zk_server specified");
     }
 
     // znode to register this task at in /path/to/znode format.
-    if (config.getString("zk_registration_prefix", zkRegistrationPrefix)) {
+    if (localconfig->getString("zk_registration_prefix", zkRegistrationPrefix)) {
         LOG_OPER("Using zk_registration_prefix %s", zkRegistrationPrefix.c_str());
     } else {
         LOG_OPER("No zk_registration_prefix specified");
     }
-    if (config.getString("zk_agg_selector", zkAggSelectorKey)) {
+    if (localconfig->getString("zk_agg_selector", zkAggSelectorKey)) {
         LOG_OPER("Using zk_agg_selector %s", zkAggSelectorKey.c_str());
         ZKClient::setAggSelectorStrategy(zkAggSelectorKey);
     } else {
@@ -759,30 +1693,20 @@ void scribeHandler::initialize() {
     }
 #endif
 
-    // check if config sets the size to use for the ThreadManager
-    unsigned long int num_threads;
-    if (config.getUnsigned("num_thrift_server_threads", num_threads)) {
-      numThriftServerThreads = (size_t) num_threads;
-
-      if (numThriftServerThreads <= 0) {
-        LOG_OPER("invalid value for num_thrift_server_threads: %lu",
-            num_threads);
-        throw runtime_error("invalid value for num_thrift_server_threads");
-      }
-    }
-
-
-    // Build a new map of stores, and move stores from the old map as
-    // we find them in the config file. Any stores left in the old map
-    // at the end will be deleted.
+    // Build a new graph of stores, and move running stores into it as we
+    // find them unchanged in the config file. Running stores that are not
+    // moved are stopped once the new graph has been swapped in.
+    indexRunningStores(running_stores);
+    num_running = running_stores.size();
     std::vector<pStoreConf> store_confs;
-    config.getAllStores(store_confs);
+    localconfig->getAllStores(store_confs);
     for (std::vector<pStoreConf>::iterator iter = store_confs.begin();
         iter != store_confs.end();
         ++iter) {
       pStoreConf store_conf = (*iter);
 
-      bool success = configureStore(store_conf, &numstores);
+      bool success = configureStore(store_conf, &numstores, graph,
+                                    running_stores);
 
       if (!success) {
         perfect_config = false;
@@ -804,11 +1728,25 @@ void scribeHandler::initialize() {
     enough_config_to_run = false;
   }
 
-  if (!enough_config_to_run) {
-    // If the new configuration failed we'll run with
-    // nothing configured and status set to WARNING
-    deleteCategoryMap(categories);
-    deleteCategoryMap(category_prefixes);
+  if (enough_config_to_run) {
+    LOG_OPER("kept <%lu> running stores",
+             (unsigned long) (num_running - running_stores.size()));
+    swapStoreGraph(graph);
+  } else {
+    // If the new configuration failed we keep running whatever stores we
+    // have, which is nothing on startup, with status set to WARNING
+    stopNewStores(graph);
+  }
+
+  try {
+    RWGuard monitor(*scribeHandlerLock, true);
+    stopSources();
+    startSources();
+  } catch(const std::exception& e) {
+    string errormsg("Bad config - exception starting sources: ");
+    errormsg += e.what();
+    setStatusDetails(errormsg);
+    perfect_config = false;
   }
 
 
@@ -819,11 +1757,46 @@ void scribeHandler::initialize() {
     setStatusDetails("");
     setStatus(ALIVE);
   }
+  pthread_mutex_unlock(&initializeMutex);
 }
 
 
+typedef std::set<shared_ptr<StoreQueue> > store_set_t;
+
+// Adds every store of a graph to stores
+static void addGraphStores(const category_map_t& cats,
+                           const category_map_t& prefixes,
+                           const store_list_t& default_stores,
+                           store_set_t& stores) {
+  const category_map_t* maps[] = {&cats, &prefixes};
+  for (size_t i = 0; i < sizeof(maps) / sizeof(maps[0]); ++i) {
+    for (category_map_t::const_iterator cat_iter = maps[i]->begin();
+         cat_iter != maps[i]->end();
+         ++cat_iter) {
+      stores.insert(cat_iter->second->begin(), cat_iter->second->end());
+    }
+  }
+  stores.insert(default_stores.begin(), default_stores.end());
+}
+
+// Takes the running store for category built from the configuration
+// identified by key, if there is one
+static bool takeRunningStore(store_key_map_t& running_stores,
+                             const string& category, const string& key,
+                             shared_ptr<StoreQueue>& _return) {
+  store_key_map_t::iterator iter = running_stores.find(category + '\n' + key);
+  if (iter == running_stores.end()) {
+    return false;
+  }
+  _return = iter->second;
+  running_stores.erase(iter);
+  return true;
+}
+
 // Configures the store specified by the store configuration. Returns false if failed.
-bool scribeHandler::configureStore(pStoreConf store_conf, int *numstores) {
+bool scribeHandler::configureStore(pStoreConf store_conf, int *numstores,
+                                   StoreGraph& graph,
+                                   store_key_map_t& running_stores) {
   string category;
   shared_ptr<StoreQueue> pstore;
   vector<string> category_list;
@@ -859,7 +1832,8 @@ bool scribeHandler::configureStore(pStoreConf store_conf, int *numstores) {
   else if (single_category) {
     // configure single store
     shared_ptr<StoreQueue> result =
-        configureStoreCategory(store_conf, category_list[0], model);
+        configureStoreCategory(store_conf, category_list[0], model, graph,
+                               running_stores);
 
     if (result == NULL) {
       return false;
@@ -879,7 +1853,8 @@ bool scribeHandler::configureStore(pStoreConf store_conf, int *numstores) {
     }
 
     // create model so that we can create stores as copies of this model
-    model = configureStoreCategory(store_conf, categories, model, true);
+    model = configureStoreCategory(store_conf, categories, model, graph,
+                                   running_stores, true);
 
     if (model == NULL) {
       string errormsg("Bad config - could not create store for category: ");
@@ -892,7 +1867,8 @@ bool scribeHandler::configureStore(pStoreConf store_conf, int *numstores) {
     vector<string>::iterator iter;
     for (iter = category_list.begin(); iter < category_list.end(); iter++) {
       shared_ptr<StoreQueue> result =
-          configureStoreCategory(store_conf, *iter, model);
+          configureStoreCategory(store_conf, *iter, model, graph,
+                                 running_stores);
 
       if (!result) {
         return false;
@@ -911,10 +1887,13 @@ shared_ptr<StoreQueue> scribeHandler::configureStoreCategory(
     pStoreConf store_conf,                       //configuration for store
     const string &category,                      //category name
     const boost::shared_ptr<StoreQueue> &model,  //model to use (optional)
+    StoreGraph& graph,                           //graph to add the store to
+    store_key_map_t& running_stores,             //stores that can be kept
     bool category_list) {                        //is a list of stores?
 
   bool is_default = false;
   bool already_created = false;
+  bool already_running = false;
 
   if (category.empty()) {
     setStatusDetails("Bad config - store with blank category");
@@ -946,7 +1925,11 @@ shared_ptr<StoreQueue> scribeHandler::configureStoreCategory(
     if (model != NULL) {
       // Create a copy of the model if we want a new thread per category
       if (newThreadPerCategory && !is_default && !is_prefix_category) {
-        pstore = shared_ptr<StoreQueue>(new StoreQueue(model, category));
+        already_running = takeRunningStore(running_stores, category,
+                                           model->getConfigKey(), pstore);
+        if (!already_running) {
+          pstore = shared_ptr<StoreQueue>(new StoreQueue(model, category));
+        }
       } else {
         pstore = model;
         already_created = true;
@@ -970,9 +1953,15 @@ shared_ptr<StoreQueue> scribeHandler::configureStoreCategory(
       // Determine if this store is just a model for later stores
       is_model = newThreadPerCategory && categories;
 
-      pstore =
-        shared_ptr<StoreQueue>(new StoreQueue(type, store_name, checkPeriod,
-                                              is_model, multi_category));
+      string key = storeConfigKey(store_conf);
+      already_running = takeRunningStore(running_stores, store_name, key,
+                                         pstore);
+      if (!already_running) {
+        pstore =
+          shared_ptr<StoreQueue>(new StoreQueue(type, store_name, checkPeriod,
+                                                is_model, multi_category));
+        pstore->setConfigKey(key);
+      }
     }
   } catch (...) {
     pstore.reset();
@@ -986,7 +1975,9 @@ shared_ptr<StoreQueue> scribeHandler::configureStoreCategory(
   }
 
   // open store. and configure it if not copied from a model
-  if (model == NULL) {
+  if (already_running) {
+    LOG_OPER("[%s] keeping running store", category.c_str());
+  } else if (model == NULL) {
     pstore->configureAndOpen(store_conf);
   } else if (!already_created) {
     pstore->open();
@@ -997,26 +1988,27 @@ shared_ptr<StoreQueue> scribeHandler::configureStoreCategory(
   }
   if (is_default) {
     LOG_OPER("Creating default store");
-    defaultStores.push_back(pstore);
+    graph.defaultStores.push_back(pstore);
   } else if (is_prefix_category) {
     shared_ptr<store_list_t> pstores;
-    category_map_t::iterator category_iter = category_prefixes.find(category);
-    if (category_iter != category_prefixes.end()) {
+    category_map_t::iterator category_iter =
+      graph.categoryPrefixes.find(category);
+    if (category_iter != graph.categoryPrefixes.end()) {
       pstores = category_iter->second;
     } else {
       pstores = shared_ptr<store_list_t>(new store_list_t);
-      category_prefixes[category] = pstores;
+      graph.categoryPrefixes[category] = pstores;
     }
     pstores->push_back(pstore);
   } else if (!pstore->isModelStore()) {
     // push the new store onto the new map if it's not just a model
     shared_ptr<store_list_t> pstores;
-    category_map_t::iterator category_iter = categories.find(category);
-    if (category_iter != categories.end()) {
+    category_map_t::iterator category_iter = graph.categories.find(category);
+    if (category_iter != graph.categories.end()) {
       pstores = category_iter->second;
     } else {
       pstores = shared_ptr<store_list_t>(new store_list_t);
-      categories[category] = pstores;
+      graph.categories[category] = pstores;
     }
     pstores->push_back(pstore);
   }
@@ -1024,6 +2016,250 @@ shared_ptr<StoreQueue> scribeHandler::configureStoreCategory(
   return pstore;
 }
 
+// Identifies a store's configuration: its own section of the config file
+// and the global settings it is built with
+string scribeHandler::storeConfigKey(pStoreConf store_conf) {
+  ostringstream key;
+  key << *store_conf;
+
+  string_map_t inherited;
+  getConfig()->getInheritedValues(inherited);
+  for (string_map_t::const_iterator iter = inherited.begin();
+       iter != inherited.end();
+       ++iter) {
+    key << iter->first << '=' << iter->second << '\n';
+  }
+  key << "check_interval=" << checkPeriod << '\n'
+      << "new_thread_per_category=" << newThreadPerCategory << '\n';
+  return key.str();
+}
+
+// Indexes every running store by the category it handles and its config
+// key, so that initialize() can keep the ones that have not changed
+void scribeHandler::indexRunningStores(store_key_map_t& _return) {
+  store_set_t stores;
+  {
+    RWGuard monitor(*scribeHandlerLock);
+    addGraphStores(categories, category_prefixes, defaultStores, stores);
+  }
+  for (store_set_t::const_iterator store_iter = stores.begin();
+       store_iter != stores.end();
+       ++store_iter) {
+    _return[(*store_iter)->getCategoryHandled() + '\n' +
+            (*store_iter)->getConfigKey()] = *store_iter;
+  }
+}
+
+// Keeps the categories created from a model since the last initialize(),
+// if the category would still be created from a model with the same
+// configuration. Other categories are created again by the next Log().
+// Should be called while holding a writeLock on scribeHandlerLock
+void scribeHandler::carryOverCategories(StoreGraph& graph) {
+  category_prefix_trie_t trie;
+  for (category_map_t::iterator prefix_iter = graph.categoryPrefixes.begin();
+       prefix_iter != graph.categoryPrefixes.end();
+       ++prefix_iter) {
+    const string& prefix = prefix_iter->first;
+    trie.insert(prefix.substr(0, prefix.size() - 1), prefix_iter->second);
+  }
+
+  for (category_map_t::iterator cat_iter = categories.begin();
+       cat_iter != categories.end();
+       ++cat_iter) {
+    if (graph.categories.find(cat_iter->first) != graph.categories.end()) {
+      continue;
+    }
+
+    const store_list_t* models = &graph.defaultStores;
+    const shared_ptr<store_list_t>* prefix_stores =
+      trie.longestPrefixMatch(cat_iter->first);
+    if (prefix_stores) {
+      models = prefix_stores->get();
+    }
+
+    const store_list_t& stores = *cat_iter->second;
+    bool unchanged = !models->empty() && models->size() == stores.size();
+    for (size_t i = 0; unchanged && i < stores.size(); ++i) {
+      // without new_thread_per_category the model is the store itself
+      unchanged = (*models)[i] == stores[i] ||
+        ((*models)[i]->isModelStore() &&
+         (*models)[i]->getConfigKey() == stores[i]->getConfigKey());
+    }
+    if (unchanged) {
+      graph.categories.insert(*cat_iter);
+      graph.createdCategories.insert(cat_iter->first);
+    }
+  }
+}
+
+// Makes graph the running stores, and stops the running stores it does not
+// include once no Log() call can still be adding messages to them. graph is
+// left holding the old stores.
+void scribeHandler::swapStoreGraph(StoreGraph& graph) {
+  tables_generation_ptr_t old_generation;
+  store_set_t old_stores;
+  store_set_t new_stores;
+  {
+    RWGuard monitor(*scribeHandlerLock, true);
+    carryOverCategories(graph);
+
+    // keep the store lists of unchanged categories, so that
+    // publishCategoryTables() keeps their routes
+    for (category_map_t::iterator cat_iter = graph.categories.begin();
+         cat_iter != graph.categories.end();
+         ++cat_iter) {
+      category_map_t::iterator old_iter = categories.find(cat_iter->first);
+      if (old_iter != categories.end() &&
+          *old_iter->second == *cat_iter->second) {
+        cat_iter->second = old_iter->second;
+      }
+    }
+
+    addGraphStores(categories, category_prefixes, defaultStores, old_stores);
+    addGraphStores(graph.categories, graph.categoryPrefixes,
+                   graph.defaultStores, new_stores);
+    for (store_set_t::const_iterator store_iter = new_stores.begin();
+         store_iter != new_stores.end();
+         ++store_iter) {
+      old_stores.erase(*store_iter);
+    }
+
+    categories.swap(graph.categories);
+    category_prefixes.swap(graph.categoryPrefixes);
+    defaultStores.swap(graph.defaultStores);
+    createdCategories.swap(graph.createdCategories);
+    compileCategoryPrefixes();
+    old_generation = publishCategoryTables(true);
+  }
+
+  // Log() calls that started before the swap may still add to old stores
+  waitForGeneration(old_generation);
+
+  for (store_set_t::const_iterator store_iter = old_stores.begin();
+       store_iter != old_stores.end();
+       ++store_iter) {
+    if (!(*store_iter)->isModelStore()) {
+      (*store_iter)->stop();
+    }
+  }
+
+  // A new store couldn't open its journal while the store it replaces
+  // still had it open. Stopping that store drained it and closed the
+  // journal, so what is left in it is replayed exactly once.
+  for (store_set_t::const_iterator store_iter = new_stores.begin();
+       store_iter != new_stores.end();
+       ++store_iter) {
+    (*store_iter)->openJournal();
+  }
+}
+
+// Stops the stores of a graph that is not going to be used, except the ones
+// that were kept from the running stores
+void scribeHandler::stopNewStores(const StoreGraph& graph) {
+  store_set_t running_stores;
+  store_set_t new_stores;
+  {
+    RWGuard monitor(*scribeHandlerLock);
+    addGraphStores(categories, category_prefixes, defaultStores,
+                   running_stores);
+  }
+  addGraphStores(graph.categories, graph.categoryPrefixes, graph.defaultStores,
+                 new_stores);
+  for (store_set_t::const_iterator store_iter = new_stores.begin();
+       store_iter != new_stores.end();
+       ++store_iter) {
+    if (running_stores.find(*store_iter) == running_stores.end() &&
+        !(*store_iter)->isModelStore()) {
+      (*store_iter)->stop();
+    }
+  }
+}
+
+// Tears down the categories created from a model whose stores have all been
+// idle for categoryIdleTimeout seconds, after draining and closing their
+// stores. The next message for such a category creates it again.
+// Only stops the stores of a category that were created for it, not the
+// default or prefix stores it shares without new_thread_per_category.
+// Runs on the materializer thread, so that the category can't be created
+// again before its old stores have been drained.
+void scribeHandler::reclaimIdleCategories() {
+  unsigned long idle_ms = categoryIdleTimeout * 1000;
+  if (!idle_ms) {
+    return;
+  }
+  // try again later rather than stop stores a reinitialize may be keeping
+  if (pthread_mutex_trylock(&initializeMutex) != 0) {
+    return;
+  }
+
+  unsigned long start_ms = scribe::clock::nowInMsec();
+  unsigned long num_reclaimed = 0;
+  unsigned long num_created;
+  store_list_t idle_stores;
+  tables_generation_ptr_t old_generation;
+  {
+    RWGuard monitor(*scribeHandlerLock, true);
+    store_set_t shared_stores;
+    addGraphStores(category_map_t(), category_prefixes, defaultStores,
+                   shared_stores);
+
+    for (set<string>::iterator cat_iter = createdCategories.begin();
+         cat_iter != createdCategories.end();) {
+      category_map_t::iterator store_iter = categories.find(*cat_iter);
+      if (store_iter == categories.end()) {
+        createdCategories.erase(cat_iter++);
+        continue;
+      }
+
+      const store_list_t& stores = *store_iter->second;
+      bool idle = true;
+      for (size_t i = 0; idle && i < stores.size(); ++i) {
+        idle = stores[i]->getIdleMs() >= idle_ms;
+      }
+      if (!idle) {
+        ++cat_iter;
+        continue;
+      }
+
+      LOG_OPER("[%s] reclaiming idle category", cat_iter->c_str());
+      for (size_t i = 0; i < stores.size(); ++i) {
+        if (shared_stores.find(stores[i]) == shared_stores.end()) {
+          idle_stores.push_back(stores[i]);
+        }
+      }
+      categories.erase(store_iter);
+      createdCategories.erase(cat_iter++);
+      ++num_reclaimed;
+    }
+    num_created = createdCategories.size();
+
+    if (num_reclaimed) {
+      old_generation = publishCategoryTables(true);
+    }
+  }
+  pthread_mutex_unlock(&initializeMutex);
+
+  setCounter("created categories", num_created);
+  if (!num_reclaimed) {
+    return;
+  }
+
+  // a Log() call that found the category before it was unpublished may
+  // still be adding to its stores, and stop() drains whatever it added
+  waitForGeneration(old_generation);
+  for (store_list_t::iterator store_iter = idle_stores.begin();
+       store_iter != idle_stores.end();
+       ++store_iter) {
+    if (!(*store_iter)->isModelStore()) {
+      (*store_iter)->stop();
+    }
+  }
+
+  incCounter("categories reclaimed", num_reclaimed);
+  incCounter("reclaimed stores", idle_stores.size());
+  incCounter("category reclaim ms", scribe::clock::nowInMsec() - start_ms);
+}
+
 
 // delete everything in cats
 void scribeHandler::deleteCategoryMap(category_map_t& cats) {
@@ -1051,3 +2287,96 @@ void scribeHandler::deleteCategoryMap(category_map_t& cats) {
   } // for each category
   cats.clear();
 }
+
+// Rebuilds categoryPrefixTrie from category_prefixes.
+// Should be called while holding a writeLock on scribeHandlerLock
+void scribeHandler::compileCategoryPrefixes() {
+  shared_ptr<category_prefix_trie_t> trie(new category_prefix_trie_t);
+  for (category_map_t::iterator prefix_iter = category_prefixes.begin();
+       prefix_iter != category_prefixes.end();
+       ++prefix_iter) {
+    // prefix categories are configured with a trailing '*'
+    const string& prefix = prefix_iter->first;
+    trie->insert(prefix.substr(0, prefix.size() - 1), prefix_iter->second);
+  }
+  categoryPrefixTrie = trie;
+}
+
+// Returns the current snapshot of the category tables. Callers must not
+// hold on to it while waiting for scribeHandlerLock.
+category_tables_ptr_t scribeHandler::getCategoryTables() {
+  return boost::atomic_load(&categoryTables);
+}
+
+// Publish a new snapshot of the category tables for Log(). If retire is
+// set, stores that are no longer in the tables are going to be stopped:
+// returns the generation of the snapshots that could still point to them,
+// to pass to waitForGeneration() once the lock is released.
+// Should be called while holding a writeLock on scribeHandlerLock
+tables_generation_ptr_t scribeHandler::publishCategoryTables(bool retire) {
+  category_tables_ptr_t old_tables = getCategoryTables();
+  shared_ptr<CategoryTables> tables(new CategoryTables);
+  for (category_map_t::const_iterator cat_iter = categories.begin();
+       cat_iter != categories.end();
+       ++cat_iter) {
+    // reuse the resolved route if the category's stores have not changed
+    category_hash_t::const_iterator old_iter =
+      old_tables->categories.find(cat_iter->first);
+    if (old_iter != old_tables->categories.end() &&
+        old_iter->second.stores == cat_iter->second) {
+      tables->categories.insert(*old_iter);
+    } else {
+      tables->categories.insert(
+        make_pair(cat_iter->first,
+                  CategoryRoute(cat_iter->first, cat_iter->second)));
+    }
+  }
+  tables->prefixModels = categoryPrefixTrie;
+  tables->defaultModels = defaultStores;
+
+  tables_generation_ptr_t old_generation;
+  if (retire || !old_tables->generation) {
+    tables->generation = tables_generation_ptr_t(new TablesGeneration);
+    old_generation = old_tables->generation;
+  } else {
+    tables->generation = old_tables->generation;
+  }
+  boost::atomic_store(&categoryTables, category_tables_ptr_t(tables));
+  return retire ? old_generation : tables_generation_ptr_t();
+}
+
+// Replace the published snapshot with an empty one, so that every store can
+// be stopped once the returned generation has been waited for.
+// Should be called while holding a writeLock on scribeHandlerLock
+tables_generation_ptr_t scribeHandler::retireCategoryTables() {
+  shared_ptr<CategoryTables> tables(new CategoryTables);
+  tables->generation = tables_generation_ptr_t(new TablesGeneration);
+  category_tables_ptr_t old_tables =
+    boost::atomic_exchange(&categoryTables, category_tables_ptr_t(tables));
+  return old_tables->generation;
+}
+
+// Waits until no Log() call holds a snapshot of generation, and drops it.
+// Must not be called while holding scribeHandlerLock.
+void scribeHandler::waitForGeneration(tables_generation_ptr_t& generation) {
+  // Log() calls only hold a snapshot while they add their messages
+  while (generation && !generation.unique()) {
+    usleep(1000);
+  }
+  generation.reset();
+}
+
+// Returns the models a new category would be created from, like
+// createNewCategory(), or NULL if there are none
+const store_list_t* scribeHandler::findModels(const CategoryTables& tables,
+                                              const string& category) {
+  if (tables.prefixModels) {
+    const shared_ptr<store_list_t>* prefix_stores =
+      tables.prefixModels->longestPrefixMatch(category);
+    if (prefix_stores && !(*prefix_stores)->empty()) {
+      return prefix_stores->get();
+    }
+  }
+  return tables.defaultModels.empty() ? NULL : &tables.defaultModels;
+}
+
@@ -24,6 +24,12 @@
 #ifndef SCRIBE_SERVER_H
 #define SCRIBE_SERVER_H
 
+#include <boost/unordered_map.hpp>
+
+#include "counter_handle.h"
+#include "log_batch.h"
+#include "peer_table.h"
+#include "prefix_trie.h"
 #include "store.h"
 #include "store_queue.h"
 #include "source.h"
@@ -36,6 +42,86 @@
 typedef std::vector<boost::shared_ptr<StoreQueue> > store_list_t;
 typedef std::map<std::string, boost::shared_ptr<store_list_t> > category_map_t;
 typedef std::vector<boost::shared_ptr<Source> > source_list_t;
+// Running stores by the category they handle and their config key
+typedef std::map<std::string, boost::shared_ptr<StoreQueue> > store_key_map_t;
+
+/*
+ * The stores configured from one config file. initialize() builds a new
+ * one next to the running stores and swaps it in, so that Log() can keep
+ * going while stores are created and opened.
+ */
+struct StoreGraph {
+  category_map_t categories;
+  category_map_t categoryPrefixes;
+  store_list_t defaultStores;
+  std::set<std::string> createdCategories;
+};
+typedef std::vector<boost::shared_ptr<apache::thrift::server::TNonblockingServer> >
+  server_list_t;
+
+// A category as Log() sees it: its interned id, the stores it goes to and
+// its counters, resolved once when the category is published
+struct CategoryRoute {
+  category_id_t id;
+  boost::shared_ptr<store_list_t> stores;
+  store_priority_t priority;  // highest priority of its stores
+  bool journaled;             // whether any of its stores is journaled
+  CategoryCounterHandle receivedGood;
+  CategoryCounterHandle receivedBad;
+  CategoryCounterHandle deniedForRate;
+  CategoryCounterHandle deniedForDelay;
+  CategoryCounterHandle deniedForQueueSize;
+
+  CategoryRoute(const std::string& category,
+                const boost::shared_ptr<store_list_t>& store_list);
+};
+typedef boost::unordered_map<std::string, CategoryRoute> category_hash_t;
+typedef PrefixTrie<boost::shared_ptr<store_list_t> > category_prefix_trie_t;
+
+/*
+ * Immutable snapshot of the category tables used by Log().
+ * Readers get the current snapshot with an atomic load and never take
+ * scribeHandlerLock. Writers modify the master tables under the write lock
+ * and then publish a fresh snapshot. A store list is never modified once it
+ * has been published.
+ */
+struct TablesGeneration {};
+typedef boost::shared_ptr<TablesGeneration> tables_generation_ptr_t;
+
+struct CategoryTables {
+  category_hash_t categories;
+  // What new categories are created from, so that Log() can tell what a
+  // category's stores will be like before it is created
+  boost::shared_ptr<const category_prefix_trie_t> prefixModels;
+  store_list_t defaultModels;
+  // Shared by the snapshots published since stores were last retired, so
+  // that waiting for it covers Log() calls holding any of them
+  tables_generation_ptr_t generation;
+};
+typedef boost::shared_ptr<const CategoryTables> category_tables_ptr_t;
+
+/*
+ * A category that Log() has seen but that the materializer thread has not
+ * created yet, together with the messages parked for it in arrival order.
+ */
+struct PendingCategory {
+  unsigned long firstParkedMs;  // when the first message was parked
+  boost::shared_ptr<logentry_vector_t> messages;
+
+  PendingCategory() : firstParkedMs(0) {}
+};
+typedef std::map<std::string, PendingCategory> pending_category_map_t;
+
+// Messages from one Log() call grouped by the category they go to
+typedef std::map<const CategoryRoute*, logentry_vector_t> store_batch_map_t;
+
+// Where the messages of each store_batch_map_t entry were in the request,
+// kept when a Log() call may accept only some of its messages
+typedef std::map<const CategoryRoute*, std::vector<uint32_t> >
+  batch_index_map_t;
+
+// Journaled stores a Log() call must wait on, with the position to wait for
+typedef std::vector<std::pair<StoreQueue*, uint64_t> > journal_wait_list_t;
 
 std::string resultCodeToString(scribe::thrift::ResultCode::type rc);
 
@@ -50,18 +136,46 @@ class scribeHandler : virtual public scribe::thrift::scribeIf,
   void reinitialize();
 
   scribe::thrift::ResultCode::type Log(const std::vector<scribe::thrift::LogEntry>& messages);
+  // Same as Log() for a call parsed in place by LogBatchProcessor
+  scribe::thrift::ResultCode::type Log(const LogBatch& batch);
+  void LogWithBackoff(scribe::thrift::LogReply& _return,
+                      const std::vector<scribe::thrift::LogEntry>& messages);
+  void LogV2(scribe::thrift::LogV2Reply& _return,
+             const std::vector<scribe::thrift::LogEntry>& messages);
+  // What all of the above and sources that don't speak Thrift log through
+  scribe::thrift::ResultCode::type
+    logEntries(const logentry_slice_vector_t& entries,
+               unsigned long* retry_after_ms = NULL,
+               std::vector<bool>* accepted = NULL);
 
   void getVersion(std::string& _return) {_return = scribeversion;}
   facebook::fb303::fb_status getStatus();
   void getStatusDetails(std::string& _return);
   void setStatus(facebook::fb303::fb_status new_status);
   void setStatusDetails(const std::string& new_status_details);
-  void setQueueSizeCounter(bool get_read_lock);
+  void setQueueSizeCounter();
+
+  // fb303 counters, including the ones kept in CounterHandles, with
+  // "queue size" refreshed on demand
+  void getCounters(std::map<std::string, int64_t>& _return);
+  int64_t getCounter(const std::string& key);
+
+  // Address of the client whose request this thread is handling, set by
+  // LogBatchProcessor. NULL when not handling a Thrift request or when the
+  // Thrift library can't tell, which is always the case without
+  // THRIFT_POST_2_0.
+  static __thread const std::string* currentPeer;
 
   unsigned long int port; // it's long because that's all I implemented in the conf class
 
   // number of threads processing new Thrift connections
   size_t numThriftServerThreads;
+  // number of event loops doing Thrift socket I/O, each with its own
+  // listening socket on port
+  size_t numIoReactors;
+  // if set, Thrift is also served on this Unix domain socket
+  std::string unixSocketPath;
+  unsigned long unixSocketMode;  // permissions of the socket
   unsigned long updateStatusInterval;  // periodic interval to publish counters
 
 
@@ -69,10 +183,13 @@ class scribeHandler : virtual public scribe::thrift::scribeIf,
     return maxQueueSize;
   }
 
-  inline const StoreConf& getConfig() const {
-    return config;
+  // The global config, which is replaced as a whole by initialize()
+  inline boost::shared_ptr<const StoreConf> getConfig() const {
+    return boost::atomic_load(&config);
   }
 
+  // These look up the counter by name on every call. Counters bumped for
+  // every message or batch should use a CounterHandle instead.
   void incCounter(std::string category, std::string counter);
   void incCounter(std::string category, std::string counter, long amount);
   void incCounter(std::string counter);
@@ -81,16 +198,23 @@ class scribeHandler : virtual public scribe::thrift::scribeIf,
 
 	std::string resultCodeToString(scribe::thrift::ResultCode::type rc);
 
-  inline void setServer(
+  // Adds one of the Thrift servers that shutdown() must stop.
+  // Should only be called before the servers start serving.
+  inline void addServer(
       boost::shared_ptr<apache::thrift::server::TNonblockingServer> & server) {
-    this->server = server;
+    servers.push_back(server);
   }
 
   unsigned long getMaxConn() {
     return maxConn;
   }
+
+  // this needs to be public for the thread creation to get to it,
+  // but no one else should ever call it.
+  void materializerThreadMember();
+
  private:
-  boost::shared_ptr<apache::thrift::server::TNonblockingServer> server;
+  server_list_t servers;
 
   unsigned long checkPeriod; // periodic check interval for all contained stores
 
@@ -100,20 +224,66 @@ class scribeHandler : virtual public scribe::thrift::scribeIf,
   category_map_t categories;
   category_map_t category_prefixes;
 
+  // category_prefixes compiled for longest-prefix-match lookups.
+  // Rebuilt and swapped in whenever the configuration is loaded.
+  boost::shared_ptr<const category_prefix_trie_t> categoryPrefixTrie;
+
+  // Snapshot of categories published for lock-free lookups in Log().
+  // Only access through getCategoryTables() and publishCategoryTables().
+  category_tables_ptr_t categoryTables;
+
+  // New categories are created asynchronously by the materializer thread so
+  // that Log() never has to wait for stores to be built and opened.
+  // Messages for a category that is being created are parked here and
+  // handed to its stores once it is published.
+  pending_category_map_t pendingCategories;
+  std::queue<std::string> materializeQueue;  // categories left to create
+  unsigned long numParkedMessages;
+  unsigned long maxParkedMessages;
+  unsigned long maxCategoryCreateMs;  // longest wait for a category so far
+  bool materializerStopping;
+  pthread_t materializerThread;
+  pthread_mutex_t pendingMutex;  // Must be held to read/modify all of the above
+  pthread_cond_t materializeCond;
+
+  // Categories in categories that were created from a model rather than
+  // configured. The materializer thread tears them down once all their
+  // stores have been idle for categoryIdleTimeout seconds, 0 meaning never,
+  // and the next message for them creates them again.
+  std::set<std::string> createdCategories;
+  unsigned long categoryIdleTimeout;
+
   // the default stores
   store_list_t defaultStores;
   source_list_t runningSources;
 
+  // Held for the whole of initialize() so that only one new store graph is
+  // built at a time
+  pthread_mutex_t initializeMutex;
+
   std::string configFilename;
   facebook::fb303::fb_status status;
   std::string statusDetails;
   apache::thrift::concurrency::Mutex statusLock;
-  time_t lastMsgTime;
-  unsigned long numMsgLastSecond;
   unsigned long maxMsgPerSecond;
+  unsigned long long maxBytesPerSecond;
+  TokenBucket msgRateLimit;   // global rate limits
+  TokenBucket byteRateLimit;
   unsigned long long maxQueueSize;
+  // Messages shed as the queues fill up, by priority
+  CounterHandle deniedForPriority[NUM_PRIORITIES];
+  // Requests for a category are shed once one of its stores has had a
+  // message queued for longer than this. 0 disables it.
+  unsigned long maxQueueDelayMs;
+  // Clients over this many times their fair share are turned away once the
+  // queues are half full, see PeerTable. 0 disables it.
+  unsigned long peerFairShareFactor;
+  unsigned long peerWindowMs;
+  PeerTable peerTable;
+  CounterHandle deniedForPeerShare;
   unsigned long maxConn;
-  StoreConf config;
+  // Only access through getConfig() outside of initialize()
+  boost::shared_ptr<const StoreConf> config;
   bool newThreadPerCategory;
 
 #ifdef USE_ZOOKEEPER
@@ -123,6 +293,8 @@ class scribeHandler : virtual public scribe::thrift::scribeIf,
   /* mutex to syncronize access to scribeHandler.
    * A single mutex is fine since it only needs to be locked in write mode
    * during start/stop/reinitialize or when we need to create a new category.
+   * Log() never takes it, see CategoryTables and PendingCategory.
+   * If acquiring both, always take scribeHandlerLock before pendingMutex.
    */
   boost::shared_ptr<apache::thrift::concurrency::ReadWriteMutex>
     scribeHandlerLock;
@@ -133,8 +305,33 @@ class scribeHandler : virtual public scribe::thrift::scribeIf,
   const scribeHandler& operator=(const scribeHandler& rhs);
 
  protected:
-  bool throttleDeny(int num_messages); // returns true if overloaded
+  // returns true if overloaded
+  bool throttleDeny(unsigned long num_messages, unsigned long long num_bytes);
+  bool throttleCategories(const store_batch_map_t& batches,
+                          std::vector<const CategoryRoute*>* denied = NULL);
+  bool queueFull(store_priority_t priority, unsigned long long num_bytes);
+  bool shedForQueueSize(const store_batch_map_t& batches,
+                        std::vector<const CategoryRoute*>* shed = NULL);
+  bool shedForQueueDelay(const store_batch_map_t& batches,
+                         unsigned long* retry_after_ms,
+                         std::vector<const CategoryRoute*>* shed = NULL);
+  void refundCategories(const store_batch_map_t& batches);
+  void rejectBatches(std::vector<const CategoryRoute*>& routes,
+                     store_batch_map_t& batches,
+                     const batch_index_map_t& indexes,
+                     std::vector<bool>& accepted);
+  void dropBatches(const std::vector<const CategoryRoute*>& routes,
+                   store_batch_map_t& batches,
+                   unsigned long* dropped_messages,
+                   unsigned long long* dropped_bytes);
   void deleteCategoryMap(category_map_t& cats);
+  void compileCategoryPrefixes();
+  category_tables_ptr_t getCategoryTables();
+  tables_generation_ptr_t publishCategoryTables(bool retire = false);
+  tables_generation_ptr_t retireCategoryTables();
+  static void waitForGeneration(tables_generation_ptr_t& generation);
+  static const store_list_t* findModels(const CategoryTables& tables,
+                                        const std::string& category);
   const char* statusAsString(facebook::fb303::fb_status new_status);
   bool createCategoryFromModel(const std::string &category,
                                const boost::shared_ptr<StoreQueue> &model);
@@ -142,16 +339,39 @@ class scribeHandler : virtual public scribe::thrift::scribeIf,
     configureStoreCategory(pStoreConf store_conf,
                            const std::string &category,
                            const boost::shared_ptr<StoreQueue> &model,
+                           StoreGraph& graph,
+                           store_key_map_t& running_stores,
                            bool category_list=false);
-  bool configureStore(pStoreConf store_conf, int* num_stores);
+  bool configureStore(pStoreConf store_conf, int* num_stores,
+                      StoreGraph& graph, store_key_map_t& running_stores);
+  std::string storeConfigKey(pStoreConf store_conf);
+  void indexRunningStores(store_key_map_t& _return);
+  void carryOverCategories(StoreGraph& graph);
+  void swapStoreGraph(StoreGraph& graph);
+  void stopNewStores(const StoreGraph& graph);
   void startSources();
   void stopSources();
   void stopStores();
-  bool throttleRequest(const std::vector<scribe::thrift::LogEntry>&  messages);
+  bool throttleRequest(unsigned long num_messages,
+                       unsigned long long num_bytes);
+  bool throttlePeer(unsigned long num_messages, unsigned long long num_bytes,
+                    unsigned long* retry_after_ms);
+  void chargePeer(const logentry_slice_vector_t& entries,
+                  const std::vector<bool>* accepted,
+                  unsigned long dropped_messages,
+                  unsigned long long dropped_bytes);
+  void addPeerCounters(std::map<std::string, int64_t>& _return);
   boost::shared_ptr<store_list_t>
     createNewCategory(const std::string& category);
-  void addMessage(const scribe::thrift::LogEntry& entry,
-                  const boost::shared_ptr<store_list_t>& store_list);
+  void addMessage(const logentry_ptr_t& entry, const CategoryRoute& route);
+  void addMessages(const logentry_vector_t& entries,
+                   const CategoryRoute& route,
+                   journal_wait_list_t* journal_waits = NULL);
+  bool parkMessage(const LogEntrySlice& entry,
+                   category_tables_ptr_t& found_tables,
+                   const CategoryRoute*& found_route);
+  void materializeCategories(const std::vector<std::string>& new_categories);
+  void reclaimIdleCategories();
 };
 
 extern boost::shared_ptr<scribeHandler> g_Handler;
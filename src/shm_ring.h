@@ -0,0 +1,395 @@
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+
+#ifndef SCRIBE_SHM_RING_H
+#define SCRIBE_SHM_RING_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+/*
+ * Single-producer/single-consumer rings in POSIX shared memory, for
+ * producers on the same host as scribe that want to skip sockets
+ * altogether.
+ *
+ * scribe's shm source creates the rings /scribe.<name>.0, .1, ... and drains
+ * them. A producer claims a free ring with ShmRingWriter and appends
+ * records to it: a RecordHeader followed by the category and the message,
+ * padded to 8 bytes. A record never wraps around the end of the ring. If
+ * it doesn't fit, a padding record fills the rest of the ring first. head
+ * and tail count the bytes ever written and consumed, so the ring is full
+ * when head - tail would go over capacity. scribe stops consuming while
+ * it can't accept messages, so a full ring is the producer's backpressure.
+ *
+ * Only libc and librt are needed, so producers can use this header as is.
+ */
+
+namespace scribe {
+namespace shm {
+
+const uint32_t RING_MAGIC = 0x73637262;       // "scrb"
+const uint32_t RING_VERSION = 1;
+const uint32_t PADDING_RECORD = 0xffffffff;   // categorySize of padding
+const mode_t DEFAULT_RING_MODE = 0660;        // producers in scribe's group
+
+struct RingHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t capacity;        // bytes of records, a power of 2
+  volatile int32_t owner;   // pid of the producer, 0 if the ring is free
+  char padding0[64 - 20];
+  volatile uint64_t head;   // only written by the producer
+  char padding1[64 - 8];
+  volatile uint64_t tail;   // only written by scribe
+  char padding2[64 - 8];
+};
+
+struct RecordHeader {
+  uint32_t categorySize;
+  uint32_t messageSize;
+};
+
+inline uint64_t recordSize(uint64_t category_size, uint64_t message_size) {
+  return (sizeof(RecordHeader) + category_size + message_size + 7) &
+    ~(uint64_t)7;
+}
+
+inline std::string ringName(const std::string& name, unsigned index) {
+  char suffix[16];
+  snprintf(suffix, sizeof(suffix), ".%u", index);
+  return "/scribe." + name + suffix;
+}
+
+// A mapped ring
+class Ring {
+ public:
+  RingHeader* header;
+  char* data;
+
+  Ring() : header(NULL), data(NULL), mappedSize(0) {}
+  ~Ring() { unmap(); }
+
+  // Creates the ring, or keeps the records in it if it already exists with
+  // the same capacity. capacity is rounded up to a power of 2. Anyone the
+  // mode lets write to the ring can log to any category.
+  bool create(const std::string& shm_name, uint64_t capacity, mode_t mode) {
+    uint64_t ring_capacity = 4096;
+    while (ring_capacity < capacity) {
+      ring_capacity <<= 1;
+    }
+    size_t size = sizeof(RingHeader) + ring_capacity;
+
+    int fd = shm_open(shm_name.c_str(), O_RDWR | O_CREAT, mode);
+    if (fd < 0) {
+      return false;
+    }
+    // not limited by our umask, and changed on a ring that already exists
+    if (fchmod(fd, mode) != 0) {
+      ::close(fd);
+      return false;
+    }
+
+    struct stat st;
+    bool resize = fstat(fd, &st) != 0 || (size_t) st.st_size != size;
+    if ((resize && ftruncate(fd, size) != 0) || !map(fd, size)) {
+      ::close(fd);
+      return false;
+    }
+    ::close(fd);
+
+    if (resize || header->magic != RING_MAGIC ||
+        header->version != RING_VERSION ||
+        header->capacity != ring_capacity) {
+      header->magic = 0;
+      __sync_synchronize();
+      header->version = RING_VERSION;
+      header->capacity = ring_capacity;
+      header->owner = 0;
+      header->head = 0;
+      header->tail = 0;
+      __sync_synchronize();
+      header->magic = RING_MAGIC;
+    }
+    return true;
+  }
+
+  // Maps a ring created by scribe
+  bool attach(const std::string& shm_name) {
+    int fd = shm_open(shm_name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+      return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size <= sizeof(RingHeader) ||
+        !map(fd, st.st_size)) {
+      ::close(fd);
+      return false;
+    }
+    ::close(fd);
+
+    if (header->magic != RING_MAGIC || header->version != RING_VERSION ||
+        header->capacity != mappedSize - sizeof(RingHeader)) {
+      unmap();
+      return false;
+    }
+    return true;
+  }
+
+  void unmap() {
+    if (header) {
+      munmap(header, mappedSize);
+      header = NULL;
+      data = NULL;
+      mappedSize = 0;
+    }
+  }
+
+  uint64_t capacity() const {
+    return header->capacity;
+  }
+
+ private:
+  size_t mappedSize;
+
+  bool map(int fd, size_t size) {
+    void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+      return false;
+    }
+    header = (RingHeader*) mem;
+    data = (char*) mem + sizeof(RingHeader);
+    mappedSize = size;
+    return true;
+  }
+
+  // disallow copy and assignment
+  Ring(const Ring& rhs);
+  Ring& operator=(const Ring& rhs);
+};
+
+/*
+ * The producer side. Not thread safe: a producer with several threads
+ * needs a writer, and a ring, per thread.
+ */
+class ShmRingWriter {
+ public:
+  ShmRingWriter() : head(0) {}
+  ~ShmRingWriter() { close(); }
+
+  // Claims a ring that is free, or whose producer has exited, among the
+  // rings scribe created for name. Returns false if there is none.
+  bool open(const std::string& name) {
+    close();
+    pid_t pid = getpid();
+    for (unsigned i = 0; ring.attach(ringName(name, i)); ++i) {
+      int32_t owner = ring.header->owner;
+      bool free = owner == 0 ||
+        (owner != pid && kill(owner, 0) == -1 && errno == ESRCH);
+      if (free &&
+          __sync_bool_compare_and_swap(&ring.header->owner, owner, pid)) {
+        head = ring.header->head;
+        return true;
+      }
+      ring.unmap();
+    }
+    return false;
+  }
+
+  void close() {
+    if (ring.header) {
+      ring.header->owner = 0;
+      ring.unmap();
+    }
+  }
+
+  bool isOpen() const {
+    return ring.header != NULL;
+  }
+
+  // Appends a message. Returns false if there is no room for it, in which
+  // case the producer should back off or drop it. Messages longer than
+  // half the ring never fit.
+  bool write(const char* category, uint32_t category_size,
+             const char* message, uint32_t message_size) {
+    uint64_t capacity = ring.capacity();
+    uint64_t size = recordSize(category_size, message_size);
+    if (size > capacity / 2) {
+      return false;
+    }
+
+    uint64_t offset = head & (capacity - 1);
+    uint64_t contiguous = capacity - offset;
+    uint64_t needed = size <= contiguous ? size : size + contiguous;
+    uint64_t tail = ring.header->tail;
+    __sync_synchronize();
+    if (head + needed - tail > capacity) {
+      return false;
+    }
+
+    if (size > contiguous) {
+      RecordHeader* padding = (RecordHeader*) (ring.data + offset);
+      padding->categorySize = PADDING_RECORD;
+      padding->messageSize = 0;
+      head += contiguous;
+      offset = 0;
+    }
+
+    RecordHeader* record = (RecordHeader*) (ring.data + offset);
+    record->categorySize = category_size;
+    record->messageSize = message_size;
+    memcpy(record + 1, category, category_size);
+    memcpy((char*) (record + 1) + category_size, message, message_size);
+    head += size;
+
+    // publish the record only once it is complete
+    __sync_synchronize();
+    ring.header->head = head;
+    return true;
+  }
+
+  bool write(const std::string& category, const std::string& message) {
+    return write(category.data(), category.size(),
+                 message.data(), message.size());
+  }
+
+  // How full the ring is, from 0 to 1. Producers can use it to slow down
+  // before writes start failing.
+  double fullness() const {
+    return (double) (head - ring.header->tail) / ring.capacity();
+  }
+
+ private:
+  Ring ring;
+  uint64_t head;  // our copy of ring.header->head
+
+  // disallow copy and assignment
+  ShmRingWriter(const ShmRingWriter& rhs);
+  ShmRingWriter& operator=(const ShmRingWriter& rhs);
+};
+
+// A record in a ring, valid until it is consumed
+struct ShmRecord {
+  const char* category;
+  uint32_t categorySize;
+  const char* message;
+  uint32_t messageSize;
+};
+
+// The scribe side
+class ShmRingReader {
+ public:
+  ShmRingReader() : readEnd(0), corruptBytes(0) {}
+
+  bool create(const std::string& shm_name, uint64_t capacity,
+              mode_t mode = DEFAULT_RING_MODE) {
+    if (!ring.create(shm_name, capacity, mode)) {
+      return false;
+    }
+    readEnd = ring.header->tail;
+    return true;
+  }
+
+  // Appends up to max_records of the records that haven't been consumed
+  // to records. Reading again without consume() returns the same records.
+  // Padding counts towards max_records, so that however the producer fills
+  // the ring, one read() does a bounded amount of work.
+  size_t read(std::vector<ShmRecord>& records, size_t max_records) {
+    uint64_t capacity = ring.capacity();
+    uint64_t head = ring.header->head;
+    __sync_synchronize();
+
+    uint64_t pos = ring.header->tail;
+    if (head - pos > capacity) {
+      // Can only be a misbehaving producer: there isn't that much in the
+      // ring. Skip everything it claims to have written.
+      corruptBytes += capacity;
+      ring.header->tail = head;
+      readEnd = head;
+      return 0;
+    }
+
+    size_t count = 0;
+    size_t steps = 0;
+    while (pos < head && steps < max_records) {
+      uint64_t offset = pos & (capacity - 1);
+      const RecordHeader* record = (const RecordHeader*) (ring.data + offset);
+      ++steps;
+      if (record->categorySize == PADDING_RECORD) {
+        pos += capacity - offset;
+        continue;
+      }
+
+      uint64_t size = recordSize(record->categorySize, record->messageSize);
+      if (size > capacity - offset || pos + size > head) {
+        // Can only be a misbehaving producer. Once the records before this
+        // one are consumed, skip everything it wrote.
+        if (count == 0) {
+          corruptBytes += head - pos;
+          pos = head;
+          ring.header->tail = pos;
+        }
+        break;
+      }
+
+      ShmRecord entry;
+      entry.category = (const char*) (record + 1);
+      entry.categorySize = record->categorySize;
+      entry.message = entry.category + record->categorySize;
+      entry.messageSize = record->messageSize;
+      records.push_back(entry);
+      pos += size;
+      ++count;
+    }
+
+    readEnd = pos;
+    return count;
+  }
+
+  // Frees the records returned by the last read()
+  void consume() {
+    __sync_synchronize();
+    ring.header->tail = readEnd;
+  }
+
+  // Bytes skipped because they didn't hold valid records
+  uint64_t getCorruptBytes() const {
+    return corruptBytes;
+  }
+
+ private:
+  Ring ring;
+  uint64_t readEnd;
+  uint64_t corruptBytes;
+
+  // disallow copy and assignment
+  ShmRingReader(const ShmRingReader& rhs);
+  ShmRingReader& operator=(const ShmRingReader& rhs);
+};
+
+} // !namespace scribe::shm
+} // !namespace scribe
+
+#endif // !defined SCRIBE_SHM_RING_H
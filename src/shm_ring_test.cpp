@@ -0,0 +1,164 @@
+#include "shm_ring.h"
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+
+#include <sstream>
+
+using namespace std;
+using namespace scribe::shm;
+
+class ShmRingTest : public CppUnit::TestCase {
+public:
+    CPPUNIT_TEST_SUITE(ShmRingTest);
+    CPPUNIT_TEST(testWriteRead);
+    CPPUNIT_TEST(testFullAndWrap);
+    CPPUNIT_TEST(testClaim);
+    CPPUNIT_TEST(testMode);
+    CPPUNIT_TEST(testBogusHead);
+    CPPUNIT_TEST_SUITE_END();
+
+    string name;
+
+    void setUp() {
+        ostringstream oss;
+        oss << "shm_ring_test_" << getpid();
+        name = oss.str();
+    }
+
+    void tearDown() {
+        for (unsigned i = 0; i < 2; ++i) {
+            shm_unlink(ringName(name, i).c_str());
+        }
+    }
+
+    void testWriteRead() {
+        ShmRingReader reader;
+        CPPUNIT_ASSERT(reader.create(ringName(name, 0), 4096));
+
+        ShmRingWriter writer;
+        CPPUNIT_ASSERT(writer.open(name));
+        CPPUNIT_ASSERT(writer.write("cat", "hello\n"));
+        CPPUNIT_ASSERT(writer.write("", "no category\n"));
+
+        vector<ShmRecord> records;
+        CPPUNIT_ASSERT_EQUAL((size_t) 2, reader.read(records, 100));
+        CPPUNIT_ASSERT_EQUAL(string("cat"),
+                             string(records[0].category, records[0].categorySize));
+        CPPUNIT_ASSERT_EQUAL(string("hello\n"),
+                             string(records[0].message, records[0].messageSize));
+        CPPUNIT_ASSERT_EQUAL((uint32_t) 0, records[1].categorySize);
+
+        // not consumed yet, so read again
+        records.clear();
+        CPPUNIT_ASSERT_EQUAL((size_t) 2, reader.read(records, 100));
+        reader.consume();
+        records.clear();
+        CPPUNIT_ASSERT_EQUAL((size_t) 0, reader.read(records, 100));
+        CPPUNIT_ASSERT_EQUAL(0.0, writer.fullness());
+    }
+
+    void testFullAndWrap() {
+        ShmRingReader reader;
+        CPPUNIT_ASSERT(reader.create(ringName(name, 0), 4096));
+        ShmRingWriter writer;
+        CPPUNIT_ASSERT(writer.open(name));
+
+        // 8 + 3 + 1000 bytes, padded to 1016
+        string message(1000, 'x');
+        int written = 0;
+        while (writer.write("cat", message)) {
+            ++written;
+        }
+        CPPUNIT_ASSERT_EQUAL(4, written);
+        CPPUNIT_ASSERT(writer.fullness() > 0.9);
+        CPPUNIT_ASSERT(!writer.write("cat", string(3000, 'x')));
+
+        vector<ShmRecord> records;
+        CPPUNIT_ASSERT_EQUAL((size_t) 2, reader.read(records, 2));
+        reader.consume();
+
+        // the next records wrap around the end of the ring
+        for (int i = 0; i < 2; ++i) {
+            ostringstream oss;
+            oss << i << message;
+            CPPUNIT_ASSERT(writer.write("cat", oss.str().substr(0, 1000)));
+        }
+        CPPUNIT_ASSERT(!writer.write("cat", message));
+
+        records.clear();
+        CPPUNIT_ASSERT_EQUAL((size_t) 4, reader.read(records, 100));
+        CPPUNIT_ASSERT_EQUAL('0', records[2].message[0]);
+        CPPUNIT_ASSERT_EQUAL('1', records[3].message[0]);
+        reader.consume();
+        CPPUNIT_ASSERT_EQUAL(0.0, writer.fullness());
+        CPPUNIT_ASSERT_EQUAL((uint64_t) 0, reader.getCorruptBytes());
+    }
+
+    void testClaim() {
+        ShmRingReader reader0, reader1;
+        CPPUNIT_ASSERT(reader0.create(ringName(name, 0), 4096));
+        CPPUNIT_ASSERT(reader1.create(ringName(name, 1), 4096));
+
+        ShmRingWriter writer0, writer1, writer2;
+        CPPUNIT_ASSERT(writer0.open(name));
+        CPPUNIT_ASSERT(writer1.open(name));
+        CPPUNIT_ASSERT(!writer2.open(name));
+
+        // each writer has a ring of its own
+        CPPUNIT_ASSERT(writer1.write("one", "1"));
+        vector<ShmRecord> records;
+        CPPUNIT_ASSERT_EQUAL((size_t) 0, reader0.read(records, 100));
+        CPPUNIT_ASSERT_EQUAL((size_t) 1, reader1.read(records, 100));
+
+        writer0.close();
+        CPPUNIT_ASSERT(writer2.open(name));
+    }
+
+    void testMode() {
+        ShmRingReader reader;
+        CPPUNIT_ASSERT(reader.create(ringName(name, 0), 4096));
+        struct stat st;
+        CPPUNIT_ASSERT_EQUAL(0, stat(("/dev/shm" + ringName(name, 0)).c_str(),
+                                     &st));
+        CPPUNIT_ASSERT_EQUAL((mode_t) 0660, st.st_mode & 0777);
+
+        // changed on a ring that is already there
+        ShmRingReader again;
+        CPPUNIT_ASSERT(again.create(ringName(name, 0), 4096, 0600));
+        CPPUNIT_ASSERT_EQUAL(0, stat(("/dev/shm" + ringName(name, 0)).c_str(),
+                                     &st));
+        CPPUNIT_ASSERT_EQUAL((mode_t) 0600, st.st_mode & 0777);
+    }
+
+    void testBogusHead() {
+        ShmRingReader reader;
+        CPPUNIT_ASSERT(reader.create(ringName(name, 0), 4096));
+        ShmRingWriter writer;
+        CPPUNIT_ASSERT(writer.open(name));
+        CPPUNIT_ASSERT(writer.write("cat", "hello\n"));
+
+        // a producer claiming to have written more than fits in the ring
+        Ring ring;
+        CPPUNIT_ASSERT(ring.attach(ringName(name, 0)));
+        ring.header->head += 1000000 * ring.capacity();
+
+        vector<ShmRecord> records;
+        CPPUNIT_ASSERT_EQUAL((size_t) 0, reader.read(records, 100));
+        CPPUNIT_ASSERT(reader.getCorruptBytes() > 0);
+        CPPUNIT_ASSERT_EQUAL(ring.header->head, ring.header->tail);
+    }
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ShmRingTest);
+
+int main(int argc, char **argv)
+{
+  CppUnit::TextUi::TestRunner runner;
+  CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+  runner.addTest( registry.makeTest() );
+  runner.run();
+  return 0;
+}
@@ -18,6 +18,13 @@
 
 #include "source.h"
 #include "scribe_server.h"
+#include "syslog_parser.h"
+#include "shm_ring.h"
+
+#include <netdb.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
 
 using boost::shared_ptr;
 using boost::property_tree::ptree;
@@ -26,6 +33,21 @@ using namespace std;
 
 extern shared_ptr<scribeHandler> g_Handler;
 
+#define DEFAULT_SYSLOG_BATCH_SIZE   64
+#define DEFAULT_SYSLOG_MESSAGE_SIZE 8192
+#define SYSLOG_POLL_TIMEOUT_MS      1000
+
+#define DEFAULT_SHM_RINGS           16
+#define DEFAULT_SHM_RING_SIZE       (4 * 1024 * 1024)
+#define DEFAULT_SHM_BATCH_SIZE      1024
+#define SHM_IDLE_SLEEP_US           500
+
+#define DEFAULT_LINE_BUFFER_SIZE    (256 * 1024)
+#define DEFAULT_MAX_LINE_SIZE       (1024 * 1024)
+#define DEFAULT_LINE_CONNECTIONS    1024
+#define LINE_POLL_TIMEOUT_MS        1000
+#define LINE_RETRY_MS               100
+
 void* sourceStarter(void *this_ptr) {
   Source *source_ptr = (Source*)this_ptr;
   source_ptr->run();
@@ -37,6 +59,15 @@ bool Source::createSource(ptree& conf, shared_ptr<Source>& newSource) {
   if (0 == type.compare("tail")) {
     newSource = shared_ptr<Source>(new TailSource(conf));
     return true;
+  } else if (0 == type.compare("syslog")) {
+    newSource = shared_ptr<Source>(new SyslogSource(conf));
+    return true;
+  } else if (0 == type.compare("shm")) {
+    newSource = shared_ptr<Source>(new ShmSource(conf));
+    return true;
+  } else if (0 == type.compare("lines")) {
+    newSource = shared_ptr<Source>(new LineSource(conf));
+    return true;
   } else {
     LOG_OPER("Unable to create source for unknown type <%s>", type.c_str());
     return false;
@@ -163,3 +194,653 @@ void TailSource::run() {
     categoryHandled.c_str(), filename.c_str());
   in.pop();
 }
+
+
+SyslogSource::SyslogSource(ptree& configuration)
+  : Source(configuration),
+    port(0),
+    batchSize(DEFAULT_SYSLOG_BATCH_SIZE),
+    maxMessageSize(DEFAULT_SYSLOG_MESSAGE_SIZE),
+    receiveBuffer(0),
+    fd(-1),
+    receivedCounter("syslog received"),
+    droppedCounter("syslog dropped"),
+    truncatedCounter("syslog truncated"),
+    overflowCounter("syslog dropped by kernel") {}
+
+SyslogSource::~SyslogSource() {}
+
+void SyslogSource::configure() {
+  Source::configure();
+  port = configuration.get<unsigned long>("port", 0);
+  bindAddress = configuration.get<string>("bind", "");
+  batchSize = configuration.get<unsigned long>("batch_size",
+                                               DEFAULT_SYSLOG_BATCH_SIZE);
+  maxMessageSize = configuration.get<unsigned long>(
+    "max_message_size", DEFAULT_SYSLOG_MESSAGE_SIZE);
+  receiveBuffer = configuration.get<unsigned long>("receive_buffer", 0);
+
+  if (port == 0) {
+    LOG_OPER("[%s] Invalid SyslogSource configuration! No <port> specified.",
+      categoryHandled.c_str());
+    validConfiguration = false;
+  }
+  if (batchSize == 0 || maxMessageSize == 0) {
+    LOG_OPER("[%s] Invalid SyslogSource configuration! <batch_size> and "
+      "<max_message_size> must be positive.", categoryHandled.c_str());
+    validConfiguration = false;
+  }
+}
+
+void SyslogSource::start() {
+  active = true;
+  pthread_create(&sourceThread, NULL, sourceStarter, (void*) this);
+}
+
+void SyslogSource::stop() {
+  // run() notices within SYSLOG_POLL_TIMEOUT_MS
+  active = false;
+  pthread_join(sourceThread, NULL);
+}
+
+// Creates a socket of socket_type bound to bind_address (any address if
+// empty) and port. Returns -1 after logging the error on failure.
+static int bindSocket(const string& category, const string& bind_address,
+                      unsigned long port, int socket_type) {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = socket_type;
+  hints.ai_flags = AI_PASSIVE;
+
+  char port_str[16];
+  snprintf(port_str, sizeof(port_str), "%lu", port);
+
+  struct addrinfo* res;
+  int rc = getaddrinfo(bind_address.empty() ? NULL : bind_address.c_str(),
+                       port_str, &hints, &res);
+  if (rc != 0) {
+    LOG_OPER("[%s] Can't resolve source address <%s:%lu>: %s",
+      category.c_str(), bind_address.c_str(), port, gai_strerror(rc));
+    return -1;
+  }
+
+  int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if (fd < 0) {
+    LOG_OPER("[%s] Can't create source socket: %s",
+      category.c_str(), strerror(errno));
+    freeaddrinfo(res);
+    return -1;
+  }
+
+  int one = 1;
+  if (socket_type == SOCK_STREAM) {
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  }
+
+  if (bind(fd, res->ai_addr, res->ai_addrlen) != 0) {
+    LOG_OPER("[%s] Can't bind source socket to port <%lu>: %s",
+      category.c_str(), port, strerror(errno));
+    ::close(fd);
+    freeaddrinfo(res);
+    return -1;
+  }
+
+  freeaddrinfo(res);
+  return fd;
+}
+
+bool SyslogSource::openSocket() {
+  fd = bindSocket(categoryHandled, bindAddress, port, SOCK_DGRAM);
+  if (fd < 0) {
+    return false;
+  }
+
+  if (receiveBuffer > 0) {
+    int size = (int) receiveBuffer;
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) != 0) {
+      LOG_OPER("[%s] Can't set syslog receive buffer to <%lu>: %s",
+        categoryHandled.c_str(), receiveBuffer, strerror(errno));
+    }
+  }
+#ifdef SO_RXQ_OVFL
+  // have the kernel report datagrams dropped because the buffer was full
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one));
+#endif
+
+  return true;
+}
+
+void SyslogSource::run() {
+
+  configure();
+  if (!validConfiguration || !openSocket()) {
+    return;
+  }
+
+  LOG_OPER("[%s] Starting syslog source on port <%lu>",
+    categoryHandled.c_str(), port);
+
+  SyslogCategoryMapper mapper(categoryHandled);
+
+  // One slot per datagram, with room for the newline appended to it
+  size_t slot_size = maxMessageSize + 1;
+  vector<char> buffer(batchSize * slot_size);
+#ifdef SO_RXQ_OVFL
+  size_t control_size = CMSG_SPACE(sizeof(uint32_t));
+#else
+  size_t control_size = 0;
+#endif
+  vector<char> control(batchSize * control_size + 1);
+  vector<struct iovec> iovecs(batchSize);
+  vector<struct mmsghdr> datagrams(batchSize);
+  for (unsigned long i = 0; i < batchSize; ++i) {
+    iovecs[i].iov_base = &buffer[i * slot_size];
+    iovecs[i].iov_len = maxMessageSize;
+    memset(&datagrams[i], 0, sizeof(datagrams[i]));
+    datagrams[i].msg_hdr.msg_iov = &iovecs[i];
+    datagrams[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  vector<string> categories(batchSize);
+  logentry_slice_vector_t entries;
+  entries.reserve(batchSize);
+  uint32_t kernel_drops = 0;
+
+  while (active) {
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, SYSLOG_POLL_TIMEOUT_MS) <= 0) {
+      continue;
+    }
+
+    // the kernel overwrites these on every call
+    for (unsigned long i = 0; i < batchSize; ++i) {
+      datagrams[i].msg_hdr.msg_control =
+        control_size ? &control[i * control_size] : NULL;
+      datagrams[i].msg_hdr.msg_controllen = control_size;
+      datagrams[i].msg_hdr.msg_flags = 0;
+    }
+
+    int count = recvmmsg(fd, &datagrams[0], batchSize, MSG_DONTWAIT, NULL);
+    if (count <= 0) {
+      if (count < 0 && errno != EAGAIN && errno != EINTR) {
+        LOG_OPER("[%s] Failed to receive syslog messages: %s",
+          categoryHandled.c_str(), strerror(errno));
+      }
+      continue;
+    }
+
+    entries.clear();
+    for (int i = 0; i < count; ++i) {
+      struct msghdr& hdr = datagrams[i].msg_hdr;
+      if (hdr.msg_flags & MSG_TRUNC) {
+        truncatedCounter.inc();
+      }
+#ifdef SO_RXQ_OVFL
+      for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+           cmsg != NULL;
+           cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SO_RXQ_OVFL) {
+          // total since the socket was opened
+          uint32_t drops;
+          memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+          overflowCounter.inc(drops - kernel_drops);
+          kernel_drops = drops;
+        }
+      }
+#endif
+
+      // Messages may or may not end with a newline, but scribe messages do
+      char* data = &buffer[i * slot_size];
+      uint32_t len = datagrams[i].msg_len;
+      while (len > 0 &&
+             (data[len - 1] == '\n' || data[len - 1] == '\r' ||
+              data[len - 1] == '\0')) {
+        --len;
+      }
+      data[len] = '\n';
+
+      SyslogMessage msg;
+      parseSyslog(data, len, msg);
+      mapper.map(msg, categories[i]);
+      entries.push_back(LogEntrySlice(StringSlice(categories[i]),
+                                      StringSlice(msg.message.data,
+                                                  msg.message.size + 1)));
+    }
+
+    receivedCounter.inc(count);
+    if (g_Handler->logEntries(entries) != ResultCode::OK) {
+      droppedCounter.inc(count);
+    }
+  }
+
+  LOG_OPER("[%s] Closing syslog source on port <%lu>",
+    categoryHandled.c_str(), port);
+  ::close(fd);
+  fd = -1;
+}
+
+
+ShmSource::ShmSource(ptree& configuration)
+  : Source(configuration),
+    numRings(DEFAULT_SHM_RINGS),
+    ringSize(DEFAULT_SHM_RING_SIZE),
+    batchSize(DEFAULT_SHM_BATCH_SIZE),
+    mode(scribe::shm::DEFAULT_RING_MODE),
+    receivedCounter("shm received"),
+    deferredCounter("shm deferred"),
+    corruptCounter("shm corrupt bytes") {}
+
+ShmSource::~ShmSource() {}
+
+void ShmSource::configure() {
+  Source::configure();
+  name = configuration.get<string>("name", "scribe");
+  numRings = configuration.get<unsigned long>("rings", DEFAULT_SHM_RINGS);
+  ringSize = configuration.get<unsigned long>("ring_size",
+                                              DEFAULT_SHM_RING_SIZE);
+  batchSize = configuration.get<unsigned long>("batch_size",
+                                               DEFAULT_SHM_BATCH_SIZE);
+  // octal, as for chmod
+  string ring_mode = configuration.get<string>("mode", "");
+  mode = ring_mode.empty() ? scribe::shm::DEFAULT_RING_MODE :
+    (mode_t) (strtoul(ring_mode.c_str(), NULL, 8) & 0777);
+
+  if (name.empty() || name.find('/') != string::npos) {
+    LOG_OPER("[%s] Invalid ShmSource configuration! <name> must be "
+      "nonempty and can't contain '/'.", categoryHandled.c_str());
+    validConfiguration = false;
+  }
+  if (numRings == 0 || batchSize == 0) {
+    LOG_OPER("[%s] Invalid ShmSource configuration! <rings> and "
+      "<batch_size> must be positive.", categoryHandled.c_str());
+    validConfiguration = false;
+  }
+}
+
+void ShmSource::start() {
+  active = true;
+  pthread_create(&sourceThread, NULL, sourceStarter, (void*) this);
+}
+
+void ShmSource::stop() {
+  active = false;
+  pthread_join(sourceThread, NULL);
+}
+
+void ShmSource::run() {
+
+  configure();
+  if (!validConfiguration) {
+    return;
+  }
+
+  // Rings are left in place when we stop, so that producers keep their
+  // ring and nothing written to it is lost across restarts
+  vector<shared_ptr<scribe::shm::ShmRingReader> > rings;
+  for (unsigned long i = 0; i < numRings; ++i) {
+    string ring_name = scribe::shm::ringName(name, i);
+    shared_ptr<scribe::shm::ShmRingReader> ring(
+      new scribe::shm::ShmRingReader());
+    if (!ring->create(ring_name, ringSize, mode)) {
+      LOG_OPER("[%s] Failed to create shared memory ring <%s>: %s",
+        categoryHandled.c_str(), ring_name.c_str(), strerror(errno));
+      continue;
+    }
+    rings.push_back(ring);
+  }
+  if (rings.empty()) {
+    return;
+  }
+
+  LOG_OPER("[%s] Starting shm source with <%lu> rings named <%s>",
+    categoryHandled.c_str(), (unsigned long) rings.size(), name.c_str());
+
+  vector<scribe::shm::ShmRecord> records;
+  logentry_slice_vector_t entries;
+  records.reserve(batchSize);
+  entries.reserve(batchSize);
+  StringSlice default_category(categoryHandled);
+
+  while (active) {
+    bool busy = false;
+
+    for (vector<shared_ptr<scribe::shm::ShmRingReader> >::iterator
+           ring_iter = rings.begin();
+         ring_iter != rings.end();
+         ++ring_iter) {
+      scribe::shm::ShmRingReader& ring = **ring_iter;
+
+      uint64_t corrupt = ring.getCorruptBytes();
+      records.clear();
+      size_t count = ring.read(records, batchSize);
+      if (ring.getCorruptBytes() != corrupt) {
+        LOG_OPER("[%s] Skipped <%llu> corrupt bytes in shared memory ring",
+          categoryHandled.c_str(),
+          (unsigned long long) (ring.getCorruptBytes() - corrupt));
+        corruptCounter.inc(ring.getCorruptBytes() - corrupt);
+      }
+      if (count == 0) {
+        continue;
+      }
+
+      entries.clear();
+      for (vector<scribe::shm::ShmRecord>::iterator record_iter =
+             records.begin();
+           record_iter != records.end();
+           ++record_iter) {
+        StringSlice category(record_iter->category,
+                             record_iter->categorySize);
+        entries.push_back(LogEntrySlice(
+          category.empty() ? default_category : category,
+          StringSlice(record_iter->message, record_iter->messageSize)));
+      }
+
+      if (g_Handler->logEntries(entries) == ResultCode::OK) {
+        ring.consume();
+        receivedCounter.inc(count);
+        busy = true;
+      } else {
+        // try again after sleeping, the producer sees the ring fill up
+        deferredCounter.inc(count);
+      }
+    }
+
+    if (!busy) {
+      usleep(SHM_IDLE_SLEEP_US);
+    }
+  }
+
+  LOG_OPER("[%s] Stopping shm source <%s>",
+    categoryHandled.c_str(), name.c_str());
+}
+
+
+LineSource::LineSource(ptree& configuration)
+  : Source(configuration),
+    port(0),
+    bufferSize(DEFAULT_LINE_BUFFER_SIZE),
+    maxLineSize(DEFAULT_MAX_LINE_SIZE),
+    maxConnections(DEFAULT_LINE_CONNECTIONS),
+    listenFd(-1),
+    epollFd(-1),
+    receivedCounter("lines received"),
+    deferredCounter("lines deferred"),
+    droppedCounter("line connections dropped") {}
+
+LineSource::~LineSource() {}
+
+void LineSource::configure() {
+  Source::configure();
+  port = configuration.get<unsigned long>("port", 0);
+  bindAddress = configuration.get<string>("bind", "");
+  bufferSize = configuration.get<unsigned long>("buffer_size",
+                                                DEFAULT_LINE_BUFFER_SIZE);
+  maxLineSize = configuration.get<unsigned long>("max_line_size",
+                                                 DEFAULT_MAX_LINE_SIZE);
+  maxConnections = configuration.get<unsigned long>(
+    "max_connections", DEFAULT_LINE_CONNECTIONS);
+
+  if (port == 0) {
+    LOG_OPER("[%s] Invalid LineSource configuration! No <port> specified.",
+      categoryHandled.c_str());
+    validConfiguration = false;
+  }
+  if (bufferSize < 2 || maxLineSize == 0) {
+    LOG_OPER("[%s] Invalid LineSource configuration! <buffer_size> and "
+      "<max_line_size> are too small.", categoryHandled.c_str());
+    validConfiguration = false;
+  }
+}
+
+void LineSource::start() {
+  active = true;
+  pthread_create(&sourceThread, NULL, sourceStarter, (void*) this);
+}
+
+void LineSource::stop() {
+  // run() notices within LINE_POLL_TIMEOUT_MS
+  active = false;
+  pthread_join(sourceThread, NULL);
+}
+
+bool LineSource::openSocket() {
+  listenFd = bindSocket(categoryHandled, bindAddress, port, SOCK_STREAM);
+  if (listenFd < 0) {
+    return false;
+  }
+
+  if (fcntl(listenFd, F_SETFL, O_NONBLOCK) != 0 ||
+      listen(listenFd, SOMAXCONN) != 0) {
+    LOG_OPER("[%s] Can't listen on port <%lu>: %s",
+      categoryHandled.c_str(), port, strerror(errno));
+    ::close(listenFd);
+    listenFd = -1;
+    return false;
+  }
+
+  epollFd = epoll_create(DEFAULT_LINE_CONNECTIONS);
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = listenFd;
+  if (epollFd < 0 || epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event)) {
+    LOG_OPER("[%s] Can't set up epoll: %s",
+      categoryHandled.c_str(), strerror(errno));
+    if (epollFd >= 0) {
+      ::close(epollFd);
+      epollFd = -1;
+    }
+    ::close(listenFd);
+    listenFd = -1;
+    return false;
+  }
+
+  return true;
+}
+
+void LineSource::acceptConnections() {
+  while (true) {
+    int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        LOG_OPER("[%s] Failed to accept line connection: %s",
+          categoryHandled.c_str(), strerror(errno));
+      }
+      return;
+    }
+
+    if (connections.size() >= maxConnections) {
+      droppedCounter.inc();
+      ::close(fd);
+      continue;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+      ::close(fd);
+      continue;
+    }
+    connections[fd] = shared_ptr<Connection>(new Connection(fd, bufferSize));
+  }
+}
+
+void LineSource::closeConnection(int fd) {
+  epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+  ::close(fd);
+  connections.erase(fd);
+}
+
+// Logs the complete lines in conn's buffer. Returns false if scribe didn't
+// accept them, in which case they are kept to be retried.
+bool LineSource::logLines(Connection& conn) {
+  char* data = &conn.buffer[0];
+  size_t pos = 0;
+
+  if (!conn.haveCategory) {
+    char* newline = (char*) memchr(data, '\n', conn.used);
+    if (newline == NULL) {
+      return true;
+    }
+    size_t size = newline - data;
+    if (size > 0 && data[size - 1] == '\r') {
+      --size;
+    }
+    conn.category = size > 0 ? string(data, size) : categoryHandled;
+    conn.haveCategory = true;
+    pos = newline + 1 - data;
+  }
+  size_t first_line = pos;
+
+  // a last line without a newline still counts once the producer is done.
+  // readConnection() always leaves room for the newline.
+  if (conn.eof && conn.used > pos && data[conn.used - 1] != '\n') {
+    data[conn.used++] = '\n';
+  }
+
+  // memchr is vectorized in glibc, so this scans many bytes per cycle
+  StringSlice category(conn.category);
+  entries.clear();
+  while (pos < conn.used) {
+    char* newline = (char*) memchr(data + pos, '\n', conn.used - pos);
+    if (newline == NULL) {
+      break;
+    }
+    size_t end = newline + 1 - data;
+    if (end - pos > 1) {
+      entries.push_back(LogEntrySlice(category,
+                                      StringSlice(data + pos, end - pos)));
+    }
+    pos = end;
+  }
+
+  bool accepted = true;
+  if (!entries.empty()) {
+    if (g_Handler->logEntries(entries) == ResultCode::OK) {
+      receivedCounter.inc(entries.size());
+    } else {
+      deferredCounter.inc(entries.size());
+      accepted = false;
+      pos = first_line;
+    }
+  }
+
+  memmove(data, data + pos, conn.used - pos);
+  conn.used -= pos;
+  return accepted;
+}
+
+// Reads what is available from conn and logs it. Returns false if conn
+// should be closed.
+bool LineSource::readConnection(Connection& conn) {
+  // A full buffer here holds part of a single line
+  if (conn.used + 1 >= conn.buffer.size()) {
+    if (conn.buffer.size() > maxLineSize) {
+      LOG_OPER("[%s] Closing line connection with a line longer than <%lu>",
+        categoryHandled.c_str(), maxLineSize);
+      droppedCounter.inc();
+      return false;
+    }
+    conn.buffer.resize(min((unsigned long) conn.buffer.size() * 2,
+                           maxLineSize + 2));
+  }
+
+  ssize_t bytes = recv(conn.fd, &conn.buffer[conn.used],
+                       conn.buffer.size() - conn.used - 1, 0);
+  if (bytes < 0) {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+  }
+  if (bytes == 0) {
+    conn.eof = true;
+  }
+  conn.used += bytes;
+
+  if (!logLines(conn)) {
+    // stop reading until the lines are accepted
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, conn.fd, NULL);
+    conn.retryAtMs = scribe::clock::nowInMsec() + LINE_RETRY_MS;
+    return true;
+  }
+  return !conn.eof;
+}
+
+void LineSource::run() {
+
+  configure();
+  if (!validConfiguration || !openSocket()) {
+    return;
+  }
+
+  LOG_OPER("[%s] Starting line source on port <%lu>",
+    categoryHandled.c_str(), port);
+
+  struct epoll_event events[64];
+  vector<int> finished;
+
+  while (active) {
+    // retry connections whose lines weren't accepted
+    int timeout = LINE_POLL_TIMEOUT_MS;
+    unsigned long now = scribe::clock::nowInMsec();
+    finished.clear();
+    for (connection_map_t::iterator conn_iter = connections.begin();
+         conn_iter != connections.end();
+         ++conn_iter) {
+      Connection& conn = *conn_iter->second;
+      if (conn.retryAtMs == 0) {
+        continue;
+      }
+      if (conn.retryAtMs > now) {
+        timeout = min(timeout, (int) (conn.retryAtMs - now));
+      } else if (!logLines(conn)) {
+        conn.retryAtMs = now + LINE_RETRY_MS;
+        timeout = min(timeout, LINE_RETRY_MS);
+      } else if (conn.eof) {
+        finished.push_back(conn.fd);
+      } else {
+        conn.retryAtMs = 0;
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = conn.fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, conn.fd, &event);
+      }
+    }
+    for (vector<int>::iterator fd_iter = finished.begin();
+         fd_iter != finished.end();
+         ++fd_iter) {
+      closeConnection(*fd_iter);
+    }
+
+    int count = epoll_wait(epollFd, events, 64, timeout);
+    for (int i = 0; i < count; ++i) {
+      int fd = events[i].data.fd;
+      if (fd == listenFd) {
+        acceptConnections();
+        continue;
+      }
+      connection_map_t::iterator conn_iter = connections.find(fd);
+      if (conn_iter != connections.end() &&
+          !readConnection(*conn_iter->second)) {
+        closeConnection(fd);
+      }
+    }
+  }
+
+  LOG_OPER("[%s] Closing line source on port <%lu>",
+    categoryHandled.c_str(), port);
+  while (!connections.empty()) {
+    closeConnection(connections.begin()->first);
+  }
+  ::close(epollFd);
+  ::close(listenFd);
+  epollFd = -1;
+  listenFd = -1;
+}
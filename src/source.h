@@ -21,6 +21,8 @@
 
 #include "common.h"
 #include "conf.h"
+#include "counter_handle.h"
+#include "log_batch.h"
 
 #include <boost/iostreams/device/file.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
@@ -62,4 +64,117 @@ class TailSource : public Source {
   boost::iostreams::filtering_istream in;
 };
 
+
+/*
+ * Receives syslog messages over UDP, several datagrams per recvmmsg() call,
+ * and logs each batch with a single logEntries() call. The category is a
+ * template for SyslogCategoryMapper, e.g. "syslog_{facility}". Datagrams
+ * can't be retried, so messages that aren't accepted are counted as dropped.
+ */
+class SyslogSource : public Source {
+ public:
+  SyslogSource(boost::property_tree::ptree& configuration);
+  ~SyslogSource();
+  void configure();
+  void start();
+  void stop();
+  void run();
+ private:
+  bool openSocket();
+
+  unsigned long port;
+  std::string bindAddress;
+  unsigned long batchSize;       // datagrams per recvmmsg()
+  unsigned long maxMessageSize;  // longer datagrams are truncated
+  unsigned long receiveBuffer;   // SO_RCVBUF, 0 for the system default
+  int fd;
+
+  CounterHandle receivedCounter;
+  CounterHandle droppedCounter;
+  CounterHandle truncatedCounter;
+  CounterHandle overflowCounter;  // dropped by the kernel, full socket buffer
+};
+
+
+/*
+ * Drains the shared memory rings that same-host producers write to with
+ * ShmRingWriter, see shm_ring.h. Records are logged like a Log() call.
+ * While scribe returns TRY_LATER they are left in the ring, so the
+ * producer sees the backpressure as the ring filling up. The category is
+ * used for records that don't have one.
+ */
+class ShmSource : public Source {
+ public:
+  ShmSource(boost::property_tree::ptree& configuration);
+  ~ShmSource();
+  void configure();
+  void start();
+  void stop();
+  void run();
+ private:
+  std::string name;            // rings are /scribe.<name>.<index>
+  unsigned long numRings;
+  unsigned long ringSize;
+  unsigned long batchSize;     // records per ring per logEntries() call
+  mode_t mode;                 // permissions of the rings
+
+  CounterHandle receivedCounter;
+  CounterHandle deferredCounter;
+  CounterHandle corruptCounter;
+};
+
+
+/*
+ * Plain TCP listener for producers that just append lines. A connection
+ * starts with a line naming its category, or an empty line for the
+ * source's category, followed by newline-terminated messages. Everything
+ * read from a connection at once is logged with one logEntries() call.
+ * While scribe returns TRY_LATER the connection isn't read, which pushes
+ * back on the producer through TCP flow control.
+ */
+class LineSource : public Source {
+ public:
+  LineSource(boost::property_tree::ptree& configuration);
+  ~LineSource();
+  void configure();
+  void start();
+  void stop();
+  void run();
+ private:
+  struct Connection {
+    int fd;
+    bool haveCategory;
+    std::string category;
+    std::vector<char> buffer;
+    size_t used;
+    bool eof;
+    unsigned long retryAtMs;  // nonzero while waiting to retry a batch
+
+    Connection(int conn_fd, size_t buffer_size)
+      : fd(conn_fd), haveCategory(false), buffer(buffer_size), used(0),
+        eof(false), retryAtMs(0) {}
+  };
+  typedef std::map<int, boost::shared_ptr<Connection> > connection_map_t;
+
+  bool openSocket();
+  void acceptConnections();
+  bool readConnection(Connection& conn);
+  bool logLines(Connection& conn);
+  void closeConnection(int fd);
+
+  unsigned long port;
+  std::string bindAddress;
+  unsigned long bufferSize;    // bytes read from a connection at once
+  unsigned long maxLineSize;
+  unsigned long maxConnections;
+  int listenFd;
+  int epollFd;
+  connection_map_t connections;
+  logentry_slice_vector_t entries;
+
+  CounterHandle receivedCounter;
+  CounterHandle deferredCounter;
+  CounterHandle droppedCounter;
+};
+
 #endif /* SCRIBE_SOURCE_H_ */
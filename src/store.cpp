@@ -918,7 +918,7 @@ bool FileStore::writeMessages(boost::shared_ptr<logentry_vector_t> messages,
 
       if (writeCategory) {
         //add space for category+newline and category frame
-        unsigned long category_length = (*iter)->category.length() + 1;
+        unsigned long category_length = (*iter)->category().length() + 1;
         length += category_length;
 
         category_frame = write_file->getFrame(category_length);
@@ -941,7 +941,7 @@ bool FileStore::writeMessages(boost::shared_ptr<logentry_vector_t> messages,
 
       if (writeCategory) {
         write_buffer += category_frame;
-        write_buffer += (*iter)->category + "\n";
+        write_buffer += (*iter)->category() + "\n";
       }
 
       write_buffer += frame;
@@ -1075,29 +1075,35 @@ bool FileStore::readOldest(/*out*/ boost::shared_ptr<logentry_vector_t> messages
 
   uint32_t bsize = 0;
   std::string message;
+  std::string category;
+  category_id_t category_id = CategoryTable::intern(categoryHandled);
   while ((loss = infile->readNext(message)) > 0) {
     if (!message.empty()) {
-      logentry_ptr_t entry = logentry_ptr_t(new LogEntry);
+      boost::shared_ptr<LogMessage> entry(new LogMessage);
 
       // check whether a category is stored with the message
       if (writeCategory) {
         // get category without trailing \n
-        entry->category = message.substr(0, message.length() - 1);
+        category.assign(message, 0, message.length() - 1);
 
         if ((loss = infile->readNext(message)) <= 0) {
           LOG_OPER("[%s] category not stored with message <%s> "
               "corruption?, incompatible config change?",
-              categoryHandled.c_str(), entry->category.c_str());
+              categoryHandled.c_str(), category.c_str());
           break;
         }
-      } else {
-        entry->category = categoryHandled;
+
+        // files usually hold long runs of the same category
+        if (category != CategoryTable::name(category_id)) {
+          category_id = CategoryTable::intern(category);
+        }
       }
 
+      entry->categoryId = category_id;
       entry->message = message;
 
       messages->push_back(entry);
-      bsize += entry->category.size();
+      bsize += entry->category().size();
       bsize += entry->message.size();
     }
   }
@@ -1984,7 +1990,8 @@ bool NetworkStore::open() {
       }
     }
 
-  } else if (remotePort <= 0 || remoteHost.empty()) {
+  } else if (remoteHost.empty() ||
+             (remotePort <= 0 && !isUnixSocketHost(remoteHost))) {
     LOG_OPER("[%s] Bad config - won't attempt to connect to <%s:%lu>",
         categoryHandled.c_str(), remoteHost.c_str(), remotePort);
     setStatus("Bad config - invalid location for remote server");
@@ -2076,24 +2083,25 @@ NetworkStore::handleMessages(boost::shared_ptr<logentry_vector_t> messages) {
 
   bool tryDummySend = shouldSendDummy(messages);
   boost::shared_ptr<logentry_vector_t> dummymessages(new logentry_vector_t);
+  logentry_vector_t rejected;
 
   if (useConnPool) {
     if (serviceBased) {
       if (!tryDummySend ||
           ((ret = g_connPool.send(serviceName, dummymessages)) == CONN_OK)) {
-        ret = g_connPool.send(serviceName, messages);
+        ret = g_connPool.send(serviceName, messages, &rejected);
       }
     } else {
       if (!tryDummySend ||
           (ret = g_connPool.send(remoteHost, remotePort, dummymessages)) ==
           CONN_OK) {
-        ret = g_connPool.send(remoteHost, remotePort, messages);
+        ret = g_connPool.send(remoteHost, remotePort, messages, &rejected);
       }
     }
   } else if (unpooledConn) {
     if (!tryDummySend ||
         ((ret = unpooledConn->send(dummymessages)) == CONN_OK)) {
-      ret = unpooledConn->send(messages);
+      ret = unpooledConn->send(messages, &rejected);
     }
   } else {
     ret = CONN_FATAL;
@@ -2103,6 +2111,11 @@ NetworkStore::handleMessages(boost::shared_ptr<logentry_vector_t> messages) {
   if (ret == CONN_FATAL) {
     close();
   }
+  if (ret != CONN_OK && !rejected.empty()) {
+    // leave only the messages the remote server turned away for our
+    // caller to retry
+    messages->swap(rejected);
+  }
   return (ret == CONN_OK);
 }
 
@@ -2531,10 +2544,9 @@ bool BucketStore::handleMessages(boost::shared_ptr<logentry_vector_t> messages)
         for (logentry_vector_t::iterator iter = batch->begin();
              iter != batch->end();
              ++iter) {
-          logentry_ptr_t entry = logentry_ptr_t(new LogEntry);
-          entry->category = (*iter)->category;
-          entry->message = getMessageWithoutKey((*iter)->message);
-          key_removed->push_back(entry);
+          key_removed->push_back(logentry_ptr_t(
+            new LogMessage((*iter)->categoryId,
+                           getMessageWithoutKey((*iter)->message))));
         }
         batch = key_removed;
       }
@@ -2648,7 +2660,8 @@ string BucketStore::getMessageWithoutKey(const std::string& message) {
 NullStore::NullStore(StoreQueue* storeq,
                      const std::string& category,
                      bool multi_category)
-  : Store(storeq, category, "null", multi_category)
+  : Store(storeq, category, "null", multi_category),
+    ignoredCounter(category, "ignored")
 {}
 
 NullStore::~NullStore() {
@@ -2676,7 +2689,7 @@ void NullStore::close() {
 }
 
 bool NullStore::handleMessages(boost::shared_ptr<logentry_vector_t> messages) {
-  g_Handler->incCounter(categoryHandled, "ignored", messages->size());
+  ignoredCounter.inc(messages->size());
   return true;
 }
 
@@ -2844,7 +2857,13 @@ bool MultiStore::handleMessages(boost::shared_ptr<logentry_vector_t> messages) {
   for (std::vector<boost::shared_ptr<Store> >::iterator iter = stores.begin();
        iter != stores.end();
        ++iter) {
-    cur_result = (*iter)->handleMessages(messages);
+    // A store that fails leaves only the messages it didn't handle in its
+    // vector, so every store but the last gets its own copy
+    boost::shared_ptr<logentry_vector_t> store_messages = messages;
+    if (iter + 1 != stores.end()) {
+      store_messages.reset(new logentry_vector_t(*messages));
+    }
+    cur_result = (*iter)->handleMessages(store_messages);
     any_result |= cur_result;
     all_result &= cur_result;
   }
@@ -2898,7 +2917,7 @@ boost::shared_ptr<Store> CategoryStore::copy(const std::string &category) {
 bool CategoryStore::open() {
   bool result = true;
 
-  for (map<string, shared_ptr<Store> >::iterator iter = stores.begin();
+  for (map<category_id_t, shared_ptr<Store> >::iterator iter = stores.begin();
       iter != stores.end();
       ++iter) {
     result &= iter->second->open();
@@ -2909,7 +2928,7 @@ bool CategoryStore::open() {
 
 bool CategoryStore::isOpen() {
 
-  for (map<string, shared_ptr<Store> >::iterator iter = stores.begin();
+  for (map<category_id_t, shared_ptr<Store> >::iterator iter = stores.begin();
       iter != stores.end();
       ++iter) {
     if (!iter->second->isOpen()) {
@@ -2966,7 +2985,7 @@ void CategoryStore::configureCommon(pStoreConf configuration,
 }
 
 void CategoryStore::close() {
-  for (map<string, shared_ptr<Store> >::iterator iter = stores.begin();
+  for (map<category_id_t, shared_ptr<Store> >::iterator iter = stores.begin();
       iter != stores.end();
       ++iter) {
     iter->second->close();
@@ -2981,17 +3000,18 @@ bool CategoryStore::handleMessages(boost::shared_ptr<logentry_vector_t> messages
   for (message_iter = messages->begin();
       message_iter != messages->end();
       ++message_iter) {
-    map<string, shared_ptr<Store> >::iterator store_iter;
+    map<category_id_t, shared_ptr<Store> >::iterator store_iter;
     shared_ptr<Store> store;
-    string category = (*message_iter)->category;
+    category_id_t category_id = (*message_iter)->categoryId;
+    const string& category = (*message_iter)->category();
 
-    store_iter = stores.find(category);
+    store_iter = stores.find(category_id);
 
     if (store_iter == stores.end()) {
       // Create new store for this category
       store = modelStore->copy(category);
       store->open();
-      stores[category] = store;
+      stores[category_id] = store;
     } else {
       store = store_iter->second;
     }
@@ -3025,7 +3045,7 @@ bool CategoryStore::handleMessages(boost::shared_ptr<logentry_vector_t> messages
 }
 
 void CategoryStore::periodicCheck() {
-  for (map<string, shared_ptr<Store> >::iterator iter = stores.begin();
+  for (map<category_id_t, shared_ptr<Store> >::iterator iter = stores.begin();
       iter != stores.end();
       ++iter) {
     iter->second->periodicCheck();
@@ -3033,7 +3053,7 @@ void CategoryStore::periodicCheck() {
 }
 
 void CategoryStore::flush() {
-  for (map<string, shared_ptr<Store> >::iterator iter = stores.begin();
+  for (map<category_id_t, shared_ptr<Store> >::iterator iter = stores.begin();
       iter != stores.end();
       ++iter) {
     iter->second->flush();
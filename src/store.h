@@ -509,6 +509,8 @@ class NullStore : public Store {
   virtual void deleteOldest(struct tm* now);
   virtual bool empty(struct tm* now);
 
+ protected:
+  CategoryCounterHandle ignoredCounter;
 
  private:
   // disallow empty constructor, copy and assignment
@@ -589,7 +591,7 @@ class CategoryStore : public Store {
   void configureCommon(pStoreConf configuration, pStoreConf parent,
                        const std::string type);
   boost::shared_ptr<Store> modelStore;
-  std::map<std::string, boost::shared_ptr<Store> > stores;
+  std::map<category_id_t, boost::shared_ptr<Store> > stores;
 
  private:
   CategoryStore();
@@ -0,0 +1,358 @@
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "store_executor.h"
+
+const unsigned StoreExecutor::MAX_THREADS;
+const unsigned StoreExecutor::TIMER_TICK_MS;
+__thread StoreExecutor* StoreExecutor::currentExecutor = NULL;
+__thread unsigned StoreExecutor::currentWorker = 0;
+
+static StoreExecutor* defaultExecutor = NULL;
+static pthread_once_t defaultExecutorOnce = PTHREAD_ONCE_INIT;
+
+static uint64_t monotonicNowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void createDefaultExecutor() {
+  long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+  defaultExecutor = new StoreExecutor(num_cores > 0 ? num_cores : 1);
+}
+
+struct WorkerArgs {
+  StoreExecutor* executor;
+  unsigned index;
+};
+
+static void* workerStarter(void* arg) {
+  WorkerArgs* args = (WorkerArgs*) arg;
+  StoreExecutor* executor = args->executor;
+  unsigned index = args->index;
+  delete args;
+  executor->workerThreadMember(index);
+  return NULL;
+}
+
+static void* timerStarter(void* this_ptr) {
+  ((StoreExecutor*) this_ptr)->timerThreadMember();
+  return NULL;
+}
+
+ExecutorTask::ExecutorTask(StoreExecutor& executor)
+  : executor(executor),
+    runState(IDLE) {
+  timer.data = this;
+}
+
+ExecutorTask::~ExecutorTask() {
+}
+
+void ExecutorTask::schedule() {
+  while (true) {
+    int state = runState;
+    if (state == IDLE) {
+      if (__sync_bool_compare_and_swap(&runState, IDLE, QUEUED)) {
+        executor.submit(this);
+        return;
+      }
+    } else if (state == RUNNING) {
+      if (__sync_bool_compare_and_swap(&runState, RUNNING, RUN_AGAIN)) {
+        return;
+      }
+    } else {
+      // queued already, so it will see whatever it was scheduled for
+      return;
+    }
+  }
+}
+
+void ExecutorTask::scheduleAfter(unsigned long delay_ms) {
+  executor.addTimer(this, monotonicNowMs() + delay_ms, false);
+}
+
+void ExecutorTask::scheduleWithin(unsigned long delay_ms) {
+  executor.addTimer(this, monotonicNowMs() + delay_ms, true);
+}
+
+void ExecutorTask::cancelTimer() {
+  executor.removeTimer(this);
+}
+
+void ExecutorTask::waitIdle() {
+  while (true) {
+    if (runState == IDLE) {
+      // the timer may have scheduled it again before it was cancelled
+      cancelTimer();
+      if (runState == IDLE) {
+        return;
+      }
+    }
+    usleep(1000);
+  }
+}
+
+// Only called by the thread that took the task from a deque
+void ExecutorTask::runTask() {
+  __sync_lock_test_and_set(&runState, RUNNING);
+  run();
+  if (!__sync_bool_compare_and_swap(&runState, RUNNING, IDLE)) {
+    // scheduled while it was running. Go to the back of the line rather
+    // than run again right away, so one busy task can't starve the others.
+    __sync_lock_test_and_set(&runState, QUEUED);
+    executor.submit(this);
+  }
+  // the task may be destroyed as soon as it is idle
+}
+
+StoreExecutor& StoreExecutor::instance() {
+  pthread_once(&defaultExecutorOnce, createDefaultExecutor);
+  return *defaultExecutor;
+}
+
+StoreExecutor::StoreExecutor(unsigned num_threads)
+  : numThreads(0),
+    nextWorker(0),
+    numQueued(0),
+    tasksRun(0),
+    tasksStolen(0),
+    numSleeping(0),
+    numSharedThreads(0),
+    numBlockingTasks(0),
+    stopping(false),
+    timerWheel(monotonicNowMs() / TIMER_TICK_MS),
+    timerWakeTick(TimerWheel::NEVER),
+    timerWakeups(0) {
+  pthread_mutex_init(&sleepMutex, NULL);
+  pthread_cond_init(&sleepCond, NULL);
+
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_mutex_init(&timerMutex, NULL);
+  pthread_cond_init(&timerCond, &attr);
+  pthread_condattr_destroy(&attr);
+
+  setNumThreads(num_threads);
+  pthread_create(&timerThread, NULL, timerStarter, (void*) this);
+}
+
+StoreExecutor::~StoreExecutor() {
+  pthread_mutex_lock(&sleepMutex);
+  stopping = true;
+  pthread_cond_broadcast(&sleepCond);
+  pthread_mutex_unlock(&sleepMutex);
+
+  pthread_mutex_lock(&timerMutex);
+  pthread_cond_signal(&timerCond);
+  pthread_mutex_unlock(&timerMutex);
+
+  pthread_join(timerThread, NULL);
+  for (unsigned i = 0; i < numThreads; ++i) {
+    pthread_join(workers[i].thread, NULL);
+    pthread_mutex_destroy(&workers[i].lock);
+  }
+
+  pthread_mutex_destroy(&sleepMutex);
+  pthread_cond_destroy(&sleepCond);
+  pthread_mutex_destroy(&timerMutex);
+  pthread_cond_destroy(&timerCond);
+}
+
+void StoreExecutor::setNumThreads(unsigned num_threads) {
+  pthread_mutex_lock(&sleepMutex);
+  numSharedThreads = std::max(numSharedThreads, num_threads);
+  growPool();
+  pthread_mutex_unlock(&sleepMutex);
+}
+
+void StoreExecutor::addBlockingTask() {
+  pthread_mutex_lock(&sleepMutex);
+  ++numBlockingTasks;
+  growPool();
+  pthread_mutex_unlock(&sleepMutex);
+}
+
+void StoreExecutor::removeBlockingTask() {
+  pthread_mutex_lock(&sleepMutex);
+  --numBlockingTasks;
+  pthread_mutex_unlock(&sleepMutex);
+}
+
+// Adds threads until there is one per blocking task on top of the shared
+// ones
+void StoreExecutor::growPool() {
+  unsigned num_threads = std::min(
+    std::max(numSharedThreads + numBlockingTasks, 1U), MAX_THREADS);
+  for (unsigned i = numThreads; i < num_threads; ++i) {
+    pthread_mutex_init(&workers[i].lock, NULL);
+    WorkerArgs* args = new WorkerArgs;
+    args->executor = this;
+    args->index = i;
+    pthread_create(&workers[i].thread, NULL, workerStarter, (void*) args);
+  }
+  if (num_threads > numThreads) {
+    // publish the new workers only once they are set up
+    __sync_synchronize();
+    numThreads = num_threads;
+  }
+}
+
+unsigned StoreExecutor::getNumThreads() {
+  return numThreads;
+}
+
+void StoreExecutor::submit(ExecutorTask* task) {
+  unsigned index = currentExecutor == this ? currentWorker :
+    __sync_fetch_and_add(&nextWorker, 1) % numThreads;
+
+  Worker& worker = workers[index];
+  pthread_mutex_lock(&worker.lock);
+  worker.tasks.push_back(task);
+  __sync_fetch_and_add(&numQueued, 1);
+  pthread_mutex_unlock(&worker.lock);
+
+  // A worker going to sleep counts itself in numSleeping before it checks
+  // numQueued, so one of the two sees the other
+  __sync_synchronize();
+  if (numSleeping) {
+    pthread_mutex_lock(&sleepMutex);
+    pthread_cond_signal(&sleepCond);
+    pthread_mutex_unlock(&sleepMutex);
+  }
+}
+
+// Takes the next task from the worker's own deque, or steals the newest
+// one from another worker's
+ExecutorTask* StoreExecutor::takeTask(unsigned index) {
+  unsigned num_threads = numThreads;
+  for (unsigned i = 0; i < num_threads; ++i) {
+    Worker& worker = workers[(index + i) % num_threads];
+    ExecutorTask* task = NULL;
+
+    pthread_mutex_lock(&worker.lock);
+    if (!worker.tasks.empty()) {
+      if (i == 0) {
+        task = worker.tasks.front();
+        worker.tasks.pop_front();
+      } else {
+        task = worker.tasks.back();
+        worker.tasks.pop_back();
+      }
+      __sync_fetch_and_sub(&numQueued, 1);
+    }
+    pthread_mutex_unlock(&worker.lock);
+
+    if (task) {
+      if (i != 0) {
+        __sync_fetch_and_add(&tasksStolen, 1);
+      }
+      return task;
+    }
+  }
+  return NULL;
+}
+
+void StoreExecutor::workerThreadMember(unsigned index) {
+  currentExecutor = this;
+  currentWorker = index;
+
+  while (true) {
+    ExecutorTask* task = takeTask(index);
+    if (task) {
+      task->runTask();
+      __sync_fetch_and_add(&tasksRun, 1);
+      continue;
+    }
+
+    pthread_mutex_lock(&sleepMutex);
+    if (stopping) {
+      pthread_mutex_unlock(&sleepMutex);
+      return;
+    }
+    __sync_fetch_and_add(&numSleeping, 1);
+    if (numQueued == 0) {
+      pthread_cond_wait(&sleepCond, &sleepMutex);
+    }
+    __sync_fetch_and_sub(&numSleeping, 1);
+    pthread_mutex_unlock(&sleepMutex);
+  }
+}
+
+void StoreExecutor::addTimer(ExecutorTask* task, uint64_t when_ms,
+                             bool keep_earlier) {
+  // round up, so a task never runs before it asked to
+  uint64_t tick = (when_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+
+  pthread_mutex_lock(&timerMutex);
+  if (!keep_earlier || !task->timer.isArmed() ||
+      tick < task->timer.expires) {
+    timerWheel.add(&task->timer, tick);
+    if (tick < timerWakeTick) {
+      // the timer thread is sleeping past it
+      pthread_cond_signal(&timerCond);
+    }
+  }
+  pthread_mutex_unlock(&timerMutex);
+}
+
+void StoreExecutor::removeTimer(ExecutorTask* task) {
+  pthread_mutex_lock(&timerMutex);
+  timerWheel.remove(&task->timer);
+  pthread_mutex_unlock(&timerMutex);
+}
+
+void StoreExecutor::timerThreadMember() {
+  std::vector<WheelTimer*> expired;
+
+  pthread_mutex_lock(&timerMutex);
+  while (true) {
+    pthread_mutex_lock(&sleepMutex);
+    bool stop = stopping;
+    pthread_mutex_unlock(&sleepMutex);
+    if (stop) {
+      break;
+    }
+
+    timerWheel.advance(monotonicNowMs() / TIMER_TICK_MS, expired);
+    for (std::vector<WheelTimer*>::iterator iter = expired.begin();
+         iter != expired.end(); ++iter) {
+      // under timerMutex, so that cancelTimer() can't miss it
+      ((ExecutorTask*) (*iter)->data)->schedule();
+    }
+    expired.clear();
+
+    timerWakeTick = timerWheel.nextTick();
+    if (timerWakeTick == TimerWheel::NEVER) {
+      pthread_cond_wait(&timerCond, &timerMutex);
+    } else {
+      uint64_t wake_ms = timerWakeTick * TIMER_TICK_MS;
+      struct timespec deadline;
+      deadline.tv_sec = wake_ms / 1000;
+      deadline.tv_nsec = (wake_ms % 1000) * 1000000;
+      pthread_cond_timedwait(&timerCond, &timerMutex, &deadline);
+    }
+    // nothing is missed while the thread is awake
+    timerWakeTick = 0;
+    ++timerWakeups;
+  }
+  pthread_mutex_unlock(&timerMutex);
+}
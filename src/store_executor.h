@@ -0,0 +1,181 @@
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+#ifndef SCRIBE_STORE_EXECUTOR_H
+#define SCRIBE_STORE_EXECUTOR_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <deque>
+#include <vector>
+
+#include "timer_wheel.h"
+
+class StoreExecutor;
+
+/*
+ * Work that StoreExecutor runs, such as a StoreQueue handling its messages,
+ * commands and periodic checks.
+ *
+ * A task runs on one thread at a time. Scheduling a task that is queued
+ * already does nothing, and scheduling one that is running makes it run
+ * once more when it is done, so no request to run is lost and the work
+ * for one task is never reordered.
+ */
+class ExecutorTask {
+ public:
+  explicit ExecutorTask(StoreExecutor& executor);
+  virtual ~ExecutorTask();
+
+  // Has the task run as soon as a thread is free
+  void schedule();
+  // Has the task scheduled in delay_ms, replacing any earlier timer for it
+  void scheduleAfter(unsigned long delay_ms);
+  // Has the task scheduled in delay_ms at the latest, keeping an earlier
+  // timer for it
+  void scheduleWithin(unsigned long delay_ms);
+  void cancelTimer();
+
+  // Waits until the task is neither queued nor running, and cancels its
+  // timer. Must be called before a derived task is destroyed, once nothing
+  // but its own timer can schedule it any more.
+  void waitIdle();
+
+ protected:
+  virtual void run() = 0;
+
+ private:
+  friend class StoreExecutor;
+
+  enum run_state_t {
+    IDLE,
+    QUEUED,
+    RUNNING,
+    RUN_AGAIN   // scheduled while running
+  };
+
+  void runTask();
+
+  StoreExecutor& executor;
+  volatile int runState;
+  WheelTimer timer;  // Owned by the executor's timerMutex
+
+  // disallow copy and assignment
+  ExecutorTask(const ExecutorTask& rhs);
+  ExecutorTask& operator=(const ExecutorTask& rhs);
+};
+
+/*
+ * Fixed pool of threads running ExecutorTasks, so that the number of
+ * threads doesn't grow with the number of categories.
+ *
+ * Every thread has its own deque of tasks. Tasks scheduled by a pool
+ * thread go to its own deque, others are spread over the deques round
+ * robin. A thread runs the tasks in its deque in order and, when it has
+ * none left, steals from the back of the others' before going to sleep.
+ * A timer thread schedules the tasks that asked to run at a later time.
+ * Their timers are kept in a timer wheel, so that arming and cancelling
+ * them costs the same however many queues there are, and the timer thread
+ * only wakes up when one is due (or, with none due within the first wheel,
+ * when the wheel comes round).
+ *
+ * Tasks block the thread they run on. A store that blocks, such as a
+ * network store connecting or an HDFS file store writing, holds a thread
+ * for as long as it takes. So that blocked stores can't hold every thread
+ * and keep the rest waiting, each task that may block adds a thread to the
+ * pool for as long as it exists, see addBlockingTask().
+ */
+class StoreExecutor {
+ public:
+  // The executor all store queues run on, sized to the number of cores
+  // until setNumThreads() says otherwise. Never destroyed.
+  static StoreExecutor& instance();
+
+  explicit StoreExecutor(unsigned num_threads);
+  ~StoreExecutor();
+
+  // Threads can be added but not taken away while tasks may be queued on
+  // them, so this only ever grows the pool. Threads for blocking tasks
+  // come on top of num_threads.
+  void setNumThreads(unsigned num_threads);
+
+  // Counts a task that may block its thread for long, growing the pool by
+  // a thread for it. The pool stays as large when the task goes away, and
+  // its thread serves the next blocking task.
+  void addBlockingTask();
+  void removeBlockingTask();
+
+  unsigned getNumThreads();
+  uint64_t getTasksRun() { return tasksRun; }
+  uint64_t getTasksStolen() { return tasksStolen; }
+  uint64_t getTimerWakeups() { return timerWakeups; }
+
+  // these need to be public for the thread creation to get to them,
+  // but no one else should ever call them.
+  void workerThreadMember(unsigned index);
+  void timerThreadMember();
+
+ private:
+  friend class ExecutorTask;
+
+  struct Worker {
+    pthread_t thread;
+    pthread_mutex_t lock;  // Must be held to read/modify tasks
+    std::deque<ExecutorTask*> tasks;
+  };
+  static const unsigned MAX_THREADS = 256;
+  // Store deadlines are in seconds, so there is no point waking up more
+  // often than this
+  static const unsigned TIMER_TICK_MS = 10;
+
+  void growPool();  // sleepMutex must be held
+  void submit(ExecutorTask* task);
+  ExecutorTask* takeTask(unsigned index);
+  void addTimer(ExecutorTask* task, uint64_t when_ms, bool keep_earlier);
+  void removeTimer(ExecutorTask* task);
+
+  // Fixed array, so that threads can read it without a lock while more
+  // are added
+  Worker workers[MAX_THREADS];
+  volatile unsigned numThreads;
+  volatile unsigned nextWorker;  // round robin for submit()
+  volatile uint64_t numQueued;   // tasks in all deques
+  volatile uint64_t tasksRun;
+  volatile uint64_t tasksStolen;
+
+  pthread_mutex_t sleepMutex;  // Must be held to read/modify the below
+  pthread_cond_t sleepCond;
+  volatile unsigned numSleeping;
+  unsigned numSharedThreads;   // as set by setNumThreads()
+  unsigned numBlockingTasks;
+  bool stopping;
+
+  pthread_t timerThread;
+  pthread_mutex_t timerMutex;  // Must be held to read/modify the below
+  pthread_cond_t timerCond;
+  TimerWheel timerWheel;
+  uint64_t timerWakeTick;  // when the timer thread will next look
+  volatile uint64_t timerWakeups;
+
+  // the pool this thread belongs to, if any, and its index in it
+  static __thread StoreExecutor* currentExecutor;
+  static __thread unsigned currentWorker;
+
+  // disallow copy and assignment
+  StoreExecutor(const StoreExecutor& rhs);
+  StoreExecutor& operator=(const StoreExecutor& rhs);
+};
+
+#endif // SCRIBE_STORE_EXECUTOR_H
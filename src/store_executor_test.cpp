@@ -0,0 +1,182 @@
+#include "store_executor.h"
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+
+#include <unistd.h>
+
+class CountingTask : public ExecutorTask {
+ public:
+  explicit CountingTask(StoreExecutor& executor, unsigned long sleep_us = 0)
+    : ExecutorTask(executor), runs(0), running(0), overlaps(0),
+      sleepUs(sleep_us), rescheduleOnce(false) {}
+
+  volatile unsigned long runs;
+  volatile int running;
+  volatile unsigned long overlaps;
+  unsigned long sleepUs;
+  bool rescheduleOnce;
+
+ protected:
+  void run() {
+    if (__sync_add_and_fetch(&running, 1) != 1) {
+      __sync_fetch_and_add(&overlaps, 1);
+    }
+    if (sleepUs) {
+      usleep(sleepUs);
+    }
+    if (rescheduleOnce) {
+      rescheduleOnce = false;
+      schedule();
+    }
+    __sync_fetch_and_add(&runs, 1);
+    __sync_fetch_and_sub(&running, 1);
+  }
+};
+
+static const unsigned NUM_TASKS = 50;
+static const unsigned NUM_SCHEDULERS = 4;
+static const unsigned SCHEDULES_PER_THREAD = 2000;
+
+static CountingTask* tasks[NUM_TASKS];
+
+static void* scheduleTasks(void*) {
+  for (unsigned i = 0; i < SCHEDULES_PER_THREAD; ++i) {
+    tasks[i % NUM_TASKS]->schedule();
+  }
+  return NULL;
+}
+
+class StoreExecutorTest : public CppUnit::TestCase {
+public:
+    CPPUNIT_TEST_SUITE(StoreExecutorTest);
+    CPPUNIT_TEST(testSchedule);
+    CPPUNIT_TEST(testRunAgain);
+    CPPUNIT_TEST(testSerialized);
+    CPPUNIT_TEST(testTimer);
+    CPPUNIT_TEST(testBlockingTasks);
+    CPPUNIT_TEST_SUITE_END();
+
+    void testSchedule() {
+        StoreExecutor executor(2);
+        CountingTask task(executor);
+        task.schedule();
+        task.waitIdle();
+        CPPUNIT_ASSERT_EQUAL(1UL, (unsigned long) task.runs);
+
+        // scheduled any number of times while running, it runs once more
+        task.sleepUs = 50000;
+        task.schedule();
+        usleep(10000);
+        task.schedule();
+        task.schedule();
+        task.waitIdle();
+        CPPUNIT_ASSERT_EQUAL(3UL, (unsigned long) task.runs);
+    }
+
+    void testRunAgain() {
+        StoreExecutor executor(1);
+        CountingTask task(executor);
+        task.rescheduleOnce = true;
+        task.schedule();
+        usleep(50000);
+        task.waitIdle();
+        CPPUNIT_ASSERT_EQUAL(2UL, (unsigned long) task.runs);
+    }
+
+    void testSerialized() {
+        StoreExecutor executor(4);
+        for (unsigned i = 0; i < NUM_TASKS; ++i) {
+            tasks[i] = new CountingTask(executor, 100);
+        }
+
+        pthread_t threads[NUM_SCHEDULERS];
+        for (unsigned i = 0; i < NUM_SCHEDULERS; ++i) {
+            pthread_create(&threads[i], NULL, scheduleTasks, NULL);
+        }
+        for (unsigned i = 0; i < NUM_SCHEDULERS; ++i) {
+            pthread_join(threads[i], NULL);
+        }
+
+        unsigned long runs = 0;
+        for (unsigned i = 0; i < NUM_TASKS; ++i) {
+            tasks[i]->waitIdle();
+            CPPUNIT_ASSERT(tasks[i]->runs >= 1);
+            CPPUNIT_ASSERT_EQUAL(0UL, (unsigned long) tasks[i]->overlaps);
+            runs += tasks[i]->runs;
+            delete tasks[i];
+        }
+        CPPUNIT_ASSERT_EQUAL((uint64_t) runs, executor.getTasksRun());
+        CPPUNIT_ASSERT_EQUAL(4U, executor.getNumThreads());
+    }
+
+    void testTimer() {
+        StoreExecutor executor(1);
+        CountingTask task(executor);
+        task.scheduleAfter(20);
+        usleep(5000);
+        CPPUNIT_ASSERT_EQUAL(0UL, (unsigned long) task.runs);
+        usleep(100000);
+        CPPUNIT_ASSERT_EQUAL(1UL, (unsigned long) task.runs);
+
+        // a later timer replaces an earlier one
+        task.scheduleAfter(10);
+        task.scheduleAfter(100000);
+        usleep(50000);
+        CPPUNIT_ASSERT_EQUAL(1UL, (unsigned long) task.runs);
+
+        task.cancelTimer();
+        task.waitIdle();
+        CPPUNIT_ASSERT_EQUAL(1UL, (unsigned long) task.runs);
+
+        // scheduleWithin() only ever brings the timer forward
+        task.scheduleAfter(20);
+        task.scheduleWithin(100000);
+        usleep(100000);
+        CPPUNIT_ASSERT_EQUAL(2UL, (unsigned long) task.runs);
+        task.scheduleAfter(100000);
+        task.scheduleWithin(20);
+        usleep(100000);
+        CPPUNIT_ASSERT_EQUAL(3UL, (unsigned long) task.runs);
+        task.waitIdle();
+    }
+
+    void testBlockingTasks() {
+        StoreExecutor executor(1);
+        CountingTask blocked(executor, 200000);
+        CountingTask other(executor);
+        executor.addBlockingTask();
+        CPPUNIT_ASSERT_EQUAL(2U, executor.getNumThreads());
+
+        // a blocked task leaves a thread for the others
+        blocked.schedule();
+        usleep(10000);
+        other.schedule();
+        usleep(50000);
+        CPPUNIT_ASSERT_EQUAL(1UL, (unsigned long) other.runs);
+        CPPUNIT_ASSERT_EQUAL(0UL, (unsigned long) blocked.runs);
+        blocked.waitIdle();
+        other.waitIdle();
+
+        // the thread is kept for the next blocking task
+        executor.removeBlockingTask();
+        executor.addBlockingTask();
+        CPPUNIT_ASSERT_EQUAL(2U, executor.getNumThreads());
+        executor.setNumThreads(2);
+        CPPUNIT_ASSERT_EQUAL(3U, executor.getNumThreads());
+        executor.removeBlockingTask();
+    }
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(StoreExecutorTest);
+
+int main(int argc, char **argv)
+{
+  CppUnit::TextUi::TestRunner runner;
+  CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+  runner.addTest( registry.makeTest() );
+  runner.run();
+  return 0;
+}
@@ -30,25 +30,32 @@ using namespace scribe::thrift;
 
 #define DEFAULT_TARGET_WRITE_SIZE  16384LL
 #define DEFAULT_MAX_WRITE_INTERVAL 1
+#define DEFAULT_JOURNAL_SEGMENT_SIZE (16 * 1024 * 1024)
 
-void* threadStatic(void *this_ptr) {
-  StoreQueue *queue_ptr = (StoreQueue*)this_ptr;
-  queue_ptr->threadMember();
-  return NULL;
-}
+StoreQueue::SizeShard StoreQueue::totalSizeShards[NUM_SIZE_SHARDS];
 
 StoreQueue::StoreQueue(const string& type, const string& category,
                        unsigned check_period, bool is_model, bool multi_category)
-  : msgQueueSize(0),
-    hasWork(false),
+  : ExecutorTask(StoreExecutor::instance()),
+    msgQueueSize(0),
+    journalSegmentSize(DEFAULT_JOURNAL_SEGMENT_SIZE),
+    failedJournalEnd(0),
+    queuedSinceMs(0),
+    pendingSinceMs(0),
+    lastQueuedMs(scribe::clock::nowInMsec()),
     stopping(false),
+    stopped(false),
     isModel(is_model),
     multiCategory(multi_category),
+    blocking(false),
     categoryHandled(category),
     checkPeriod(check_period),
     targetWriteSize(DEFAULT_TARGET_WRITE_SIZE),
     maxWriteInterval(DEFAULT_MAX_WRITE_INTERVAL),
-    mustSucceed(true) {
+    mustSucceed(true),
+    maxMsgPerSecond(0),
+    maxBytesPerSecond(0),
+    priority(PRIORITY_NORMAL) {
 
   store = Store::createStore(this, type, category,
                             false, multiCategory);
@@ -56,81 +63,244 @@ StoreQueue::StoreQueue(const string& type, const string& category,
     throw std::runtime_error("createStore failed in StoreQueue constructor. Invalid type?");
   }
   storeInitCommon();
+  // not scheduled until configureAndOpen(), as run() reads the
+  // configuration it sets
 }
 
 StoreQueue::StoreQueue(const boost::shared_ptr<StoreQueue> example,
                        const std::string &category)
-  : msgQueueSize(0),
-    hasWork(false),
+  : ExecutorTask(StoreExecutor::instance()),
+    msgQueueSize(0),
+    journalPath(example->journalPath),
+    journalSegmentSize(example->journalSegmentSize),
+    failedJournalEnd(0),
+    queuedSinceMs(0),
+    pendingSinceMs(0),
+    lastQueuedMs(scribe::clock::nowInMsec()),
     stopping(false),
+    stopped(false),
     isModel(false),
     multiCategory(example->multiCategory),
+    blocking(false),
     categoryHandled(category),
     checkPeriod(example->checkPeriod),
     targetWriteSize(example->targetWriteSize),
     maxWriteInterval(example->maxWriteInterval),
-    mustSucceed(example->mustSucceed) {
+    mustSucceed(example->mustSucceed),
+    maxMsgPerSecond(example->maxMsgPerSecond),
+    maxBytesPerSecond(example->maxBytesPerSecond),
+    priority(example->priority),
+    configKey(example->configKey) {
+
+  // every category created from a model gets its own rate limits
+  msgRateLimit.configure(maxMsgPerSecond);
+  byteRateLimit.configure(maxBytesPerSecond);
 
   store = example->copyStore(category);
   if (!store) {
     throw std::runtime_error("createStore failed copying model store");
   }
   storeInitCommon();
+  setBlocking(example->blocking);
+  // before run() can see the journal
+  openJournal();
+  schedule();
 }
 
 
 StoreQueue::~StoreQueue() {
   if (!isModel) {
+    // stopping drains the queue
+    stop();
+    waitIdle();
+  }
+  adjustTotalSize(-(long long)msgQueueSize);
+  if (!isModel) {
+    MessageBatch* batch = msgQueue.popAll();
+    while (batch) {
+      MessageBatch* next = batch->next;
+      delete batch;
+      batch = next;
+    }
     pthread_mutex_destroy(&cmdMutex);
     pthread_mutex_destroy(&msgMutex);
-    pthread_mutex_destroy(&hasWorkMutex);
-    pthread_cond_destroy(&hasWorkCond);
+    pthread_cond_destroy(&stoppedCond);
   }
+  setBlocking(false);
 }
 
-void StoreQueue::addMessage(boost::shared_ptr<LogEntry> entry) {
+void StoreQueue::addMessage(logentry_ptr_t entry) {
   if (isModel) {
     LOG_OPER("ERROR: called addMessage on model store");
   } else {
-    bool waitForWork = false;
+    MessageBatch* batch = new MessageBatch;
+    batch->messages.push_back(entry);
+    batch->size = entry->message.size();
+    pushBatch(batch);
+  }
+}
+
+// Same as addMessage() for a batch of messages, but pushes them all at once
+uint64_t StoreQueue::addMessages(const logentry_vector_t& entries) {
+  uint64_t journal_position = 0;
+
+  if (isModel) {
+    LOG_OPER("ERROR: called addMessages on model store");
+  } else if (!entries.empty()) {
+    MessageBatch* batch = new MessageBatch;
+    batch->messages = entries;
+    batch->size = 0;
+    for (logentry_vector_t::const_iterator iter = entries.begin();
+         iter != entries.end();
+         ++iter) {
+      batch->size += (*iter)->message.size();
+    }
+    journal_position = pushBatch(batch);
+  }
+
+  return journal_position;
+}
+
+// Queues a batch for run(), which takes ownership of it.
+// Returns the journal position to pass to waitDurable().
+uint64_t StoreQueue::pushBatch(MessageBatch* batch) {
+  uint64_t journal_position = 0;
+  unsigned long long batch_size = batch->size;
+
+  if (queuedSinceMs == 0) {
+    unsigned long now = scribe::clock::nowInMsec();
+    if (__sync_bool_compare_and_swap(&queuedSinceMs, 0, now)) {
+      lastQueuedMs = now;
+    }
+  }
+  unsigned long long size =
+    __sync_add_and_fetch(&msgQueueSize, batch_size);
+  adjustTotalSize(batch_size);
 
+  bool was_empty;
+  if (isJournaled()) {
+    // journaled stores still push in journal order
     pthread_mutex_lock(&msgMutex);
-    msgQueue->push_back(entry);
-    msgQueueSize += entry->message.size();
+    if (journal) {
+      journal_position = journal->append(batch->messages);
+    }
+    was_empty = msgQueue.push(batch);
+    pthread_mutex_unlock(&msgMutex);
+  } else {
+    was_empty = msgQueue.push(batch);
+  }
 
-    waitForWork = (msgQueueSize >= targetWriteSize) ? true : false;
+  // Have the store run once, when the queue becomes big enough to write.
+  // Otherwise it writes max_write_interval after messages first come in.
+  if (size >= targetWriteSize &&
+      (was_empty || size - batch_size < targetWriteSize)) {
+    schedule();
+  } else if (was_empty) {
+    scheduleWithin(1000UL * maxWriteInterval);
+  }
+
+  return journal_position;
+}
+
+// Takes everything queued for run(), along with the journal end
+// to release once it has been handled. Returns NULL if nothing was queued.
+shared_ptr<logentry_vector_t> StoreQueue::takeMessages(uint64_t& journal_end) {
+  MessageBatch* batch;
+  if (isJournaled()) {
+    pthread_mutex_lock(&msgMutex);
+    if (journal) {
+      journal_end = journal->end();
+    }
+    batch = msgQueue.popAll();
     pthread_mutex_unlock(&msgMutex);
+  } else {
+    batch = msgQueue.popAll();
+  }
 
-    // Wake up store thread if we have enough messages
-    if (waitForWork == true) {
-      // signal that there is work to do if not already signaled
-      pthread_mutex_lock(&hasWorkMutex);
-      if (!hasWork) {
-        hasWork = true;
-        pthread_cond_signal(&hasWorkCond);
-      }
-      pthread_mutex_unlock(&hasWorkMutex);
+  if (!batch) {
+    return shared_ptr<logentry_vector_t>();
+  }
+  pendingSinceMs = __sync_lock_test_and_set(&queuedSinceMs, 0);
+
+  shared_ptr<logentry_vector_t> messages(new logentry_vector_t);
+  unsigned long long size = 0;
+  while (batch) {
+    if (messages->empty()) {
+      messages->swap(batch->messages);
+    } else {
+      messages->insert(messages->end(), batch->messages.begin(),
+                       batch->messages.end());
     }
+    size += batch->size;
+    MessageBatch* next = batch->next;
+    delete batch;
+    batch = next;
   }
+  __sync_sub_and_fetch(&msgQueueSize, size);
+  adjustTotalSize(-(long long)size);
+
+  return messages;
+}
+
+// How long the oldest message that hasn't been handled yet has been waiting.
+// Reads the timestamps without msgMutex, which is good enough for
+// admission control.
+unsigned long StoreQueue::getQueueDelayMs() {
+  unsigned long pending_since = pendingSinceMs;
+  unsigned long queued_since = queuedSinceMs;
+  unsigned long oldest = pending_since ? pending_since : queued_since;
+
+  if (oldest == 0) {
+    return 0;
+  }
+  unsigned long now = scribe::clock::nowInMsec();
+  return now > oldest ? now - oldest : 0;
+}
+
+// Reads the timestamps without msgMutex, which is good enough for deciding
+// that a category has gone quiet.
+unsigned long StoreQueue::getIdleMs() {
+  if (msgQueueSize || queuedSinceMs || pendingSinceMs) {
+    return 0;
+  }
+  unsigned long last = lastQueuedMs;
+  unsigned long now = scribe::clock::nowInMsec();
+  return now > last ? now - last : 0;
+}
+
+bool StoreQueue::waitDurable(uint64_t position) {
+  if (!isJournaled()) {
+    return true;
+  }
+  shared_ptr<Journal> current_journal = getJournal();
+  if (!current_journal) {
+    // the journal could not be opened
+    return false;
+  }
+  return current_journal->waitDurable(position);
 }
 
 void StoreQueue::configureAndOpen(pStoreConf configuration) {
+  // The journal is opened right away rather than by the store thread so
+  // that no message can be queued before it would be journaled
+  configureJournal(configuration);
+  // Log() looks at the priority as soon as the category is published
+  configurePriority(configuration);
+  setBlocking(mayBlock(configuration));
+
   // model store has to handle this inline since it has no queue
   if (isModel) {
     configureInline(configuration);
   } else {
+    openJournal();
+
     pthread_mutex_lock(&cmdMutex);
     StoreCommand cmd(CMD_CONFIGURE, configuration);
     cmdQueue.push(cmd);
     pthread_mutex_unlock(&cmdMutex);
 
     // signal that there is work to do if not already signaled
-    pthread_mutex_lock(&hasWorkMutex);
-    if (!hasWork) {
-      hasWork = true;
-      pthread_cond_signal(&hasWorkCond);
-    }
-    pthread_mutex_unlock(&hasWorkMutex);
+    schedule();
   }
 }
 
@@ -146,14 +316,13 @@ void StoreQueue::stop() {
     pthread_mutex_unlock(&cmdMutex);
 
     // signal that there is work to do if not already signaled
-    pthread_mutex_lock(&hasWorkMutex);
-    if (!hasWork) {
-      hasWork = true;
-      pthread_cond_signal(&hasWorkCond);
-    }
-    pthread_mutex_unlock(&hasWorkMutex);
+    schedule();
 
-    pthread_join(storeThread, NULL);
+    pthread_mutex_lock(&cmdMutex);
+    while (!stopped) {
+      pthread_cond_wait(&stoppedCond, &cmdMutex);
+    }
+    pthread_mutex_unlock(&cmdMutex);
   }
 }
 
@@ -167,15 +336,28 @@ void StoreQueue::open() {
     pthread_mutex_unlock(&cmdMutex);
 
     // signal that there is work to do if not already signaled
-    pthread_mutex_lock(&hasWorkMutex);
-    if (!hasWork) {
-      hasWork = true;
-      pthread_cond_signal(&hasWorkCond);
-    }
-    pthread_mutex_unlock(&hasWorkMutex);
+    schedule();
   }
 }
 
+bool StoreQueue::admitMessages(unsigned long num_messages,
+                               unsigned long long num_bytes) {
+  if (!msgRateLimit.consume(num_messages)) {
+    return false;
+  }
+  if (!byteRateLimit.consume(num_bytes)) {
+    msgRateLimit.refund(num_messages);
+    return false;
+  }
+  return true;
+}
+
+void StoreQueue::refundMessages(unsigned long num_messages,
+                                unsigned long long num_bytes) {
+  msgRateLimit.refund(num_messages);
+  byteRateLimit.refund(num_bytes);
+}
+
 shared_ptr<Store> StoreQueue::copyStore(const std::string &category) {
   return store->copy(category);
 }
@@ -193,115 +375,136 @@ std::string StoreQueue::getBaseType() {
   return store->getType();
 }
 
-void StoreQueue::threadMember() {
+// One pass of the store's work: commands, periodic checks and messages.
+// The executor never runs it on two threads at once.
+void StoreQueue::run() {
   if (isModel) {
-    LOG_OPER("ERROR: store thread starting on model store, exiting");
+    LOG_OPER("ERROR: store queue scheduled on model store");
     return;
   }
 
-  if (!store) {
-    LOG_OPER("store is NULL, store thread exiting");
-    return;
-  }
-
-  // init time of last periodic check to time of 0
-  time_t last_periodic_check = 0;
-
-  time_t last_handle_messages;
-  time(&last_handle_messages);
-
-  struct timespec abs_timeout;
-
   bool stop = false;
-  while (!stop) {
 
-    // handle commands
-    //
-    pthread_mutex_lock(&cmdMutex);
-    while (!cmdQueue.empty()) {
-      StoreCommand cmd = cmdQueue.front();
-      cmdQueue.pop();
-
-      switch (cmd.command) {
-      case CMD_CONFIGURE:
-        configureInline(cmd.configuration);
-        break;
-      case CMD_OPEN:
-        openInline();
-        break;
-      case CMD_STOP:
-        stop = true;
-        break;
-      default:
-        LOG_OPER("LOGIC ERROR: unknown command to store queue");
-        break;
-      }
+  // handle commands
+  //
+  pthread_mutex_lock(&cmdMutex);
+  if (stopped) {
+    // scheduled by messages that came in as it was stopping
+    pthread_mutex_unlock(&cmdMutex);
+    return;
+  }
+  while (!cmdQueue.empty()) {
+    StoreCommand cmd = cmdQueue.front();
+    cmdQueue.pop();
+
+    switch (cmd.command) {
+    case CMD_CONFIGURE:
+      configureInline(cmd.configuration);
+      break;
+    case CMD_OPEN:
+      openInline();
+      break;
+    case CMD_STOP:
+      stop = true;
+      break;
+    default:
+      LOG_OPER("LOGIC ERROR: unknown command to store queue");
+      break;
     }
+  }
 
-    // handle periodic tasks
-    time_t this_loop;
-    time(&this_loop);
-    if (!stop && ((this_loop - last_periodic_check) >= checkPeriod)) {
-      if (store->isOpen()) {
-        store->periodicCheck();
-      }
-      last_periodic_check = this_loop;
+  // handle periodic tasks
+  time_t this_loop;
+  time(&this_loop);
+  if (!stop && ((this_loop - lastPeriodicCheck) >= checkPeriod)) {
+    if (store->isOpen()) {
+      store->periodicCheck();
     }
+    // the journal may have been closed by the store this one replaced
+    openJournal();
+    lastPeriodicCheck = this_loop;
+  }
 
-    pthread_mutex_lock(&msgMutex);
-    pthread_mutex_unlock(&cmdMutex);
-
-    boost::shared_ptr<logentry_vector_t> messages;
-
-    // handle messages if stopping, enough time has passed, or queue is large
-    //
-    if (stop ||
-        (this_loop - last_handle_messages >= maxWriteInterval) ||
-        msgQueueSize >= targetWriteSize) {
-
-      if (failedMessages) {
-        // process any messages we were not able to process last time
-        messages = failedMessages;
-        failedMessages = boost::shared_ptr<logentry_vector_t>();
-      } else if (msgQueueSize > 0) {
-        // process message in queue
-        messages = msgQueue;
-        msgQueue = boost::shared_ptr<logentry_vector_t>(new logentry_vector_t);
-        msgQueueSize = 0;
-      }
-
-      // reset timer
-      last_handle_messages = this_loop;
+  pthread_mutex_unlock(&cmdMutex);
+
+  boost::shared_ptr<logentry_vector_t> messages;
+  uint64_t journal_end = 0;
+
+  // handle messages if stopping, enough time has passed, or queue is large
+  //
+  if (stop ||
+      (this_loop - lastHandleMessages >= maxWriteInterval) ||
+      msgQueueSize >= targetWriteSize) {
+
+    if (failedMessages) {
+      // process any messages we were not able to process last time
+      messages = failedMessages;
+      journal_end = failedJournalEnd;
+      failedMessages = boost::shared_ptr<logentry_vector_t>();
+    } else if (msgQueueSize > 0) {
+      // process message in queue
+      messages = takeMessages(journal_end);
     }
 
-    pthread_mutex_unlock(&msgMutex);
+    // reset timer
+    lastHandleMessages = this_loop;
+  } else if (!failedMessages && msgQueueSize == 0) {
+    // nothing to write, so the interval starts with the next message
+    lastHandleMessages = this_loop;
+  }
 
-    if (messages) {
-      if (!store->handleMessages(messages)) {
-        // Store could not handle these messages
-        processFailedMessages(messages);
-      }
-      store->flush();
+  if (messages) {
+    if (!store->handleMessages(messages)) {
+      // Store could not handle these messages
+      processFailedMessages(messages);
     }
+    store->flush();
 
-    if (!stop) {
-      // set timeout to when we need to handle messages or do a periodic check
-      abs_timeout.tv_sec = min(last_periodic_check + checkPeriod,
-          last_handle_messages + maxWriteInterval);
-      abs_timeout.tv_nsec = 0;
+    if (!failedMessages) {
+      pendingSinceMs = 0;
+    }
 
-      // wait until there's some work to do or we timeout
-      pthread_mutex_lock(&hasWorkMutex);
-      if (!hasWork) {
-	pthread_cond_timedwait(&hasWorkCond, &hasWorkMutex, &abs_timeout);
+    shared_ptr<Journal> current_journal = getJournal();
+    if (current_journal) {
+      if (failedMessages) {
+        failedJournalEnd = journal_end;
+      } else {
+        // everything up to journal_end is handled or given up on
+        current_journal->release(journal_end);
       }
-      hasWork = false;
-      pthread_mutex_unlock(&hasWorkMutex);
     }
+  }
 
-  } // while (!stop)
+  if (!stop) {
+    // Run again for the next periodic check and, if messages are waiting,
+    // when they are due to be written, unless more work comes in first.
+    // An idle store doesn't wake up every max_write_interval: pushBatch()
+    // sets the deadline for the first messages to come in. The size is
+    // read after the periodic check timer replaces any earlier one, so a
+    // deadline set by pushBatch() in the meantime is never lost.
+    unsigned long long now_ms = scribe::clock::nowInMsec();
+    unsigned long long check_ms = 1000ULL *
+      (lastPeriodicCheck + checkPeriod);
+    scheduleAfter(check_ms > now_ms ? check_ms - now_ms : 0);
+    if (failedMessages || msgQueueSize > 0) {
+      unsigned long long write_ms = 1000ULL *
+        (lastHandleMessages + maxWriteInterval);
+      scheduleWithin(write_ms > now_ms ? write_ms - now_ms : 0);
+    }
+    return;
+  }
 
+  cancelTimer();
   store->close();
+  shared_ptr<Journal> current_journal = getJournal();
+  if (current_journal) {
+    current_journal->close();
+  }
+
+  pthread_mutex_lock(&cmdMutex);
+  stopped = true;
+  pthread_cond_broadcast(&stoppedCond);
+  pthread_mutex_unlock(&cmdMutex);
 }
 
 void StoreQueue::processFailedMessages(shared_ptr<logentry_vector_t> messages) {
@@ -314,25 +517,44 @@ void StoreQueue::processFailedMessages(shared_ptr<logentry_vector_t> messages) {
 
     LOG_OPER("[%s] WARNING: Re-queueing %lu messages!",
              categoryHandled.c_str(), messages->size());
-    g_Handler->incCounter(categoryHandled, "requeue", messages->size());
+    requeueCounter.inc(messages->size());
   } else {
     // record messages as being lost
     LOG_OPER("[%s] WARNING: Lost %lu messages!",
              categoryHandled.c_str(), messages->size());
-    g_Handler->incCounter(categoryHandled, "lost", messages->size());
+    lostCounter.inc(messages->size());
+  }
+}
+
+unsigned long long StoreQueue::getTotalSize() {
+  long long total = 0;
+  for (unsigned i = 0; i < NUM_SIZE_SHARDS; ++i) {
+    total += totalSizeShards[i].size;
+  }
+  // shards are read one at a time, so the sum can briefly go negative
+  return total > 0 ? total : 0;
+}
+
+void StoreQueue::adjustTotalSize(long long delta) {
+  if (delta != 0) {
+    __sync_fetch_and_add(&totalSizeShards[sizeShard].size, delta);
   }
 }
 
 void StoreQueue::storeInitCommon() {
+  sizeShard = ((unsigned long)this / sizeof(StoreQueue)) % NUM_SIZE_SHARDS;
+  requeueCounter = CategoryCounterHandle(categoryHandled, "requeue");
+  lostCounter = CategoryCounterHandle(categoryHandled, "lost");
+
   // model store doesn't need this stuff
   if (!isModel) {
-    msgQueue = boost::shared_ptr<logentry_vector_t>(new logentry_vector_t);
     pthread_mutex_init(&cmdMutex, NULL);
     pthread_mutex_init(&msgMutex, NULL);
-    pthread_mutex_init(&hasWorkMutex, NULL);
-    pthread_cond_init(&hasWorkCond, NULL);
+    pthread_cond_init(&stoppedCond, NULL);
 
-    pthread_create(&storeThread, NULL, threadStatic, (void*) this);
+    // init time of last periodic check to time of 0
+    lastPeriodicCheck = 0;
+    time(&lastHandleMessages);
   }
 }
 
@@ -345,6 +567,12 @@ void StoreQueue::configureInline(pStoreConf configuration) {
     maxWriteInterval = 1;
   }
 
+  configuration->getUnsignedLongLong("max_msg_per_second", maxMsgPerSecond);
+  configuration->getUnsignedLongLong("max_bytes_per_second",
+                                     maxBytesPerSecond);
+  msgRateLimit.configure(maxMsgPerSecond);
+  byteRateLimit.configure(maxBytesPerSecond);
+
   string tmp;
   if (configuration->getString("must_succeed", tmp) && tmp == "no") {
     LOG_OPER("[%s] Setting mustSucceed to false.", categoryHandled.c_str());
@@ -354,6 +582,133 @@ void StoreQueue::configureInline(pStoreConf configuration) {
   store->configure(configuration, pStoreConf());
 }
 
+void StoreQueue::configureJournal(pStoreConf configuration) {
+  configuration->getString("journal_path", journalPath);
+  configuration->getUnsignedLongLong("journal_segment_size",
+                                     journalSegmentSize);
+}
+
+// Only queues that run count towards the executor's blocking tasks. A model
+// just passes the setting on to the queues copied from it.
+void StoreQueue::setBlocking(bool is_blocking) {
+  if (!isModel && is_blocking != blocking) {
+    if (is_blocking) {
+      StoreExecutor::instance().addBlockingTask();
+    } else {
+      StoreExecutor::instance().removeBlockingTask();
+    }
+  }
+  blocking = is_blocking;
+}
+
+// Returns true if the configured store, or any store inside it, can block
+// for long: network stores and stores writing to HDFS
+bool StoreQueue::mayBlock(pStoreConf configuration) {
+  string type;
+  string fs_type;
+  if ((configuration->getString("type", type) && type == "network") ||
+      (configuration->getString("fs_type", fs_type) && fs_type == "hdfs")) {
+    return true;
+  }
+
+  vector<pStoreConf> substores;
+  configuration->getAllStores(substores);
+  for (vector<pStoreConf>::const_iterator store_iter = substores.begin();
+       store_iter != substores.end();
+       ++store_iter) {
+    if (mayBlock(*store_iter)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void StoreQueue::configurePriority(pStoreConf configuration) {
+  string tmp;
+  if (!configuration->getString("priority", tmp)) {
+    return;
+  }
+
+  if (tmp == "low") {
+    priority = PRIORITY_LOW;
+  } else if (tmp == "normal") {
+    priority = PRIORITY_NORMAL;
+  } else if (tmp == "high") {
+    priority = PRIORITY_HIGH;
+  } else {
+    LOG_OPER("[%s] Bad config - priority <%s> is not low, normal or high",
+             categoryHandled.c_str(), tmp.c_str());
+  }
+}
+
+const char* priorityName(store_priority_t priority) {
+  switch (priority) {
+  case PRIORITY_LOW:
+    return "low";
+  case PRIORITY_HIGH:
+    return "high";
+  default:
+    return "normal";
+  }
+}
+
+// Opens the journal if one is configured and queues the messages left in
+// it by the last run. While the store this one replaces still has the
+// journal open, Log() returns TRY_LATER for this store, and this is called
+// again once that store has been stopped.
+void StoreQueue::openJournal() {
+  if (isModel || journalPath.empty() || getJournal()) {
+    return;
+  }
+
+  string filename = journalPath + "/" + categoryHandled + "_" +
+    getBaseType() + ".journal";
+  if (Journal::isOpen(filename)) {
+    LOG_OPER("[%s] Journal <%s> is still open by the store this one "
+             "replaces, Log() will return TRY_LATER until it is closed",
+             categoryHandled.c_str(), filename.c_str());
+    return;
+  }
+
+  shared_ptr<Journal> new_journal(new Journal(filename, journalSegmentSize));
+  logentry_vector_t replayed;
+  if (!new_journal->open(replayed)) {
+    LOG_OPER("[%s] Failed to open journal in <%s>, Log() will return "
+             "TRY_LATER", categoryHandled.c_str(), journalPath.c_str());
+    return;
+  }
+
+  pthread_mutex_lock(&msgMutex);
+
+  // The replayed messages go ahead of any queued while the journal was
+  // still in use, which Log() didn't acknowledge
+  MessageBatch* queued = msgQueue.popAll();
+  if (!replayed.empty()) {
+    MessageBatch* batch = new MessageBatch;
+    batch->messages.swap(replayed);
+    batch->size = 0;
+    for (logentry_vector_t::const_iterator iter = batch->messages.begin();
+         iter != batch->messages.end();
+         ++iter) {
+      batch->size += (*iter)->message.size();
+    }
+    unsigned long now = scribe::clock::nowInMsec();
+    __sync_bool_compare_and_swap(&queuedSinceMs, 0, now);
+    lastQueuedMs = now;
+    __sync_add_and_fetch(&msgQueueSize, batch->size);
+    adjustTotalSize(batch->size);
+    msgQueue.push(batch);
+  }
+  while (queued) {
+    MessageBatch* next = queued->next;
+    msgQueue.push(queued);
+    queued = next;
+  }
+
+  boost::atomic_store(&journal, new_journal);
+  pthread_mutex_unlock(&msgMutex);
+}
+
 void StoreQueue::openInline() {
   if (store->isOpen()) {
     store->close();
@@ -25,15 +25,30 @@
 #define SCRIBE_STORE_QUEUE_H
 
 #include "common.h"
+#include "token_bucket.h"
+#include "counter_handle.h"
+#include "journal.h"
+#include "mpsc_queue.h"
+#include "store_executor.h"
 
 class Store;
 
+// How readily Log() sheds a store's messages as the store queues fill up
+enum store_priority_t {
+  PRIORITY_LOW,
+  PRIORITY_NORMAL,
+  PRIORITY_HIGH,
+  NUM_PRIORITIES
+};
+const char* priorityName(store_priority_t priority);
+
 /*
- * This class implements a queue and a thread for dispatching
- * events to a store. It creates a store object of the requested
- * type, which can in turn create and manage other store objects.
+ * This class implements a queue for dispatching events to a store, and
+ * runs on the shared StoreExecutor whenever there are events to handle.
+ * It creates a store object of the requested type, which can in turn
+ * create and manage other store objects.
  */
-class StoreQueue {
+class StoreQueue : public ExecutorTask {
  public:
   StoreQueue(const std::string& type, const std::string& category,
              unsigned check_period, bool is_model=false, bool multi_category=false);
@@ -42,6 +57,8 @@ class StoreQueue {
   virtual ~StoreQueue();
 
   void addMessage(logentry_ptr_t entry);
+  // Returns the journal position to pass to waitDurable()
+  uint64_t addMessages(const logentry_vector_t& entries);
   void configureAndOpen(pStoreConf configuration); // closes first if already open
   void open();                                     // closes first if already open
   void stop();
@@ -51,20 +68,75 @@ class StoreQueue {
   std::string getCategoryHandled();
   bool isModelStore() { return isModel;}
 
-  // this needs to be public for the thread creation to get to it,
-  // but no one else should ever call it.
-  void threadMember();
-
   // WARNING: don't expect this to be exact, because it could change after you check.
   //          This is only for hueristics to decide when we're overloaded.
   inline unsigned long long getSize() {
     return msgQueueSize;
   }
+
+  // Sum of getSize() over all store queues. Same caveat as getSize().
+  static unsigned long long getTotalSize();
+
+  // Takes num_messages and num_bytes from this store's rate limits.
+  // Returns false, taking nothing, if either limit would be exceeded.
+  bool admitMessages(unsigned long num_messages,
+                     unsigned long long num_bytes);
+  // Gives back what a successful admitMessages() took
+  void refundMessages(unsigned long num_messages,
+                      unsigned long long num_bytes);
+  bool isRateLimited() {
+    return msgRateLimit.isLimited() || byteRateLimit.isLimited();
+  }
+
+  unsigned long getQueueDelayMs();
+  // How long ago a message was last queued, or 0 while any message is
+  // queued or being handled. Only precise to a write interval.
+  unsigned long getIdleMs();
+
+  store_priority_t getPriority() {
+    return priority;
+  }
+
+  // Identifies the configuration the store was built from, so that
+  // reinitialize() can keep it running if that has not changed. Copies made
+  // from a model have the model's key.
+  const std::string& getConfigKey() {
+    return configKey;
+  }
+  void setConfigKey(const std::string& key) {
+    configKey = key;
+  }
+
+  // Whether messages are journaled before Log() acknowledges them
+  bool isJournaled() {
+    return !journalPath.empty();
+  }
+  // Blocks until the messages added up to position are in the journal.
+  // Returns false if they can't be made durable.
+  bool waitDurable(uint64_t position);
+  // Opens the journal if it is configured and not open yet
+  void openJournal();
+
+ protected:
+  void run();
+
  private:
+  struct MessageBatch;
+
   void storeInitCommon();
+  uint64_t pushBatch(MessageBatch* batch);
+  boost::shared_ptr<logentry_vector_t> takeMessages(uint64_t& journal_end);
+  void adjustTotalSize(long long delta);
   void configureInline(pStoreConf configuration);
   void openInline();
   void processFailedMessages(boost::shared_ptr<logentry_vector_t> messages);
+  void configureJournal(pStoreConf configuration);
+  void configurePriority(pStoreConf configuration);
+  void setBlocking(bool is_blocking);
+  static bool mayBlock(pStoreConf configuration);
+  boost::shared_ptr<Journal> getJournal() {
+    return boost::atomic_load(&journal);
+  }
 
   // implementation of queues and thread
   enum store_command_t {
@@ -84,28 +156,79 @@ class StoreQueue {
 
   typedef std::queue<StoreCommand> cmd_queue_t;
 
+  // What one addMessage() or addMessages() call queued
+  struct MessageBatch {
+    logentry_vector_t messages;
+    unsigned long long size;  // in bytes
+    MessageBatch* next;
+  };
+
   // messages and commands are in different queues to allow bulk
   // handling of messages. This means that order of commands with
   // respect to messages is not preserved.
+  // Producers push message batches without taking a lock, and run() takes
+  // all of them at once.
   cmd_queue_t cmdQueue;
-  boost::shared_ptr<logentry_vector_t> msgQueue;
+  MpscQueue<MessageBatch> msgQueue;
   boost::shared_ptr<logentry_vector_t> failedMessages;
-  unsigned long long msgQueueSize;   // in bytes
-  pthread_t storeThread;
+  // in bytes. Added to before a batch is pushed and taken from after it is
+  // taken, so it never undercounts msgQueue.
+  volatile unsigned long long msgQueueSize;
+
+  // Every change to msgQueueSize is also added to one shard of a global
+  // total so that the throttle can read the total queue size without
+  // walking every store queue. Shards are padded to separate cache lines
+  // to keep queues from contending on the same counter.
+  struct SizeShard {
+    volatile long long size;
+    char padding[64 - sizeof(long long)];
+  };
+  static const unsigned NUM_SIZE_SHARDS = 16;
+  static SizeShard totalSizeShards[NUM_SIZE_SHARDS];
+  unsigned sizeShard;  // shard this queue adds to
+
+  CategoryCounterHandle requeueCounter;
+  CategoryCounterHandle lostCounter;
+
+  // Optional write-ahead journal. Messages are appended to it and pushed
+  // under msgMutex so that journal order matches queue order, which lets
+  // the store thread release everything up to the journal end it saw when
+  // it took a batch, once the batch has been handled. openJournal() may
+  // set journal on another thread, so it is only read under msgMutex or
+  // through getJournal().
+  std::string journalPath;
+  unsigned long long journalSegmentSize;
+  boost::shared_ptr<Journal> journal;
+  uint64_t failedJournalEnd;  // journal end for failedMessages
+
+  // When the oldest message in msgQueue was queued, and when the oldest
+  // message the store thread is handling or retrying was queued. 0 if there
+  // is no such message. Without a lock queuedSinceMs can briefly read 0
+  // for a queue that a batch is being pushed to, never the other way.
+  volatile unsigned long queuedSinceMs;
+  volatile unsigned long pendingSinceMs;
+  // the last time queuedSinceMs was set, or when the queue was created
+  volatile unsigned long lastQueuedMs;
 
   // Mutexes
   pthread_mutex_t cmdMutex;     // Must be held to read/modify cmdQueue
-  pthread_mutex_t msgMutex;     // Must be held to read/modify msgQueue
-  pthread_mutex_t hasWorkMutex; // Must be held to read/modify hasWork
+                                // and stopped
+  pthread_mutex_t msgMutex;     // Must be held to use journal
   // If acquiring multiple mutexes, always acquire in this order:
-  // {cmdMutex, msgMutex, hasWorkMutex}
+  // {cmdMutex, msgMutex}
 
-  bool hasWork;  // whether there are messages or commands queued
-  pthread_cond_t hasWorkCond; // cond variable to wait on for hasWork
+  // only used by run()
+  time_t lastPeriodicCheck;
+  time_t lastHandleMessages;
 
   bool stopping;
+  bool stopped;                 // whether run() has closed the store
+  pthread_cond_t stoppedCond;   // signalled when stopped is set
   bool isModel;
   bool multiCategory; // Whether multiple categories are handled
+  // Whether the store can block its executor thread for long, e.g. on the
+  // network. Such queues are counted in StoreExecutor::addBlockingTask().
+  bool blocking;
 
   // configuration
   std::string        categoryHandled;  // what category this store is handling
@@ -113,6 +236,14 @@ class StoreQueue {
   unsigned long long targetWriteSize;  // in bytes
   time_t             maxWriteInterval; // in seconds
   bool               mustSucceed;      // Always retry even if secondary fails
+  unsigned long long maxMsgPerSecond;  // 0 means no limit
+  unsigned long long maxBytesPerSecond;// 0 means no limit
+  store_priority_t   priority;
+  std::string        configKey;
+
+  // rate limits applied in Log() to messages for this store
+  TokenBucket msgRateLimit;
+  TokenBucket byteRateLimit;
 
   // Store that will handle messages. This can contain other stores.
   boost::shared_ptr<Store> store;
@@ -0,0 +1,234 @@
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+
+#include "syslog_parser.h"
+
+#include <ctype.h>
+
+using namespace std;
+
+#define MAX_PRI 191
+
+static const char* const facilityNames[] = {
+  "kern", "user", "mail", "daemon", "auth", "syslog", "lpr", "news",
+  "uucp", "cron", "authpriv", "ftp", "ntp", "security", "console", "solaris",
+  "local0", "local1", "local2", "local3", "local4", "local5", "local6",
+  "local7"
+};
+
+static const char* const severityNames[] = {
+  "emerg", "alert", "crit", "err", "warning", "notice", "info", "debug"
+};
+
+const char* syslogFacilityName(int facility) {
+  if (facility < 0 ||
+      facility >= (int) (sizeof(facilityNames) / sizeof(facilityNames[0]))) {
+    return "unknown";
+  }
+  return facilityNames[facility];
+}
+
+const char* syslogSeverityName(int severity) {
+  if (severity < 0 ||
+      severity >= (int) (sizeof(severityNames) / sizeof(severityNames[0]))) {
+    return "unknown";
+  }
+  return severityNames[severity];
+}
+
+// Returns the token starting at pos and moves pos past the space after it
+static StringSlice nextToken(const char* data, uint32_t len, uint32_t& pos) {
+  uint32_t start = pos;
+  while (pos < len && data[pos] != ' ') {
+    ++pos;
+  }
+  StringSlice token(data + start, pos - start);
+  if (pos < len) {
+    ++pos;
+  }
+  return token;
+}
+
+// "<PRI>" with 1 to 3 digits. Returns false if there is no valid PRI.
+static bool parsePri(const char* data, uint32_t len, int& pri,
+                     uint32_t& pos) {
+  if (len < 3 || data[0] != '<') {
+    return false;
+  }
+
+  pri = 0;
+  uint32_t i = 1;
+  while (i < len && i <= 4 && isdigit((unsigned char) data[i])) {
+    pri = pri * 10 + (data[i] - '0');
+    ++i;
+  }
+  if (i == 1 || i > 4 || i >= len || data[i] != '>' || pri > MAX_PRI) {
+    return false;
+  }
+  pos = i + 1;
+  return true;
+}
+
+// "Mmm dd hh:mm:ss " as in RFC 3164
+static bool isBsdTimestamp(const char* data, uint32_t len) {
+  return len >= 16 && isalpha((unsigned char) data[0]) && data[3] == ' ' &&
+    data[6] == ' ' && data[9] == ':' && data[12] == ':' && data[15] == ' ';
+}
+
+// An RFC 3164 TAG is the program name, optionally followed by "[pid]",
+// and then ':'
+static bool isTag(const StringSlice& token, StringSlice& program) {
+  for (uint32_t i = 0; i < token.size; ++i) {
+    if (token.data[i] == '[' || token.data[i] == ':') {
+      program = StringSlice(token.data, i);
+      return i > 0;
+    }
+  }
+  return false;
+}
+
+static void parseRfc5424(const char* data, uint32_t len, SyslogMessage& msg) {
+  uint32_t pos = 0;
+  nextToken(data, len, pos);  // VERSION
+  nextToken(data, len, pos);  // TIMESTAMP
+
+  StringSlice host = nextToken(data, len, pos);
+  StringSlice program = nextToken(data, len, pos);
+  if (!(host.size == 1 && host.data[0] == '-')) {
+    msg.host = host;
+  }
+  if (!(program.size == 1 && program.data[0] == '-')) {
+    msg.program = program;
+  }
+}
+
+static void parseRfc3164(const char* data, uint32_t len, SyslogMessage& msg) {
+  uint32_t pos = 0;
+  if (isBsdTimestamp(data, len)) {
+    pos = 16;
+  }
+
+  // The HOSTNAME is often left out by local senders, in which case the
+  // first token is already the TAG
+  StringSlice token = nextToken(data, len, pos);
+  if (isTag(token, msg.program)) {
+    return;
+  }
+  msg.host = token;
+  isTag(nextToken(data, len, pos), msg.program);
+}
+
+void parseSyslog(const char* data, uint32_t len, SyslogMessage& msg) {
+  msg = SyslogMessage();
+
+  int pri;
+  uint32_t pos;
+  if (!parsePri(data, len, pri, pos)) {
+    msg.message = StringSlice(data, len);
+    return;
+  }
+
+  msg.facility = pri >> 3;
+  msg.severity = pri & 7;
+  data += pos;
+  len -= pos;
+  msg.message = StringSlice(data, len);
+
+  // RFC 5424 messages have a VERSION right after the PRI
+  if (len >= 2 && data[0] >= '1' && data[0] <= '9' && data[1] == ' ') {
+    parseRfc5424(data, len, msg);
+  } else {
+    parseRfc3164(data, len, msg);
+  }
+}
+
+SyslogCategoryMapper::SyslogCategoryMapper(const string& category_template) {
+  static const struct {
+    const char* name;
+    PartType type;
+  } fields[] = {
+    { "{facility}", FACILITY },
+    { "{severity}", SEVERITY },
+    { "{host}", HOST },
+    { "{program}", PROGRAM }
+  };
+
+  string literal;
+  size_t pos = 0;
+  while (pos < category_template.size()) {
+    bool matched = false;
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i) {
+      if (category_template.compare(pos, strlen(fields[i].name),
+                                    fields[i].name) == 0) {
+        if (!literal.empty()) {
+          Part part = { LITERAL, literal };
+          parts.push_back(part);
+          literal.clear();
+        }
+        Part part = { fields[i].type, "" };
+        parts.push_back(part);
+        pos += strlen(fields[i].name);
+        matched = true;
+        break;
+      }
+    }
+    if (!matched) {
+      literal += category_template[pos++];
+    }
+  }
+  if (!literal.empty()) {
+    Part part = { LITERAL, literal };
+    parts.push_back(part);
+  }
+}
+
+static void appendSanitized(const char* data, uint32_t size, string& out) {
+  if (size == 0) {
+    out += "unknown";
+    return;
+  }
+  for (uint32_t i = 0; i < size; ++i) {
+    char c = data[i];
+    out += (isalnum((unsigned char) c) || c == '.' || c == '-' || c == '_') ?
+      c : '_';
+  }
+}
+
+void SyslogCategoryMapper::map(const SyslogMessage& msg,
+                               string& category) const {
+  category.clear();
+  for (vector<Part>::const_iterator iter = parts.begin();
+       iter != parts.end();
+       ++iter) {
+    switch (iter->type) {
+    case LITERAL:
+      category += iter->literal;
+      break;
+    case FACILITY:
+      category += syslogFacilityName(msg.facility);
+      break;
+    case SEVERITY:
+      category += syslogSeverityName(msg.severity);
+      break;
+    case HOST:
+      appendSanitized(msg.host.data, msg.host.size, category);
+      break;
+    case PROGRAM:
+      appendSanitized(msg.program.data, msg.program.size, category);
+      break;
+    }
+  }
+}
@@ -0,0 +1,72 @@
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+
+#ifndef SCRIBE_SYSLOG_PARSER_H
+#define SCRIBE_SYSLOG_PARSER_H
+
+#include <string>
+#include <vector>
+
+#include "log_batch.h"
+
+// The parts of a syslog message used to pick its category. The slices
+// point into the parsed buffer.
+struct SyslogMessage {
+  int facility;
+  int severity;
+  StringSlice host;     // empty if the message doesn't have one
+  StringSlice program;  // APP-NAME or TAG, empty if there is none
+  StringSlice message;  // everything after the PRI
+
+  SyslogMessage() : facility(1), severity(5) {}
+};
+
+// Parses an RFC 5424 or RFC 3164 message. As RFC 3164 asks of relays,
+// anything without a valid PRI is taken as a user.notice message.
+void parseSyslog(const char* data, uint32_t len, SyslogMessage& msg);
+
+const char* syslogFacilityName(int facility);
+const char* syslogSeverityName(int severity);
+
+/*
+ * Maps syslog messages to categories with a template such as
+ * "syslog_{facility}". {facility}, {severity}, {host} and {program} are
+ * replaced by the values from the message, with characters other than
+ * letters, digits, '.', '-' and '_' replaced by '_'.
+ */
+class SyslogCategoryMapper {
+ public:
+  explicit SyslogCategoryMapper(const std::string& category_template);
+
+  void map(const SyslogMessage& msg, std::string& category) const;
+
+ private:
+  enum PartType {
+    LITERAL,
+    FACILITY,
+    SEVERITY,
+    HOST,
+    PROGRAM
+  };
+  struct Part {
+    PartType type;
+    std::string literal;
+  };
+
+  std::vector<Part> parts;
+};
+
+#endif // !defined SCRIBE_SYSLOG_PARSER_H
@@ -0,0 +1,98 @@
+#include "syslog_parser.h"
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+
+using namespace std;
+
+class SyslogParserTest : public CppUnit::TestCase {
+public:
+    CPPUNIT_TEST_SUITE(SyslogParserTest);
+    CPPUNIT_TEST(testRfc3164);
+    CPPUNIT_TEST(testRfc3164NoHost);
+    CPPUNIT_TEST(testRfc5424);
+    CPPUNIT_TEST(testNoPri);
+    CPPUNIT_TEST(testCategoryMapper);
+    CPPUNIT_TEST_SUITE_END();
+
+    string line;
+
+    // msg refers to line, so only the last parsed message is valid
+    SyslogMessage parse(const string& data) {
+        line = data;
+        SyslogMessage msg;
+        parseSyslog(line.data(), line.size(), msg);
+        return msg;
+    }
+
+    void testRfc3164() {
+        SyslogMessage msg = parse("<34>Oct 11 22:14:15 mymachine su[123]: 'su root' failed");
+        CPPUNIT_ASSERT_EQUAL(4, msg.facility);
+        CPPUNIT_ASSERT_EQUAL(2, msg.severity);
+        CPPUNIT_ASSERT_EQUAL(string("mymachine"), msg.host.str());
+        CPPUNIT_ASSERT_EQUAL(string("su"), msg.program.str());
+        CPPUNIT_ASSERT_EQUAL(line.substr(4), msg.message.str());
+    }
+
+    void testRfc3164NoHost() {
+        SyslogMessage msg = parse("<13>Feb  5 17:32:18 sshd: hello");
+        CPPUNIT_ASSERT_EQUAL(1, msg.facility);
+        CPPUNIT_ASSERT_EQUAL(5, msg.severity);
+        CPPUNIT_ASSERT(msg.host.empty());
+        CPPUNIT_ASSERT_EQUAL(string("sshd"), msg.program.str());
+    }
+
+    void testRfc5424() {
+        SyslogMessage msg = parse("<165>1 2003-10-11T22:14:15.003Z "
+                                  "mymachine.example.com evntslog - ID47 "
+                                  "[exampleSDID@32473 iut=\"3\"] message");
+        CPPUNIT_ASSERT_EQUAL(20, msg.facility);
+        CPPUNIT_ASSERT_EQUAL(5, msg.severity);
+        CPPUNIT_ASSERT_EQUAL(string("mymachine.example.com"), msg.host.str());
+        CPPUNIT_ASSERT_EQUAL(string("evntslog"), msg.program.str());
+
+        msg = parse("<14>1 - - - - - -");
+        CPPUNIT_ASSERT(msg.host.empty());
+        CPPUNIT_ASSERT(msg.program.empty());
+    }
+
+    void testNoPri() {
+        SyslogMessage msg = parse("<999>not really syslog");
+        CPPUNIT_ASSERT_EQUAL(1, msg.facility);
+        CPPUNIT_ASSERT_EQUAL(5, msg.severity);
+        CPPUNIT_ASSERT_EQUAL(string("<999>not really syslog"), msg.message.str());
+
+        msg = parse("");
+        CPPUNIT_ASSERT(msg.message.empty());
+    }
+
+    void testCategoryMapper() {
+        SyslogMessage msg = parse("<34>Oct 11 22:14:15 my/host su[1]: x");
+        string category;
+
+        SyslogCategoryMapper("syslog").map(msg, category);
+        CPPUNIT_ASSERT_EQUAL(string("syslog"), category);
+
+        SyslogCategoryMapper("syslog_{facility}_{severity}").map(msg, category);
+        CPPUNIT_ASSERT_EQUAL(string("syslog_auth_crit"), category);
+
+        SyslogCategoryMapper("{host}-{program}").map(msg, category);
+        CPPUNIT_ASSERT_EQUAL(string("my_host-su"), category);
+
+        SyslogCategoryMapper("{program}").map(parse("no pri"), category);
+        CPPUNIT_ASSERT_EQUAL(string("unknown"), category);
+    }
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(SyslogParserTest);
+
+int main(int argc, char **argv)
+{
+  CppUnit::TextUi::TestRunner runner;
+  CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+  runner.addTest( registry.makeTest() );
+  runner.run();
+  return 0;
+}
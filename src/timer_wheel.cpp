@@ -0,0 +1,146 @@
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+#include "timer_wheel.h"
+
+const unsigned TimerWheel::SLOT_BITS;
+const unsigned TimerWheel::SLOTS;
+const unsigned TimerWheel::LEVELS;
+const uint64_t TimerWheel::NEVER;
+
+static const uint64_t SLOT_MASK = TimerWheel::SLOTS - 1;
+static const uint64_t MAX_DELTA =
+  ((uint64_t)1 << (TimerWheel::SLOT_BITS * TimerWheel::LEVELS)) - 1;
+
+TimerWheel::TimerWheel(uint64_t now_tick)
+  : current(now_tick),
+    numTimers(0) {
+  for (unsigned level = 0; level < LEVELS; ++level) {
+    for (unsigned index = 0; index < SLOTS; ++index) {
+      slots[level][index].prev = &slots[level][index];
+      slots[level][index].next = &slots[level][index];
+    }
+  }
+}
+
+void TimerWheel::add(WheelTimer* timer, uint64_t expires) {
+  if (timer->isArmed()) {
+    unlink(timer);
+  } else {
+    ++numTimers;
+  }
+  timer->expires = expires;
+  // the slot for the current tick has been processed already
+  place(timer, current + 1);
+}
+
+void TimerWheel::remove(WheelTimer* timer) {
+  if (timer->isArmed()) {
+    unlink(timer);
+    --numTimers;
+  }
+}
+
+void TimerWheel::advance(uint64_t now_tick,
+                         std::vector<WheelTimer*>& _return) {
+  while (current < now_tick) {
+    processTick(current + 1, _return);
+  }
+}
+
+uint64_t TimerWheel::nextTick() const {
+  if (numTimers == 0) {
+    return NEVER;
+  }
+  for (uint64_t tick = current + 1; ; ++tick) {
+    const WheelTimer& slot = slots[0][tick & SLOT_MASK];
+    // timers may have to move down when the first wheel comes round
+    if ((tick & SLOT_MASK) == 0 || slot.next != &slot) {
+      return tick;
+    }
+  }
+}
+
+// Links timer into the slot for its expiry, as seen from current. Timers
+// that expire before earliest go in the slot for earliest.
+void TimerWheel::place(WheelTimer* timer, uint64_t earliest) {
+  uint64_t expires = timer->expires;
+  if (expires < earliest) {
+    expires = earliest;
+  }
+  uint64_t delta = expires - current;
+  if (delta > MAX_DELTA) {
+    // comes round to the right slot again after cascading
+    expires = current + MAX_DELTA;
+    delta = MAX_DELTA;
+  }
+
+  unsigned level = 0;
+  while (level + 1 < LEVELS &&
+         delta >= ((uint64_t)1 << (SLOT_BITS * (level + 1)))) {
+    ++level;
+  }
+  WheelTimer* slot =
+    &slots[level][(expires >> (SLOT_BITS * level)) & SLOT_MASK];
+
+  timer->prev = slot->prev;
+  timer->next = slot;
+  slot->prev->next = timer;
+  slot->prev = timer;
+}
+
+void TimerWheel::unlink(WheelTimer* timer) {
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->prev = NULL;
+  timer->next = NULL;
+}
+
+// Spreads the timers in a slot over the wheels below it
+void TimerWheel::cascade(unsigned level, unsigned index) {
+  WheelTimer* slot = &slots[level][index];
+  WheelTimer* timer = slot->next;
+  slot->prev = slot;
+  slot->next = slot;
+
+  while (timer != slot) {
+    WheelTimer* next = timer->next;
+    place(timer, current);
+    timer = next;
+  }
+}
+
+void TimerWheel::processTick(uint64_t tick,
+                             std::vector<WheelTimer*>& _return) {
+  current = tick;
+
+  if ((tick & SLOT_MASK) == 0) {
+    for (unsigned level = 1; level < LEVELS; ++level) {
+      unsigned index = (tick >> (SLOT_BITS * level)) & SLOT_MASK;
+      cascade(level, index);
+      if (index != 0) {
+        break;
+      }
+    }
+  }
+
+  WheelTimer* slot = &slots[0][tick & SLOT_MASK];
+  while (slot->next != slot) {
+    WheelTimer* timer = slot->next;
+    unlink(timer);
+    --numTimers;
+    _return.push_back(timer);
+  }
+}
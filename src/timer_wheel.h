@@ -0,0 +1,92 @@
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+#ifndef SCRIBE_TIMER_WHEEL_H
+#define SCRIBE_TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// A timer in a TimerWheel. The wheel links timers into its slots, so a
+// timer can be in at most one wheel and must be removed from it before it
+// is destroyed.
+struct WheelTimer {
+  WheelTimer* prev;
+  WheelTimer* next;
+  uint64_t expires;   // in ticks
+  void* data;         // for the owner of the timer
+
+  WheelTimer() : prev(NULL), next(NULL), expires(0), data(NULL) {}
+  bool isArmed() const { return prev != NULL; }
+};
+
+/*
+ * Hierarchical timer wheel, with O(1) add and remove however many timers
+ * there are.
+ *
+ * Time is counted in ticks. LEVELS wheels of SLOTS slots each cover
+ * 2^(SLOT_BITS * LEVELS) ticks: the first wheel has a slot for each of the
+ * next SLOTS ticks, and every wheel after it has a slot for each SLOTS
+ * times longer stretch. Whenever the first wheel comes round, the timers in
+ * the next slot of the second wheel are spread over the first, and so on
+ * up, so a timer is moved at most LEVELS - 1 times before it expires.
+ *
+ * Not thread safe.
+ */
+class TimerWheel {
+ public:
+  explicit TimerWheel(uint64_t now_tick);
+
+  // Arms timer to expire at expires, or at the next tick if that has gone
+  // by. Re-arms it if it is armed already.
+  void add(WheelTimer* timer, uint64_t expires);
+  void remove(WheelTimer* timer);
+
+  // Moves time forward to now_tick and appends the timers that expired to
+  // _return, earliest first. They are disarmed, so they can be added again.
+  void advance(uint64_t now_tick, std::vector<WheelTimer*>& _return);
+
+  // The tick to advance() to next: no timer expires before it, but one
+  // may expire at it or timers may have to move down a wheel. Never later
+  // than SLOTS ticks from now, and NEVER if there are no timers.
+  uint64_t nextTick() const;
+
+  uint64_t getCurrentTick() const { return current; }
+  size_t size() const { return numTimers; }
+
+  static const unsigned SLOT_BITS = 8;
+  static const unsigned SLOTS = 1 << SLOT_BITS;
+  static const unsigned LEVELS = 4;
+  static const uint64_t NEVER = ~(uint64_t)0;
+
+ private:
+  void place(WheelTimer* timer, uint64_t earliest);
+  void unlink(WheelTimer* timer);
+  void cascade(unsigned level, unsigned index);
+  void processTick(uint64_t tick, std::vector<WheelTimer*>& _return);
+
+  // Slots are circular lists with a sentinel, so linking and unlinking
+  // never has to look at which slot a timer is in
+  WheelTimer slots[LEVELS][SLOTS];
+  uint64_t current;  // last tick processed
+  size_t numTimers;
+
+  // disallow copy and assignment
+  TimerWheel(const TimerWheel& rhs);
+  TimerWheel& operator=(const TimerWheel& rhs);
+};
+
+#endif // SCRIBE_TIMER_WHEEL_H
@@ -0,0 +1,164 @@
+#include "timer_wheel.h"
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+
+#include <stdlib.h>
+
+static const unsigned NUM_RANDOM_TIMERS = 5000;
+
+class TimerWheelTest : public CppUnit::TestCase {
+public:
+    CPPUNIT_TEST_SUITE(TimerWheelTest);
+    CPPUNIT_TEST(testExpiresOnTime);
+    CPPUNIT_TEST(testRemove);
+    CPPUNIT_TEST(testPast);
+    CPPUNIT_TEST(testNextTick);
+    CPPUNIT_TEST(testRandom);
+    CPPUNIT_TEST_SUITE_END();
+
+    // Steps from one nextTick() to the next, checking every timer expires
+    // at exactly its tick
+    void testExpiresOnTime() {
+        const uint64_t start = 1000000;
+        const uint64_t deltas[] = { 1, 2, 255, 256, 257, 300, 65535, 65536,
+                                    70000, 20000000 };
+        const unsigned num_timers = sizeof(deltas) / sizeof(deltas[0]);
+
+        TimerWheel wheel(start);
+        WheelTimer timers[num_timers];
+        for (unsigned i = 0; i < num_timers; ++i) {
+            wheel.add(&timers[i], start + deltas[i]);
+        }
+        CPPUNIT_ASSERT_EQUAL((size_t) num_timers, wheel.size());
+
+        std::vector<WheelTimer*> expired;
+        unsigned seen = 0;
+        while (wheel.size() > 0) {
+            wheel.advance(wheel.nextTick(), expired);
+            for (unsigned i = 0; i < expired.size(); ++i) {
+                CPPUNIT_ASSERT_EQUAL(expired[i]->expires,
+                                     wheel.getCurrentTick());
+                CPPUNIT_ASSERT(!expired[i]->isArmed());
+                CPPUNIT_ASSERT(expired[i] == &timers[seen]);
+                ++seen;
+            }
+            expired.clear();
+        }
+        CPPUNIT_ASSERT_EQUAL(num_timers, seen);
+        CPPUNIT_ASSERT_EQUAL(TimerWheel::NEVER, wheel.nextTick());
+    }
+
+    void testRemove() {
+        TimerWheel wheel(0);
+        WheelTimer a, b;
+        wheel.add(&a, 10);
+        wheel.add(&b, 1000);
+        wheel.remove(&a);
+        wheel.remove(&a);
+        CPPUNIT_ASSERT(!a.isArmed());
+        CPPUNIT_ASSERT_EQUAL((size_t) 1, wheel.size());
+
+        // adding an armed timer moves it
+        wheel.add(&b, 20);
+        CPPUNIT_ASSERT_EQUAL((size_t) 1, wheel.size());
+
+        std::vector<WheelTimer*> expired;
+        wheel.advance(5000, expired);
+        CPPUNIT_ASSERT_EQUAL((size_t) 1, expired.size());
+        CPPUNIT_ASSERT(expired[0] == &b);
+        CPPUNIT_ASSERT_EQUAL((size_t) 0, wheel.size());
+    }
+
+    void testPast() {
+        TimerWheel wheel(500);
+        WheelTimer timer;
+        wheel.add(&timer, 100);
+
+        std::vector<WheelTimer*> expired;
+        CPPUNIT_ASSERT_EQUAL((uint64_t) 501, wheel.nextTick());
+        wheel.advance(501, expired);
+        CPPUNIT_ASSERT_EQUAL((size_t) 1, expired.size());
+    }
+
+    // The wheel is only looked at when a timer is due, or when it comes
+    // round with timers further off
+    void testNextTick() {
+        TimerWheel wheel(0);
+        WheelTimer timer;
+        wheel.add(&timer, 100000);
+
+        std::vector<WheelTimer*> expired;
+        unsigned wakeups = 0;
+        while (expired.empty()) {
+            uint64_t next = wheel.nextTick();
+            CPPUNIT_ASSERT(next <= 100000);
+            wheel.advance(next, expired);
+            ++wakeups;
+        }
+        CPPUNIT_ASSERT_EQUAL((uint64_t) 100000, wheel.getCurrentTick());
+        CPPUNIT_ASSERT(wakeups <= 100000 / TimerWheel::SLOTS + 2);
+    }
+
+    // Random timers, added, removed and moved while time jumps forward
+    void testRandom() {
+        srand(42);
+        TimerWheel wheel(12345);
+        WheelTimer* timers = new WheelTimer[NUM_RANDOM_TIMERS];
+        std::vector<WheelTimer*> expired;
+        unsigned long num_expired = 0;
+
+        for (unsigned round = 0; round < 200; ++round) {
+            for (unsigned i = 0; i < 100; ++i) {
+                WheelTimer* timer = &timers[rand() % NUM_RANDOM_TIMERS];
+                unsigned action = rand() % 4;
+                if (action == 0) {
+                    wheel.remove(timer);
+                } else {
+                    uint64_t delta = action == 1 ? rand() % 300 :
+                        action == 2 ? rand() % 100000 : rand() % 50000000;
+                    wheel.add(timer, wheel.getCurrentTick() + 1 + delta);
+                }
+            }
+
+            uint64_t before = wheel.getCurrentTick();
+            wheel.advance(before + rand() % 100000, expired);
+            for (unsigned i = 0; i < expired.size(); ++i) {
+                CPPUNIT_ASSERT(expired[i]->expires > before);
+                CPPUNIT_ASSERT(expired[i]->expires <= wheel.getCurrentTick());
+                CPPUNIT_ASSERT(!expired[i]->isArmed());
+            }
+            num_expired += expired.size();
+            expired.clear();
+
+            // nothing armed is overdue
+            size_t armed = 0;
+            for (unsigned i = 0; i < NUM_RANDOM_TIMERS; ++i) {
+                if (timers[i].isArmed()) {
+                    ++armed;
+                    CPPUNIT_ASSERT(timers[i].expires > wheel.getCurrentTick());
+                }
+            }
+            CPPUNIT_ASSERT_EQUAL(armed, wheel.size());
+        }
+        CPPUNIT_ASSERT(num_expired > 0);
+
+        for (unsigned i = 0; i < NUM_RANDOM_TIMERS; ++i) {
+            wheel.remove(&timers[i]);
+        }
+        delete [] timers;
+    }
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(TimerWheelTest);
+
+int main(int argc, char **argv)
+{
+  CppUnit::TextUi::TestRunner runner;
+  CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+  runner.addTest( registry.makeTest() );
+  runner.run();
+  return 0;
+}
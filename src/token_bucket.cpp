@@ -0,0 +1,77 @@
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+#include <time.h>
+
+#include "token_bucket.h"
+
+static const int64_t NSEC_PER_SEC = 1000000000LL;
+
+static int64_t monotonicNowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+TokenBucket::TokenBucket()
+  : now(monotonicNowNs),
+    fullAt(0),
+    rate(0),
+    burstNs(0) {
+}
+
+void TokenBucket::configure(uint64_t new_rate, uint64_t burst) {
+  if (burst == 0) {
+    burst = new_rate;
+  }
+  rate = new_rate;
+  burstNs = new_rate ? (int64_t)((double)burst * NSEC_PER_SEC / new_rate) : 0;
+}
+
+int64_t TokenBucket::cost(uint64_t amount, uint64_t rate) {
+  return (int64_t)((double)amount * NSEC_PER_SEC / rate);
+}
+
+bool TokenBucket::consume(uint64_t amount) {
+  uint64_t current_rate = rate;
+  if (current_rate == 0) {
+    return true;
+  }
+
+  int64_t current = now();
+  int64_t amount_ns = cost(amount, current_rate);
+
+  while (true) {
+    int64_t old_full_at = fullAt;
+    int64_t start = old_full_at > current ? old_full_at : current;
+    int64_t new_full_at = start + amount_ns;
+
+    // Deny if the bucket would have to go below empty, unless it is full
+    if (new_full_at - current > burstNs && start > current) {
+      return false;
+    }
+
+    if (__sync_bool_compare_and_swap(&fullAt, old_full_at, new_full_at)) {
+      return true;
+    }
+  }
+}
+
+void TokenBucket::refund(uint64_t amount) {
+  uint64_t current_rate = rate;
+  if (current_rate != 0) {
+    __sync_fetch_and_sub(&fullAt, cost(amount, current_rate));
+  }
+}
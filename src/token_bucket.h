@@ -0,0 +1,63 @@
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+#ifndef SCRIBE_TOKEN_BUCKET_H
+#define SCRIBE_TOKEN_BUCKET_H
+
+#include <stdint.h>
+
+/*
+ * Lock-free token bucket used for rate limiting.
+ *
+ * Instead of a token count the bucket keeps the time at which it will be
+ * full again (the generic cell rate algorithm), so tokens refill
+ * continuously and the whole state is a single word updated with
+ * compare-and-swap. A bucket with a rate of 0 admits everything.
+ */
+class TokenBucket {
+ public:
+  TokenBucket();
+
+  // rate is in tokens per second. burst is the bucket size in tokens;
+  // 0 means one second worth of tokens.
+  void configure(uint64_t rate, uint64_t burst = 0);
+  bool isLimited() const { return rate != 0; }
+
+  // Takes amount tokens and returns true, or returns false and takes nothing
+  // if there are not enough. A request larger than the whole bucket is
+  // admitted whenever the bucket is full, so it cannot be denied forever.
+  bool consume(uint64_t amount);
+
+  // Returns tokens taken by a successful consume()
+  void refund(uint64_t amount);
+
+  // Time source in nanoseconds, only exposed for testing
+  int64_t (*now)();
+
+ private:
+  // rate is passed in, read once by the caller, so that configure() can't
+  // set it to 0 between the caller's check and the division
+  static int64_t cost(uint64_t amount, uint64_t rate);
+
+  volatile int64_t fullAt;   // when the bucket will be full again, in ns
+  volatile uint64_t rate;    // tokens per second
+  volatile int64_t burstNs;  // time to refill an empty bucket, in ns
+
+  // disallow copy and assignment
+  TokenBucket(const TokenBucket& rhs);
+  TokenBucket& operator=(const TokenBucket& rhs);
+};
+
+#endif // SCRIBE_TOKEN_BUCKET_H
@@ -0,0 +1,91 @@
+#include "token_bucket.h"
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+
+static int64_t fakeNow = 0;
+
+static int64_t getFakeNow() {
+  return fakeNow;
+}
+
+class TokenBucketTest : public CppUnit::TestCase {
+public:
+    CPPUNIT_TEST_SUITE(TokenBucketTest);
+    CPPUNIT_TEST(testUnlimited);
+    CPPUNIT_TEST(testBurst);
+    CPPUNIT_TEST(testRefill);
+    CPPUNIT_TEST(testLargeRequest);
+    CPPUNIT_TEST(testRefund);
+    CPPUNIT_TEST_SUITE_END();
+
+    void setUp() {
+        fakeNow = 1000000000LL;
+    }
+
+    void testUnlimited() {
+        TokenBucket bucket;
+        CPPUNIT_ASSERT(!bucket.isLimited());
+        CPPUNIT_ASSERT(bucket.consume(1000000));
+    }
+
+    void testBurst() {
+        TokenBucket bucket;
+        bucket.now = getFakeNow;
+        bucket.configure(100, 10);
+        CPPUNIT_ASSERT(bucket.isLimited());
+        for (int i = 0; i < 10; i++) {
+            CPPUNIT_ASSERT(bucket.consume(1));
+        }
+        CPPUNIT_ASSERT(!bucket.consume(1));
+    }
+
+    void testRefill() {
+        TokenBucket bucket;
+        bucket.now = getFakeNow;
+        bucket.configure(100, 10);
+        CPPUNIT_ASSERT(bucket.consume(10));
+        CPPUNIT_ASSERT(!bucket.consume(1));
+
+        // 50ms refills 5 tokens at 100/sec
+        fakeNow += 50000000LL;
+        CPPUNIT_ASSERT(bucket.consume(5));
+        CPPUNIT_ASSERT(!bucket.consume(1));
+    }
+
+    void testLargeRequest() {
+        TokenBucket bucket;
+        bucket.now = getFakeNow;
+        bucket.configure(100, 10);
+
+        // admitted because the bucket is full, but it pays for it afterwards
+        CPPUNIT_ASSERT(bucket.consume(50));
+        fakeNow += 100000000LL;
+        CPPUNIT_ASSERT(!bucket.consume(1));
+        fakeNow += 400000000LL;
+        CPPUNIT_ASSERT(bucket.consume(1));
+    }
+
+    void testRefund() {
+        TokenBucket bucket;
+        bucket.now = getFakeNow;
+        bucket.configure(100, 10);
+        CPPUNIT_ASSERT(bucket.consume(10));
+        bucket.refund(4);
+        CPPUNIT_ASSERT(bucket.consume(4));
+        CPPUNIT_ASSERT(!bucket.consume(1));
+    }
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(TokenBucketTest);
+
+int main(int argc, char **argv)
+{
+  CppUnit::TextUi::TestRunner runner;
+  CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+  runner.addTest( registry.makeTest() );
+  runner.run();
+  return 0;
+}
@@ -0,0 +1,50 @@
+<?php
+//  Copyright (c) 2007-2008 Facebook
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+// See accompanying file LICENSE or visit the Scribe site at:
+// http://developers.facebook.com/scribe/
+
+include_once 'tests.php';
+include_once 'testutil.php';
+
+// Measures Log() throughput for an increasing number of Thrift server
+// threads. Each run starts scribed with scribe.conf.logthroughput and sends
+// messages from many concurrent clients to a few hot categories.
+
+if ($argc > 1) {
+  $num_clients = $argv[1];
+} else {
+  $num_clients = 32;
+}
+
+$thread_counts = array(1, 2, 4, 8, 16);
+$template = file_get_contents('scribe.conf.logthroughput');
+system("mkdir -p /tmp/scribetest_");
+
+foreach ($thread_counts as $threads) {
+  $config = "/tmp/scribetest_/scribe.conf.logthroughput.$threads";
+  file_put_contents($config, str_replace('NUM_THRIFT_SERVER_THREADS',
+                                         $threads, $template));
+
+  $pid = scribe_start("logthroughput.$threads", $GLOBALS['SCRIBE_BIN'],
+                      $GLOBALS['SCRIBE_PORT'], $config);
+
+  $rate = log_throughput_test('logthroughput', $num_clients, 320000, 50, 100, 4);
+  printf("num_thrift_server_threads=%d: %d msgs/sec\n", $threads, $rate);
+
+  scribe_stop($GLOBALS['SCRIBE_CTRL'], $GLOBALS['SCRIBE_PORT'], $pid);
+}
+
+?>
@@ -525,4 +525,36 @@ function super_stress_test($categories, $client_name, $rate, $total,
   }
 }
 
+// Sends $total messages from $num_clients concurrent client processes as
+// fast as the server accepts them. Returns the number of messages per second.
+function log_throughput_test($category, $num_clients, $total, $msg_per_call,
+                            $avg_size, $num_categories) {
+  $pids = array();
+  $start = microtime(true);
+
+  for ($client = 0; $client < $num_clients; ++$client) {
+    $pid = pcntl_fork();
+
+    if ($pid == -1) {
+      print "Error: Could not fork\n";
+      return 0;
+    } else if ($pid == 0) {
+      // In child process, send without any rate limit
+      stress_test($category, "client$client", PHP_INT_MAX,
+                  $total / $num_clients, $msg_per_call, $avg_size,
+                  $num_categories);
+      Exit(0);
+    } else {
+      $pids[] = $pid;
+    }
+  }
+
+  foreach ($pids as $pid) {
+    pcntl_waitpid($pid, $status);
+  }
+
+  $elapsed = microtime(true) - $start;
+  return $elapsed > 0 ? $total / $elapsed : 0;
+}
+
 ?>